@@ -1,15 +1,42 @@
 #version 460
 #define MAX_LIGHTS 1000
 
+#ifndef LOW_RES_LIGHTING
+// Background pixels are rejected by the stencil test before shading
+layout(early_fragment_tests) in;
+#endif
+
 in vec2 fUV;
 
-uniform sampler2D positionTexture;
-uniform sampler2D normalTexture;
-uniform sampler2D colorTexture;
+#include "gbufferDecode.glsl"
 
 uniform vec3 cameraPos;
 
-out vec4 fCol;
+#ifdef LOW_RES_LIGHTING
+// Lighting is demodulated (no albedo) so upsample.fs can reapply full resolution albedo
+uniform int lightingDownscale;
+
+layout (location = 0) out vec4 diffuseOut;
+layout (location = 1) out vec4 specularOut;
+layout (location = 2) out vec4 guideOut;
+#else
+layout (location = 0) out vec4 fCol;
+#endif
+
+#ifdef TEMPORAL_LIGHTING
+// Each frame shades one interleaved slice of the lights and blends it into last frame's reprojected lighting
+uniform sampler2D historyTexture;
+uniform int historyAvailable;
+uniform mat4 previousViewProjection;
+uniform vec3 previousCameraPos;
+uniform vec2 previousRenderSize;
+uniform int temporalSlices;
+uniform int frameIndex;
+uniform float historyWeight;
+
+// Lighting (without ambient) and view distance, the distance is used to reject disoccluded history
+layout (location = 1) out vec4 historyOut;
+#endif
 
 const float linearFalloff = 0.09;
 const float quadraticFalloff = 0.032;
@@ -27,35 +54,92 @@ layout (std140) uniform LightsBlock {
 };
 uniform int lightCount;
 
-void main() {
-	vec3 fPos = texture2D(positionTexture, fUV).xyz;
-	vec3 fNormal = texture2D(normalTexture, fUV).xyz;
-	vec3 color = texture2D(colorTexture, fUV).xyz;
-	// Use depth buffer, would need to copy framebuffer depth buffer into default depth buffer
-	if (fNormal == vec3(0.0)) discard;
+void shadeLight(int i, vec3 fPos, vec3 unitNormal, vec3 cameraDir, inout vec3 diffuseLighting, inout vec3 specularLighting) {
+	Light light = lights[i];
+
+	vec3 lightDir = normalize(light.position - fPos);
+	vec3 halfwayDir = normalize(lightDir + cameraDir);
 
-	vec3 lighting = vec3(0.0);
-	vec3 unitNormal = normalize(fNormal);
+	vec3 diffuse = max(dot(lightDir, unitNormal), 0.0) * light.color;
 
-	for (int i=0; i<lightCount; i++) {
-		Light light = lights[i];
+	vec3 specular = specularStrength * pow(max(dot(unitNormal, halfwayDir), 0.0), shininess) * light.color;
 
-		vec3 lightDir = normalize(light.position - fPos);
-		vec3 cameraDir = normalize(cameraPos - fPos);
-      	vec3 halfwayDir = normalize(lightDir + cameraDir);
+	float distance = length(light.position - fPos);
+	float attenuation = 1.0 / (1.0 + linearFalloff * distance + quadraticFalloff * (distance * distance));
+	
+	diffuseLighting += diffuse*attenuation*light.power;
+	specularLighting += specular*attenuation*light.power;
+}
 
-		vec3 diffuse = max(dot(lightDir, unitNormal), 0.0) * color * light.color;
+#ifdef TEMPORAL_LIGHTING
+bool historyValid(vec3 fPos, out vec4 history) {
+	history = vec4(0.0);
+	if (historyAvailable == 0) return false;
 
-		vec3 specular = specularStrength * pow(max(dot(unitNormal, halfwayDir), 0.0), shininess) * light.color;
+	vec4 previousClip = previousViewProjection * vec4(fPos, 1.0);
+	if (previousClip.w <= 0.0) return false;
+	vec2 previousUV = previousClip.xy / previousClip.w * 0.5 + 0.5;
+	if (any(lessThan(previousUV, vec2(0.0))) || any(greaterThanEqual(previousUV, vec2(1.0)))) return false;
 
-		float distance = length(lights[i].position - fPos);
-      	float attenuation = 1.0 / (1.0 + linearFalloff * distance + quadraticFalloff * (distance * distance));
-		
-		lighting += (diffuse + specular)*attenuation*light.power;
-		// lighting += (specular)*attenuation*light.power;
+	// Disocclusion: the history texel must have seen this surface at the distance it should have been from last frame's camera
+	history = texelFetch(historyTexture, ivec2(previousUV * previousRenderSize), 0);
+	float expectedDistance = distance(previousCameraPos, fPos);
+	return history.a >= 0.0 && abs(history.a - expectedDistance) < 0.02 * expectedDistance + 0.05;
+}
+#endif
+
+void main() {
+#ifdef LOW_RES_LIGHTING
+	// Sample the centre of this texel's full resolution footprint
+	GBufferSample g = readGBuffer(min(ivec2(gl_FragCoord.xy) * lightingDownscale + lightingDownscale/2, ivec2(renderSize) - 1));
+	if (!g.geometry) {
+		diffuseOut = vec4(0.0);
+		specularOut = vec4(0.0);
+		guideOut = vec4(0.0, 0.0, 0.0, -1.0);
+		return;
 	}
-	lighting += 0.05 * color;
+#else
+	GBufferSample g = readGBuffer(ivec2(gl_FragCoord.xy));
+#endif
+	vec3 fPos = g.position;
+	vec3 unitNormal = g.normal;
+	vec3 color = g.color;
+
+	vec3 diffuseLighting = vec3(0.0);
+	vec3 specularLighting = vec3(0.0);
+	vec3 cameraDir = normalize(cameraPos - fPos);
+
+#ifdef TEMPORAL_LIGHTING
+	vec4 history;
+	bool useHistory = historyValid(fPos, history);
+
+	// Neighbouring pixels shade different slices, disoccluded pixels shade every light so their history starts converged
+	int stride = useHistory ? temporalSlices : 1;
+	int pixelSlice = (int(gl_FragCoord.x) + 2*int(gl_FragCoord.y) + frameIndex) % temporalSlices;
+	int first = useHistory ? pixelSlice : 0;
+
+	for (int i=first; i<lightCount; i+=stride)
+		shadeLight(i, fPos, unitNormal, cameraDir, diffuseLighting, specularLighting);
+
+	// A slice is an unbiased estimate of the full sum once scaled by the slice count
+	vec3 lighting = (diffuseLighting*color + specularLighting) * float(stride);
+	if (useHistory) lighting = mix(lighting, history.rgb, historyWeight);
+
+	historyOut = vec4(lighting, distance(cameraPos, fPos));
+	fCol = vec4(lighting + 0.05*color, 1.0);
+#else
+	for (int i=0; i<lightCount; i++)
+		shadeLight(i, fPos, unitNormal, cameraDir, diffuseLighting, specularLighting);
+
+#ifdef LOW_RES_LIGHTING
+	diffuseOut = vec4(diffuseLighting, 1.0);
+	specularOut = vec4(specularLighting, 1.0);
+	guideOut = vec4(unitNormal, distance(cameraPos, fPos));
+#else
+	vec3 lighting = diffuseLighting*color + specularLighting + 0.05*color;
 
 	fCol = vec4(lighting, 1.0);
 	// fCol = vec4(vec3(lights[0].color), 1.0);
-}
\ No newline at end of file
+#endif
+#endif
+}
@@ -8,6 +8,27 @@ in vec3 color;
 
 uniform vec3 cameraPos;
 
+#ifdef COMPACT_GBUFFER
+// Position is reconstructed from the depth buffer in the lighting pass
+layout (location = 0) out vec2 normalOut;
+layout (location = 1) out vec4 colorOut;
+
+// Octahedral normal encoding: https://knarkowicz.wordpress.com/2014/04/16/octahedron-normal-vector-encoding/
+vec2 octWrap(vec2 v) {
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	n.xy = n.z >= 0.0 ? n.xy : octWrap(n.xy);
+	return n.xy;
+}
+
+void main() {
+	normalOut = octEncode(normalize(fNormal));
+	colorOut = vec4(color, 1.0);
+}
+#else
 layout (location = 0) out vec3 positionOut;
 layout (location = 1) out vec3 normalOut;
 layout (location = 2) out vec3 colorOut;
@@ -16,4 +37,5 @@ void main() {
 	positionOut = fPos;
 	normalOut = normalize(fNormal);
 	colorOut = color;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
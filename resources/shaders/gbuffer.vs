@@ -1,20 +1,56 @@
 #version 460
 
+#ifdef QUANTISED_VERTICES
+// snorm16 position relative to the mesh bounds, snorm 10:10:10:2 normal (vertex_format.hpp)
+layout(location=0) in vec4 vPos;
+layout(location=1) in vec4 vNormal;
+#else
 layout(location=0) in vec3 vPos;
 layout(location=1) in vec3 vNormal;
+#endif
 layout(location=2) in vec3 positionIn;
 layout(location=3) in vec3 colorIn;
+layout(location=4) in uint meshIn;
+layout(location=5) in vec4 rotationIn;	// Unit quaternion
+layout(location=6) in float scaleIn;
 
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+#ifdef QUANTISED_VERTICES
+struct MeshQuantisation {
+	vec3 center;
+	vec3 halfExtent;
+};
+
+layout(std430, binding=5) readonly buffer MeshQuantisationBuffer {
+	MeshQuantisation meshQuantisation[];
+};
+#endif
+
+// Per frame, see frameResources in main.cpp
+layout(std140, binding=1) uniform CameraBlock {
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+};
 
 out vec3 fPos;
 out vec3 fNormal;
 out vec3 color;
 
+vec3 rotate(vec4 q, vec3 v) {
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
 void main() {
 	color = colorIn;
+#ifdef QUANTISED_VERTICES
+	MeshQuantisation quantisation = meshQuantisation[meshIn];
+	vec3 position = quantisation.center + vPos.xyz * quantisation.halfExtent;
+	fNormal = vNormal.xyz;
+#else
+	vec3 position = vPos;
 	fNormal = vNormal;
-	fPos = vPos + positionIn;
+#endif
+	// Uniform scale, so normals only need the rotation
+	fNormal = rotate(rotationIn, fNormal);
+	fPos = rotate(rotationIn, position) * scaleIn + positionIn;
 	gl_Position = projectionMatrix * viewMatrix * vec4(fPos, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,55 @@
+// Shared G-buffer decoding for passes that read the G-buffer, resolved by loadShaderSource()
+
+#ifdef COMPACT_GBUFFER
+uniform sampler2D depthTexture;
+uniform mat4 inverseViewProjection;
+#else
+uniform sampler2D positionTexture;
+#endif
+uniform sampler2D normalTexture;
+uniform sampler2D colorTexture;
+
+// Internal resolution, the G-buffer textures are allocated larger for dynamic resolution
+uniform vec2 renderSize;
+
+struct GBufferSample {
+	vec3 position;
+	vec3 normal;
+	vec3 color;
+	bool geometry;
+};
+
+#ifdef COMPACT_GBUFFER
+vec3 octDecode(vec2 f) {
+	vec3 n = vec3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+vec3 reconstructPosition(vec2 uv, float depth) {
+	vec4 clipPos = vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	vec4 worldPos = inverseViewProjection * clipPos;
+	return worldPos.xyz / worldPos.w;
+}
+#endif
+
+GBufferSample readGBuffer(ivec2 texel) {
+	GBufferSample g;
+#ifdef COMPACT_GBUFFER
+	float depth = texelFetch(depthTexture, texel, 0).r;
+	vec2 uv = (vec2(texel) + 0.5) / renderSize;
+
+	g.position = reconstructPosition(uv, depth);
+	g.normal = octDecode(texelFetch(normalTexture, texel, 0).xy);
+	g.geometry = depth < 1.0;
+#else
+	vec3 normal = texelFetch(normalTexture, texel, 0).xyz;
+
+	g.position = texelFetch(positionTexture, texel, 0).xyz;
+	g.normal = normal == vec3(0.0) ? normal : normalize(normal);
+	g.geometry = normal != vec3(0.0);
+#endif
+	g.color = texelFetch(colorTexture, texel, 0).xyz;
+	return g;
+}
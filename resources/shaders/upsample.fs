@@ -0,0 +1,75 @@
+#version 460
+
+// Only geometry pixels are upsampled, same stencil as the full resolution lighting pass
+layout(early_fragment_tests) in;
+
+in vec2 fUV;
+
+#include "gbufferDecode.glsl"
+
+uniform sampler2D diffuseTexture;
+uniform sampler2D specularTexture;
+uniform sampler2D guideTexture;
+
+uniform vec3 cameraPos;
+uniform int lightingDownscale;
+uniform ivec2 lowResSize;
+
+out vec4 fCol;
+
+// Depth similarity is relative to view distance, normal similarity is a cosine lobe
+const float depthSigma = 0.05;
+const float normalPower = 32.0;
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	GBufferSample g = readGBuffer(texel);
+	float depth = distance(cameraPos, g.position);
+
+	// Bilinear footprint in the low resolution targets
+	vec2 lowResPos = (vec2(texel) + 0.5) / float(lightingDownscale) - 0.5;
+	ivec2 base = ivec2(floor(lowResPos));
+	vec2 f = lowResPos - vec2(base);
+
+	vec3 diffuse = vec3(0.0);
+	vec3 specular = vec3(0.0);
+	float totalWeight = 0.0;
+
+	// Fallback when every tap is rejected: the tap closest in depth
+	ivec2 closestTap = clamp(base, ivec2(0), lowResSize - 1);
+	float closestDepthDiff = 1e30;
+
+	for (int i=0; i<4; i++) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = clamp(base + offset, ivec2(0), lowResSize - 1);
+
+		vec4 guide = texelFetch(guideTexture, tap, 0);
+		if (guide.w < 0.0) continue;
+
+		float depthDiff = abs(guide.w - depth);
+		if (depthDiff < closestDepthDiff) {
+			closestDepthDiff = depthDiff;
+			closestTap = tap;
+		}
+
+		float bilinearWeight = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+		float depthWeight = exp(-depthDiff / (depthSigma * depth));
+		float normalWeight = pow(max(dot(guide.xyz, g.normal), 0.0), normalPower);
+		float weight = max(bilinearWeight, 0.001) * depthWeight * normalWeight;
+
+		diffuse += texelFetch(diffuseTexture, tap, 0).rgb * weight;
+		specular += texelFetch(specularTexture, tap, 0).rgb * weight;
+		totalWeight += weight;
+	}
+
+	if (totalWeight > 0.0001) {
+		diffuse /= totalWeight;
+		specular /= totalWeight;
+	}
+	else {
+		diffuse = texelFetch(diffuseTexture, closestTap, 0).rgb;
+		specular = texelFetch(specularTexture, closestTap, 0).rgb;
+	}
+
+	fCol = vec4(diffuse*g.color + specular + 0.05*g.color, 1.0);
+}
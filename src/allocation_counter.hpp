@@ -0,0 +1,63 @@
+#pragma once
+
+// Heap allocation counting
+//
+// ALLOCATION_COUNTER_REPLACE_OPERATORS, expanded once at namespace scope in a program's main translation unit, replaces
+// the global operator new / delete with malloc / free wrappers that count every allocation (any thread, including the
+// standard library's). Code measures a section by differencing allocationCount() around it, e.g. one frame. Without
+// the macro the count stays at 0.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace allocationCounter {
+	inline std::atomic<uint64_t> allocations {0};
+}
+
+inline uint64_t allocationCount() {
+	return allocationCounter::allocations.load(std::memory_order_relaxed);
+}
+
+inline void* countedAllocate(std::size_t size) {
+	allocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* pointer = std::malloc(size ? size : 1)) return pointer;
+	throw std::bad_alloc();
+}
+
+inline void* countedAllocateAligned(std::size_t size, std::align_val_t alignment) {
+	allocationCounter::allocations.fetch_add(1, std::memory_order_relaxed);
+	std::size_t align = (std::size_t)alignment;
+#ifdef _MSC_VER
+	void* pointer = _aligned_malloc(size ? size : 1, align);
+#else
+	void* pointer = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+#endif
+	if (pointer) return pointer;
+	throw std::bad_alloc();
+}
+
+inline void countedFreeAligned(void* pointer) {
+#ifdef _MSC_VER
+	_aligned_free(pointer);
+#else
+	std::free(pointer);
+#endif
+}
+
+#define ALLOCATION_COUNTER_REPLACE_OPERATORS \
+	void* operator new(std::size_t size) { return countedAllocate(size); } \
+	void* operator new[](std::size_t size) { return countedAllocate(size); } \
+	void* operator new(std::size_t size, std::align_val_t alignment) { return countedAllocateAligned(size, alignment); } \
+	void* operator new[](std::size_t size, std::align_val_t alignment) { return countedAllocateAligned(size, alignment); } \
+	void operator delete(void* pointer) noexcept { std::free(pointer); } \
+	void operator delete[](void* pointer) noexcept { std::free(pointer); } \
+	void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); } \
+	void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); } \
+	void operator delete(void* pointer, std::align_val_t) noexcept { countedFreeAligned(pointer); } \
+	void operator delete[](void* pointer, std::align_val_t) noexcept { countedFreeAligned(pointer); } \
+	void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { countedFreeAligned(pointer); } \
+	void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { countedFreeAligned(pointer); }
@@ -0,0 +1,539 @@
+#pragma once
+
+// Linear BVH (LBVH) over object bounds
+//
+// Objects are sorted along a 30 bit Morton curve of their centroids, grouped into leaves of BVH_LEAF_SIZE consecutive
+// objects and split top-down at the highest differing Morton bit. Nodes live in a flat array in depth first order: a
+// node's left child directly follows it and its subtree is a contiguous range of nodes and of sorted objects, so a
+// node fully inside a query is emitted as one object range without visiting its children.
+//
+// Moved objects are refit in place (walking dirty leaves up to the root, or a full bottom-up sweep when many moved),
+// the tree is rebuilt once refitting has degraded its SAH cost past rebuildThreshold.
+//
+// Objects with empty bounds (free slots of the object pool) stay in the tree but are never returned by queries.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "parallel.hpp"
+#include "scene_format.hpp"
+
+struct Aabb {
+	float min[3];
+	float max[3];
+
+	void expand(const Aabb& other) {
+		for (int axis=0; axis<3; axis++) {
+			min[axis] = std::min(min[axis], other.min[axis]);
+			max[axis] = std::max(max[axis], other.max[axis]);
+		}
+	}
+
+	// No volume, e.g. an unused object slot
+	bool isEmpty() const {
+		return min[0] > max[0];
+	}
+
+	float surfaceArea() const {
+		if (isEmpty()) return 0.0f;
+		float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+		return 2.0f * (x*y + y*z + z*x);
+	}
+
+	static Aabb empty() {
+		return {{INFINITY, INFINITY, INFINITY}, {-INFINITY, -INFINITY, -INFINITY}};
+	}
+};
+
+// World space bounds of every object: its mesh's bounds offset by the object position
+inline std::vector<Aabb> computeObjectBounds(const SceneView& scene) {
+	std::vector<Aabb> meshBounds(scene.meshCount, Aabb::empty());
+	for (uint64_t m=0; m<scene.meshCount; m++) {
+		auto& mesh = scene.meshes[m];
+		for (uint32_t v=0; v<mesh.vertexCount; v++) {
+			const float* position = scene.vertices + (uint64_t)(mesh.firstVertex + v) * SCENE_FLOATS_PER_VERTEX;
+			meshBounds[m].expand({{position[0], position[1], position[2]}, {position[0], position[1], position[2]}});
+		}
+	}
+
+	std::vector<Aabb> bounds(scene.objectCount);
+	parallelFor(scene.objectCount, 16384, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			auto& mesh = meshBounds[scene.objectMeshes[i]];
+			const float* position = scene.objectPositions + i*3;
+			for (int axis=0; axis<3; axis++) {
+				bounds[i].min[axis] = mesh.min[axis] + position[axis];
+				bounds[i].max[axis] = mesh.max[axis] + position[axis];
+			}
+		}
+	});
+	return bounds;
+}
+
+// Six planes (ax + by + cz + d >= 0 inside) of a column major OpenGL view projection matrix
+struct Frustum {
+	float planes[6][4];
+
+	explicit Frustum(const float* viewProjection) {
+		auto row = [&](int r, int c) { return viewProjection[c*4 + r]; };
+		for (int p=0; p<6; p++) {
+			int axis = p / 2;
+			float sign = p % 2 == 0 ? 1.0f : -1.0f;
+			for (int c=0; c<4; c++) planes[p][c] = row(3, c) + sign * row(axis, c);
+
+			float length = std::sqrt(planes[p][0]*planes[p][0] + planes[p][1]*planes[p][1] + planes[p][2]*planes[p][2]);
+			for (int c=0; c<4; c++) planes[p][c] /= length;
+		}
+	}
+};
+
+constexpr const uint32_t BVH_LEAF_SIZE = 4;
+
+struct BvhNode {
+	float min[3];
+	uint32_t firstObject;	// Into the sorted object order
+	float max[3];
+	uint32_t objectCount;	// Leaves hold at most BVH_LEAF_SIZE objects, internal nodes always more
+};
+
+class Bvh {
+	std::vector<Aabb> objectBounds;
+	std::vector<uint32_t> objectOrder;		// Object indices in Morton order
+	std::vector<uint32_t> objectLeaf;		// Leaf node holding each object
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> parents;
+	std::vector<uint32_t> dirtyObjects;
+
+	float builtCost = 0.0f;
+	uint64_t refitObjectsSinceCheck = 0;
+
+	static uint32_t expandBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	static void setBounds(BvhNode& node, const Aabb& bounds) {
+		std::copy(bounds.min, bounds.min + 3, node.min);
+		std::copy(bounds.max, bounds.max + 3, node.max);
+	}
+
+	static Aabb getBounds(const BvhNode& node) {
+		return {{node.min[0], node.min[1], node.min[2]}, {node.max[0], node.max[1], node.max[2]}};
+	}
+
+	static bool isLeaf(const BvhNode& node) {
+		return node.objectCount <= BVH_LEAF_SIZE;
+	}
+
+	// The left child follows its parent, the right child follows the left subtree (2 * leaves - 1 nodes)
+	uint32_t rightChild(uint32_t node) const {
+		return node + 2 * ((nodes[node + 1].objectCount + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE);
+	}
+
+	// Recomputes a node's bounds from its objects or children, returns whether they changed
+	bool refitNode(uint32_t index) {
+		auto& node = nodes[index];
+		Aabb bounds = Aabb::empty();
+		if (isLeaf(node)) {
+			for (uint32_t i=node.firstObject; i<node.firstObject + node.objectCount; i++) bounds.expand(objectBounds[objectOrder[i]]);
+		}
+		else {
+			bounds = getBounds(nodes[index + 1]);
+			bounds.expand(getBounds(nodes[rightChild(index)]));
+		}
+
+		bool changed = !std::equal(bounds.min, bounds.min + 3, node.min) || !std::equal(bounds.max, bounds.max + 3, node.max);
+		setBounds(node, bounds);
+		return changed;
+	}
+
+	// Sets up the node over [firstLeaf, endLeaf) and its children's parent links, returns the first leaf of its right
+	// child (0 for a leaf). Bounds are left to refitNode() once the children are built.
+	uint32_t splitNode(uint32_t index, uint32_t firstLeaf, uint32_t endLeaf, const std::vector<uint32_t>& codes) {
+		auto& node = nodes[index];
+		node.firstObject = firstLeaf * BVH_LEAF_SIZE;
+		node.objectCount = std::min<uint32_t>(endLeaf * BVH_LEAF_SIZE, (uint32_t)objectOrder.size()) - node.firstObject;
+
+		if (endLeaf - firstLeaf == 1) {
+			for (uint32_t i=node.firstObject; i<node.firstObject + node.objectCount; i++) objectLeaf[objectOrder[i]] = index;
+			return 0;
+		}
+
+		// Split at the highest bit where the range's Morton codes differ, codes equal down to the last bit split in half
+		uint32_t firstCode = codes[firstLeaf * BVH_LEAF_SIZE];
+		uint32_t lastCode = codes[(endLeaf - 1) * BVH_LEAF_SIZE];
+		uint32_t split = firstLeaf + (endLeaf - firstLeaf) / 2;
+		if (firstCode != lastCode) {
+			int bit = 31;
+			while (!(((firstCode ^ lastCode) >> bit) & 1)) bit--;
+			split = firstLeaf + 1;
+			uint32_t high = endLeaf - 1;
+			while (split < high) {
+				uint32_t middle = (split + high) / 2;
+				if ((codes[middle * BVH_LEAF_SIZE] >> bit) & 1) high = middle;
+				else split = middle + 1;
+			}
+		}
+
+		parents[index + 1] = index;
+		parents[index + 2 * (split - firstLeaf)] = index;
+		return split;
+	}
+
+	void buildSubtree(uint32_t index, uint32_t firstLeaf, uint32_t endLeaf, const std::vector<uint32_t>& codes) {
+		uint32_t split = splitNode(index, firstLeaf, endLeaf, codes);
+		if (split) {
+			buildSubtree(index + 1, firstLeaf, split, codes);
+			buildSubtree(index + 2 * (split - firstLeaf), split, endLeaf, codes);
+		}
+		refitNode(index);
+	}
+
+	static bool intersectRay(const BvhNode& node, const float origin[3], const float inverseDirection[3], float maxDistance, float& entry) {
+		float near = 0.0f, far = maxDistance;
+		for (int axis=0; axis<3; axis++) {
+			float t0 = (node.min[axis] - origin[axis]) * inverseDirection[axis];
+			float t1 = (node.max[axis] - origin[axis]) * inverseDirection[axis];
+			near = std::max(near, std::min(t0, t1));
+			far = std::min(far, std::max(t0, t1));
+		}
+		entry = near;
+		return near <= far && node.min[0] <= node.max[0];
+	}
+
+	static bool intersectSphere(const float min[3], const float max[3], const float center[3], float radiusSquared) {
+		float distanceSquared = 0.0f;
+		for (int axis=0; axis<3; axis++) {
+			float d = std::max({min[axis] - center[axis], 0.0f, center[axis] - max[axis]});
+			distanceSquared += d*d;
+		}
+		return distanceSquared <= radiusSquared;
+	}
+
+public:
+	// SAH cost relative to the cost at build, past which refit() rebuilds
+	float rebuildThreshold = 1.3f;
+
+	void build(std::vector<Aabb> bounds) {
+		objectBounds = std::move(bounds);
+		dirtyObjects.clear();
+		refitObjectsSinceCheck = 0;
+		nodes.clear();
+
+		uint32_t count = (uint32_t)objectBounds.size();
+		if (count == 0) return;
+
+		// Centroid bounds to quantise the Morton grid
+		Aabb centroidBounds = Aabb::empty();
+		std::mutex centroidMutex;
+		parallelFor(count, 16384, [&](size_t begin, size_t end) {
+			Aabb local = Aabb::empty();
+			for (size_t i=begin; i<end; i++) {
+				auto& b = objectBounds[i];
+				if (b.isEmpty()) continue;
+				float centroid[3] = {(b.min[0] + b.max[0]) * 0.5f, (b.min[1] + b.max[1]) * 0.5f, (b.min[2] + b.max[2]) * 0.5f};
+				local.expand({{centroid[0], centroid[1], centroid[2]}, {centroid[0], centroid[1], centroid[2]}});
+			}
+			std::lock_guard<std::mutex> lock(centroidMutex);
+			centroidBounds.expand(local);
+		});
+
+		std::vector<uint32_t> codes(count);
+		objectOrder.resize(count);
+		parallelFor(count, 16384, [&](size_t begin, size_t end) {
+			float scale[3];
+			for (int axis=0; axis<3; axis++) {
+				float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				scale[axis] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+			}
+			for (size_t i=begin; i<end; i++) {
+				auto& b = objectBounds[i];
+				uint32_t code = 0;
+				for (int axis=0; axis<3 && !b.isEmpty(); axis++) {
+					float centroid = (b.min[axis] + b.max[axis]) * 0.5f;
+					code |= expandBits((uint32_t)((centroid - centroidBounds.min[axis]) * scale[axis])) << (2 - axis);
+				}
+				codes[i] = code;
+				objectOrder[i] = (uint32_t)i;
+			}
+		});
+
+		// LSD radix sort of (code, object) pairs, 8 bits per pass
+		std::vector<uint32_t> codesScratch(count), orderScratch(count);
+		for (int shift=0; shift<32; shift+=8) {
+			uint32_t offsets[256] = {};
+			for (uint32_t i=0; i<count; i++) offsets[(codes[i] >> shift) & 0xFF]++;
+			for (uint32_t digit=0, sum=0; digit<256; digit++) {
+				uint32_t digitCount = offsets[digit];
+				offsets[digit] = sum;
+				sum += digitCount;
+			}
+			for (uint32_t i=0; i<count; i++) {
+				uint32_t destination = offsets[(codes[i] >> shift) & 0xFF]++;
+				codesScratch[destination] = codes[i];
+				orderScratch[destination] = objectOrder[i];
+			}
+			codes.swap(codesScratch);
+			objectOrder.swap(orderScratch);
+		}
+
+		uint32_t leafCount = (count + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE;
+		nodes.resize(2 * leafCount - 1);
+		parents.resize(nodes.size());
+		objectLeaf.resize(count);
+		parents[0] = 0;
+
+		// The top of the tree is split on this thread, largest subtree first, until there is a subtree per worker. Those
+		// are built in parallel and the split nodes refit after them (children were split after their parents).
+		struct Subtree {
+			uint32_t index, firstLeaf, endLeaf;
+		};
+		std::vector<Subtree> subtrees {{0, 0, leafCount}};
+		std::vector<uint32_t> splitNodes;
+		while (subtrees.size() < workerCount()) {
+			auto largest = std::max_element(subtrees.begin(), subtrees.end(), [](const Subtree& a, const Subtree& b) {
+				return a.endLeaf - a.firstLeaf < b.endLeaf - b.firstLeaf;
+			});
+			if ((largest->endLeaf - largest->firstLeaf) * BVH_LEAF_SIZE <= 16384) break;
+
+			Subtree subtree = *largest;
+			uint32_t split = splitNode(subtree.index, subtree.firstLeaf, subtree.endLeaf, codes);
+			splitNodes.push_back(subtree.index);
+			*largest = {subtree.index + 1, subtree.firstLeaf, split};
+			subtrees.push_back({subtree.index + 2 * (split - subtree.firstLeaf), split, subtree.endLeaf});
+		}
+		parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+			for (size_t i=begin; i<end; i++) buildSubtree(subtrees[i].index, subtrees[i].firstLeaf, subtrees[i].endLeaf, codes);
+		});
+		for (size_t i=splitNodes.size(); i-- > 0;) refitNode(splitNodes[i]);
+
+		builtCost = sahCost();
+	}
+
+	// Marks an object as moved, its nodes are updated by the next refit()
+	void setObjectBounds(uint32_t object, const Aabb& bounds) {
+		objectBounds[object] = bounds;
+		dirtyObjects.push_back(object);
+	}
+
+	// Refits the nodes of moved objects, returns true if the tree had degraded enough to be rebuilt instead
+	bool refit() {
+		if (dirtyObjects.empty() || nodes.empty()) return false;
+
+		if (dirtyObjects.size() * 8 > objectBounds.size()) {
+			// Most of the tree moved, refit leaves in parallel then sweep parents bottom-up (children follow parents)
+			parallelFor(nodes.size(), 65536, [&](size_t begin, size_t end) {
+				for (size_t i=begin; i<end; i++) if (isLeaf(nodes[i])) refitNode((uint32_t)i);
+			});
+			for (size_t i=nodes.size(); i-- > 0;) if (!isLeaf(nodes[i])) refitNode((uint32_t)i);
+		}
+		else {
+			for (auto object : dirtyObjects) {
+				uint32_t index = objectLeaf[object];
+				// Stop once an ancestor is unchanged, e.g. a second object in an already refit leaf
+				while (refitNode(index) && index != 0) index = parents[index];
+			}
+		}
+
+		refitObjectsSinceCheck += dirtyObjects.size();
+		dirtyObjects.clear();
+
+		// Check quality once roughly an eighth of the objects have moved
+		if (refitObjectsSinceCheck * 8 >= objectBounds.size()) {
+			refitObjectsSinceCheck = 0;
+			if (sahCost() > builtCost * rebuildThreshold) {
+				build(std::move(objectBounds));
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Expected cost of a ray query relative to the root (unit node traversal and object test cost)
+	float sahCost() const {
+		if (nodes.empty()) return 0.0f;
+		double cost = 0.0;
+		for (auto& node : nodes) cost += getBounds(node).surfaceArea() * (isLeaf(node) ? node.objectCount : 1.0);
+		return (float)(cost / std::max(getBounds(nodes[0]).surfaceArea(), 1e-20f));
+	}
+
+	// Appends the objects whose bounds intersect the frustum
+	void cullFrustum(const Frustum& frustum, std::vector<uint32_t>& visible) const {
+		forEachInFrustum(frustum, [&](uint32_t object) { visible.push_back(object); });
+	}
+
+	// Writes the objects whose bounds intersect the frustum to visible (room for every object), returns how many
+	size_t cullFrustum(const Frustum& frustum, uint32_t* visible) const {
+		size_t count = 0;
+		forEachInFrustum(frustum, [&](uint32_t object) { visible[count++] = object; });
+		return count;
+	}
+
+	// Drops the submitted objects outside the frustum, keeping submission order. visible is scratch with room for every
+	// object, visibleMask is all zero between calls
+	void cullSubmitted(const Frustum& frustum, uint32_t* visible, std::vector<unsigned char>& visibleMask, std::vector<uint32_t>& objects) const {
+		size_t visibleCount = cullFrustum(frustum, visible);
+		visibleMask.resize(objectBounds.size());
+		for (size_t i=0; i<visibleCount; i++) visibleMask[visible[i]] = 1;
+		objects.erase(std::remove_if(objects.begin(), objects.end(), [&](uint32_t object) { return !visibleMask[object]; }), objects.end());
+		for (size_t i=0; i<visibleCount; i++) visibleMask[visible[i]] = 0;
+	}
+
+	template <typename Fn>
+	void forEachInFrustum(const Frustum& frustum, Fn&& fn) const {
+		if (nodes.empty()) return;
+
+		// Plane masks skip planes a parent is already fully inside of
+		uint32_t stack[128];
+		uint8_t maskStack[128];
+		int stackSize = 0;
+		uint32_t index = 0;
+		uint8_t mask = 0x3F;
+
+		while (true) {
+			auto& node = nodes[index];
+			bool outside = false;
+			for (int p=0; p<6 && !outside; p++) {
+				if (!(mask & (1 << p))) continue;
+				auto plane = frustum.planes[p];
+				float farthest = plane[3], nearest = plane[3];
+				for (int axis=0; axis<3; axis++) {
+					farthest += plane[axis] * (plane[axis] > 0.0f ? node.max[axis] : node.min[axis]);
+					nearest += plane[axis] * (plane[axis] > 0.0f ? node.min[axis] : node.max[axis]);
+				}
+				if (farthest < 0.0f) outside = true;
+				else if (nearest >= 0.0f) mask &= ~(1 << p);
+			}
+
+			if (!outside) {
+				if (mask == 0 || isLeaf(node)) {
+					for (uint32_t i=node.firstObject; i<node.firstObject + node.objectCount; i++) {
+						uint32_t object = objectOrder[i];
+						bool objectVisible = !objectBounds[object].isEmpty();
+						for (int p=0; p<6 && objectVisible && mask; p++) {
+							if (!(mask & (1 << p))) continue;
+							auto plane = frustum.planes[p];
+							auto& b = objectBounds[object];
+							float farthest = plane[3];
+							for (int axis=0; axis<3; axis++) farthest += plane[axis] * (plane[axis] > 0.0f ? b.max[axis] : b.min[axis]);
+							objectVisible = farthest >= 0.0f;
+						}
+						if (objectVisible) fn(object);
+					}
+				}
+				else {
+					stack[stackSize] = rightChild(index);
+					maskStack[stackSize++] = mask;
+					index++;
+					continue;
+				}
+			}
+
+			if (stackSize == 0) break;
+			index = stack[--stackSize];
+			mask = maskStack[stackSize];
+		}
+	}
+
+	// Closest object whose bounds the ray hits within maxDistance, direction needn't be normalised (distance is in its units)
+	bool raycast(const float origin[3], const float direction[3], float maxDistance, uint32_t& hitObject, float& hitDistance) const {
+		if (nodes.empty()) return false;
+
+		float inverseDirection[3];
+		for (int axis=0; axis<3; axis++) inverseDirection[axis] = 1.0f / direction[axis];
+
+		bool hit = false;
+		hitDistance = maxDistance;
+		uint32_t stack[128];
+		int stackSize = 0;
+		uint32_t index = 0;
+		float entry;
+		if (!intersectRay(nodes[0], origin, inverseDirection, hitDistance, entry)) return false;
+
+		while (true) {
+			auto& node = nodes[index];
+			if (isLeaf(node)) {
+				for (uint32_t i=node.firstObject; i<node.firstObject + node.objectCount; i++) {
+					uint32_t object = objectOrder[i];
+					BvhNode objectNode {};
+					setBounds(objectNode, objectBounds[object]);
+					if (intersectRay(objectNode, origin, inverseDirection, hitDistance, entry) && (!hit || entry < hitDistance)) {
+						hit = true;
+						hitObject = object;
+						hitDistance = entry;
+					}
+				}
+			}
+			else {
+				// Nearest child first so farther subtrees are culled by the closer hit
+				uint32_t children[2] = {index + 1, rightChild(index)};
+				float entries[2];
+				bool hits[2];
+				for (int c=0; c<2; c++) hits[c] = intersectRay(nodes[children[c]], origin, inverseDirection, hitDistance, entries[c]);
+				if (hits[0] && hits[1]) {
+					int nearChild = entries[0] <= entries[1] ? 0 : 1;
+					stack[stackSize++] = children[1 - nearChild];
+					index = children[nearChild];
+					continue;
+				}
+				if (hits[0] || hits[1]) {
+					index = children[hits[0] ? 0 : 1];
+					continue;
+				}
+			}
+
+			// Popped nodes may have been entered before a closer hit was found
+			bool next = false;
+			while (stackSize > 0 && !next) {
+				index = stack[--stackSize];
+				next = intersectRay(nodes[index], origin, inverseDirection, hitDistance, entry);
+			}
+			if (!next) break;
+		}
+		return hit;
+	}
+
+	// Appends the objects whose bounds intersect the sphere, e.g. the objects a light can reach
+	void querySphere(const float center[3], float radius, std::vector<uint32_t>& objects) const {
+		if (nodes.empty()) return;
+
+		float radiusSquared = radius * radius;
+		uint32_t stack[128];
+		int stackSize = 0;
+		uint32_t index = 0;
+
+		while (true) {
+			auto& node = nodes[index];
+			if (intersectSphere(node.min, node.max, center, radiusSquared)) {
+				if (isLeaf(node)) {
+					for (uint32_t i=node.firstObject; i<node.firstObject + node.objectCount; i++) {
+						auto& b = objectBounds[objectOrder[i]];
+						if (intersectSphere(b.min, b.max, center, radiusSquared)) objects.push_back(objectOrder[i]);
+					}
+				}
+				else {
+					stack[stackSize++] = rightChild(index);
+					index++;
+					continue;
+				}
+			}
+
+			if (stackSize == 0) break;
+			index = stack[--stackSize];
+		}
+	}
+
+	size_t nodeCount() const {
+		return nodes.size();
+	}
+
+	size_t objectCount() const {
+		return objectBounds.size();
+	}
+};
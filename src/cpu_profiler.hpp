@@ -0,0 +1,195 @@
+#pragma once
+
+// Scoped CPU profiler
+//
+// CPU_PROFILE_ZONE("name") times the rest of the enclosing block. A zone costs two timestamp reads and one write into
+// the calling thread's ring buffer: no locks, no allocation. Each ring has a single writer (its thread), which
+// publishes events by advancing an atomic head. The exporter reads the latest events of every ring and discards any
+// the writer lapped while it was copying. Rings hold the last CPU_PROFILER_EVENTS zones of their thread.
+//
+// Timestamps are rdtsc ticks on x86 (converted to microseconds against steady_clock when exported), steady_clock
+// nanoseconds elsewhere. Define NO_CPU_PROFILER to compile zones out.
+//
+// Zone names must outlive the profiler (string literals). A ring is handed back when its thread exits and reused by
+// the next thread to start profiling, so threads spawned per frame share a few rings, each drawn as one lane of the
+// trace.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_PROFILER_RDTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// Per thread ring size, a power of two
+constexpr const uint64_t CPU_PROFILER_EVENTS = 1 << 16;
+
+inline uint64_t cpuProfilerTimestamp() {
+#ifdef CPU_PROFILER_RDTSC
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class CpuProfiler {
+	// Fields are relaxed atomics so the exporter can read rings that are being written, they compile to plain moves
+	struct Event {
+		std::atomic<const char*> name;
+		std::atomic<uint64_t> begin, end;
+	};
+
+	struct alignas(64) Ring {
+		std::atomic<uint64_t> head {0};
+		bool released = false;	// Owning thread exited
+		std::unique_ptr<Event[]> events {new Event[CPU_PROFILER_EVENTS]};
+	};
+
+	struct State {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<Ring>> rings;
+	};
+
+	// Hands the thread's ring back when it exits. Holds the state alive so a thread outliving the profiler (a static
+	// worker pool joined during exit) can still release its ring
+	struct ThreadRing {
+		std::shared_ptr<State> state;
+		Ring* ring = nullptr;
+		~ThreadRing() {
+			if (!ring) return;
+			std::lock_guard<std::mutex> lock(state->mutex);
+			ring->released = true;
+		}
+	};
+
+	// Trivial thread_local so the fast path has no initialisation guard, ThreadRing is only touched the first time
+	static inline thread_local Ring* threadRing = nullptr;
+
+	std::shared_ptr<State> state = std::make_shared<State>();
+	uint64_t startTicks = cpuProfilerTimestamp();
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	Ring* acquire() {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		for (auto& ring : state->rings)
+			if (ring->released) {
+				ring->released = false;
+				return ring.get();
+			}
+		state->rings.push_back(std::make_unique<Ring>());
+		return state->rings.back().get();
+	}
+
+public:
+	static CpuProfiler& instance() {
+		static CpuProfiler profiler;
+		return profiler;
+	}
+
+	static void record(const char* name, uint64_t begin, uint64_t end) {
+		Ring* ring = threadRing;
+		if (!ring) {
+			static thread_local ThreadRing owner;
+			CpuProfiler& profiler = instance();
+			owner.state = profiler.state;
+			ring = owner.ring = threadRing = profiler.acquire();
+		}
+
+		uint64_t head = ring->head.load(std::memory_order_relaxed);
+		Event& event = ring->events[head & (CPU_PROFILER_EVENTS - 1)];
+		event.name.store(name, std::memory_order_relaxed);
+		event.begin.store(begin, std::memory_order_relaxed);
+		event.end.store(end, std::memory_order_relaxed);
+		ring->head.store(head + 1, std::memory_order_release);
+	}
+
+	// Timestamp ticks per microsecond, measured over the profiler's lifetime so far
+	double ticksPerMicrosecond() {
+	#ifdef CPU_PROFILER_RDTSC
+		double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+		return elapsedUs > 0.0 ? (cpuProfilerTimestamp() - startTicks) / elapsedUs : 1.0;
+	#else
+		return 1000.0;
+	#endif
+	}
+
+	// Every ring's retained zones as Chrome trace_event JSON (load in chrome://tracing or ui.perfetto.dev), returns the
+	// number of zones written
+	uint64_t writeChromeTrace(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		std::vector<std::unique_ptr<Ring>>& rings = state->rings;
+		double ticksPerUs = ticksPerMicrosecond();
+		auto flags = out.flags();
+		auto precision = out.precision();
+		out << std::fixed << std::setprecision(3);
+
+		out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		for (size_t lane=0; lane<rings.size(); lane++)
+			out << (lane ? ",\n" : "") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << lane << ", \"args\": {\"name\": \"thread " << lane << "\"}}";
+
+		uint64_t written = 0;
+		std::vector<std::pair<const char*, std::pair<uint64_t, uint64_t>>> events;
+		for (size_t lane=0; lane<rings.size(); lane++) {
+			Ring& ring = *rings[lane];
+			uint64_t head = ring.head.load(std::memory_order_acquire);
+			uint64_t first = head > CPU_PROFILER_EVENTS ? head - CPU_PROFILER_EVENTS : 0;
+
+			events.clear();
+			for (uint64_t i=first; i<head; i++) {
+				Event& event = ring.events[i & (CPU_PROFILER_EVENTS - 1)];
+				events.push_back({event.name.load(std::memory_order_relaxed), {event.begin.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed)}});
+			}
+			// Entries the writer reached again while they were copied may be torn, including the one at lapped that it may
+			// be writing now
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint64_t lapped = ring.head.load(std::memory_order_relaxed);
+			uint64_t skip = lapped + 1 > first + CPU_PROFILER_EVENTS ? std::min<uint64_t>(lapped + 1 - first - CPU_PROFILER_EVENTS, events.size()) : 0;
+
+			for (size_t i=skip; i<events.size(); i++) {
+				auto& [name, span] = events[i];
+				double beginUs = ((int64_t)(span.first - startTicks)) / ticksPerUs;
+				double durationUs = (span.second - span.first) / ticksPerUs;
+				out << ",\n{\"name\": \"" << name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << lane << ", \"ts\": " << beginUs << ", \"dur\": " << durationUs << "}";
+				written++;
+			}
+		}
+		out << "\n]}\n";
+		out.flags(flags);
+		out.precision(precision);
+		return written;
+	}
+};
+
+// Times its scope
+class CpuProfileZone {
+	const char* name;
+	uint64_t begin;
+
+public:
+	explicit CpuProfileZone(const char* name) : name(name), begin(cpuProfilerTimestamp()) {}
+	~CpuProfileZone() {
+		CpuProfiler::record(name, begin, cpuProfilerTimestamp());
+	}
+	CpuProfileZone(const CpuProfileZone&) = delete;
+	CpuProfileZone& operator=(const CpuProfileZone&) = delete;
+};
+
+#define CPU_PROFILE_CONCATENATE_(a, b) a##b
+#define CPU_PROFILE_CONCATENATE(a, b) CPU_PROFILE_CONCATENATE_(a, b)
+#ifndef NO_CPU_PROFILER
+#define CPU_PROFILE_ZONE(name) CpuProfileZone CPU_PROFILE_CONCATENATE(cpuProfileZone, __LINE__)(name)
+#else
+#define CPU_PROFILE_ZONE(name)
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+
+// Draw command generation
+//
+// Turns the visible objects into one DrawArraysIndirectCommand each (baseInstance is the object, so per-object
+// attributes are fetched with divisor 1): LOD selection picks the coarsest level whose error stays under the pixel
+// threshold, and full detail meshes with meshlets are drawn per meshlet, skipping meshlets outside the frustum or
+// facing away. No GL here, the commands are uploaded by the caller.
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.hpp"
+#include "mesh_lod.hpp"
+#include "meshlet.hpp"
+#include "object_transforms.hpp"
+
+struct DrawArraysIndirectCommand {
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstVertex;
+	unsigned int baseInstance;
+};
+
+struct DrawCommandSettings {
+	float cameraPosition[3];
+	const Frustum* frustum;	// For meshlet culling
+	float pixelsPerUnit;	// Pixels covered by one world unit at distance 1
+	float lodErrorPixels;
+	bool lodSelection;
+	bool meshletCulling;
+};
+
+struct DrawCommandStats {
+	uint64_t triangles = 0;
+	uint64_t fullDetailTriangles = 0;
+	uint64_t meshletsDrawn = 0;
+	uint64_t meshletsFrustumCulled = 0;
+	uint64_t meshletsBackfaceCulled = 0;
+};
+
+// Appends the commands for objects, stats are accumulated
+inline void generateDrawCommands(const uint32_t* objects, size_t objectCount, const uint32_t* objectMeshes, const float* objectPositions,
+	const ObjectTransforms& transforms, const MeshLodRegistry& meshLods, const MeshletRegistry& meshlets, const DrawCommandSettings& settings,
+	std::vector<DrawArraysIndirectCommand>& commands, DrawCommandStats& stats) {
+	const float* cameraPosition = settings.cameraPosition;
+
+	for (size_t i=0; i<objectCount; i++) {
+		uint32_t object = objects[i];
+		auto& chain = meshLods.chains[objectMeshes[object]];
+		const MeshLod* lod = &meshLods.lods[chain.firstLod];
+		stats.fullDetailTriangles += lod->vertexCount / 3;
+
+		float scale = transforms.scales[object];
+		if (settings.lodSelection) {
+			float center[3];
+			transforms.transformPoint(object, objectPositions + (size_t)object * 3, chain.center, center);
+			float offset[3] = {center[0] - cameraPosition[0], center[1] - cameraPosition[1], center[2] - cameraPosition[2]};
+			float distance = std::sqrt(offset[0]*offset[0] + offset[1]*offset[1] + offset[2]*offset[2]) - chain.radius * scale;
+
+			// Coarsest first, levels are ordered by increasing error
+			for (uint32_t level = chain.lodCount - 1; distance > 0.0f && level > 0; level--) {
+				auto& candidate = meshLods.lods[chain.firstLod + level];
+				if (candidate.error * scale * settings.pixelsPerUnit <= settings.lodErrorPixels * distance) {
+					lod = &candidate;
+					break;
+				}
+			}
+		}
+
+		// Smaller than the error threshold on screen
+		if (lod->vertexCount == 0) continue;
+
+		auto& range = meshlets.ranges[objectMeshes[object]];
+		if (settings.meshletCulling && range.meshletCount && lod == &meshLods.lods[chain.firstLod]) {
+			const float* position = objectPositions + (size_t)object * 3;
+			for (uint32_t m=range.firstMeshlet; m<range.firstMeshlet + range.meshletCount; m++) {
+				auto& meshlet = meshlets.meshlets[m];
+
+				// Bounds and cone into world space
+				Meshlet worldMeshlet = meshlet;
+				float center[3];
+				transforms.transformPoint(object, position, meshlet.center, center);
+				transforms.rotate(object, meshlet.coneAxis, worldMeshlet.coneAxis);
+				worldMeshlet.radius *= scale;
+
+				bool outside = false;
+				for (auto& plane : settings.frustum->planes)
+					outside = outside || plane[0]*center[0] + plane[1]*center[1] + plane[2]*center[2] + plane[3] < -worldMeshlet.radius;
+				if (outside) {
+					stats.meshletsFrustumCulled++;
+					continue;
+				}
+				if (meshletBackfacing(worldMeshlet, center, cameraPosition)) {
+					stats.meshletsBackfaceCulled++;
+					continue;
+				}
+
+				commands.push_back({meshlet.vertexCount, 1, meshlet.firstVertex, object});
+				stats.triangles += meshlet.vertexCount / 3;
+				stats.meshletsDrawn++;
+			}
+			continue;
+		}
+
+		// Offset so you call the right data from buffers with divisor (instance [1] / divisor [1]) + baseInstance)
+		commands.push_back({lod->vertexCount, 1, lod->firstVertex, object});
+		stats.triangles += lod->vertexCount / 3;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// Per-frame linear allocator
+//
+// Transient arrays that only live for one frame (the visible list, scratch tables) are bumped out of one block that
+// reset() rewinds at the start of the next frame, nothing is freed individually. A frame that outgrows the block takes
+// overflow blocks from the heap, and the next reset() replaces everything with one block big enough for that frame, so
+// once frames stop growing they don't touch the heap. Memory is uninitialised, only trivially destructible types.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+class FrameAllocator {
+	static constexpr size_t ALIGNMENT = 64;
+
+	std::unique_ptr<unsigned char[]> block;
+	size_t capacity = 0;
+	size_t used = 0;
+
+	std::vector<std::unique_ptr<unsigned char[]>> overflow;
+	size_t overflowBytes = 0;
+	size_t peak = 0;
+
+	static size_t alignUp(size_t size) {
+		return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	// Base of a buffer of size bytes, over-allocated so the usable part starts on an ALIGNMENT boundary
+	static unsigned char* aligned(std::unique_ptr<unsigned char[]>& buffer) {
+		uintptr_t address = (uintptr_t)buffer.get();
+		return buffer.get() + (alignUp(address) - address);
+	}
+
+public:
+	explicit FrameAllocator(size_t initialBytes = 0) {
+		if (initialBytes) {
+			capacity = alignUp(initialBytes);
+			block.reset(new unsigned char[capacity + ALIGNMENT]);
+		}
+	}
+
+	// count uninitialised Ts, valid until the next reset()
+	template <typename T>
+	T* allocate(size_t count) {
+		static_assert(std::is_trivially_destructible<T>::value && alignof(T) <= ALIGNMENT, "FrameAllocator holds plain data");
+		size_t size = alignUp(sizeof(T) * count);
+		if (used + size <= capacity) {
+			T* result = reinterpret_cast<T*>(aligned(block) + used);
+			used += size;
+			peak = std::max(peak, used + overflowBytes);
+			return result;
+		}
+
+		overflow.emplace_back(new unsigned char[size + ALIGNMENT]);
+		overflowBytes += size;
+		peak = std::max(peak, used + overflowBytes);
+		return reinterpret_cast<T*>(aligned(overflow.back()));
+	}
+
+	// Frees the frame's allocations, growing the block first if the frame overflowed it
+	void reset() {
+		if (!overflow.empty()) {
+			// Headroom so a frame slightly bigger than the last doesn't overflow again
+			capacity = alignUp(peak + peak / 4);
+			block.reset(new unsigned char[capacity + ALIGNMENT]);
+			overflow.clear();
+			overflowBytes = 0;
+		}
+		used = 0;
+	}
+
+	size_t bytesUsed() const {
+		return used + overflowBytes;
+	}
+
+	size_t blockBytes() const {
+		return capacity;
+	}
+
+	// Most used in a frame since construction
+	size_t peakBytes() const {
+		return peak;
+	}
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+// The demo's default scene: a grid of alternating pyramids and cubes lit by randomly placed lights
+
+#include <algorithm>
+#include <random>
+
+#include "parallel.hpp"
+#include "scene_format.hpp"
+
+inline const std::vector<float> GRID_TRI_MESH {
+	// Front
+	-0.5f, -0.5f, -0.5f,	0.0f, 0.5f, -1.0f,
+	0.0f, 0.5f, 0.0f,		0.0f, 0.5f, -1.0f,
+	0.5f, -0.5f, -0.5f,		0.0f, 0.5f, -1.0f,
+
+	// Back
+	-0.5f, -0.5f, 0.5f,		0.0f, -0.5f, 1.0f,
+	0.5f, -0.5f, 0.5f,		0.0f, -0.5f, 1.0f,
+	0.0f, 0.5f, 0.0f,		0.0f, -0.5f, 1.0f,
+
+	// Right
+	-0.5f, -0.5f, -0.5f,	-1.0f, 0.5f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		-1.0f, 0.5f, 0.0f,
+	0.0f, 0.5f, 0.0f,		-1.0f, 0.5f, 0.0f,
+
+	// Left
+	0.5f, -0.5f, -0.5f,		1.0f, -0.5f, 0.0f,
+	0.0f, 0.5f, 0.0f,		1.0f, -0.5f, 0.0f,
+	0.5f, -0.5f, 0.5f,		1.0f, -0.5f, 0.0f,
+
+	// Bottom
+	-0.5f, -0.5f, -0.5f,	0.0f, -1.0f, 0.0f,
+	0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
+
+	0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
+	0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f
+};
+
+inline const std::vector<float> GRID_QUAD_MESH {
+	// Front
+	-0.5f, -0.5f, -0.5f,	0.0f, 0.0f, -1.0f,
+	-0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
+	0.5f, -0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
+
+	-0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
+	0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
+	0.5f, -0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
+
+	// Back
+	-0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+	0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+	-0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+
+	-0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+	0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+	0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
+
+	// Right
+	-0.5f, -0.5f, -0.5f,	-1.0f, 0.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
+	-0.5f, 0.5f, -0.5f,		-1.0f, 0.0f, 0.0f,
+
+	-0.5f, 0.5f, -0.5f,		-1.0f, 0.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
+	-0.5f, 0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
+
+	// Left
+	0.5f, -0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
+	0.5f, 0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
+	0.5f, -0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
+
+	0.5f, 0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
+	0.5f, 0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
+	0.5f, -0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
+
+	// Top
+	-0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
+	-0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
+	0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
+
+	0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
+	-0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
+	0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
+
+	// Bottom
+	-0.5f, -0.5f, -0.5f,	0.0f, -1.0f, 0.0f,
+	0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
+
+	0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
+	0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
+	-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f
+};
+
+// spread matches the original demo layout, objects start 10 units in front of the origin
+// meshes replaces the pyramid/cube pair, objects cycle through them along x
+inline SceneData generateGridScene(unsigned int x, unsigned int y, unsigned int z, unsigned int lightCount, unsigned int seed, float spread = 2.0f,
+	const std::vector<std::vector<float>>& meshes = {}) {
+	SceneData scene;
+	std::vector<uint32_t> meshIds;
+	if (meshes.empty()) {
+		meshIds.push_back(scene.addMesh(GRID_TRI_MESH));
+		meshIds.push_back(scene.addMesh(GRID_QUAD_MESH));
+	}
+	for (auto& mesh : meshes) meshIds.push_back(scene.addMesh(mesh));
+
+	// Sized up front and written in place, a slab of the grid (one i) at a time per thread. Object (i, j, k) is
+	// ((i*y + j)*z + k), the order the serial loop produced
+	uint64_t objectCount = (uint64_t)x * y * z;
+	uint64_t slabSize = (uint64_t)y * z;
+	scene.objectPositions.resize(objectCount * 3);
+	scene.objectColors.resize(objectCount * 3);
+	scene.objectMeshes.resize(objectCount);
+
+	parallelFor(x, std::max<uint64_t>(1, 16384 / std::max<uint64_t>(1, slabSize)), [&](size_t begin, size_t end) {
+		for (unsigned int i=(unsigned int)begin; i<end; i++)
+			for (unsigned int j=0; j<y; j++)
+				for (unsigned int k=0; k<z; k++) {
+					uint64_t object = i * slabSize + (uint64_t)j * z + k;
+					float* position = &scene.objectPositions[object * 3];
+					float* color = &scene.objectColors[object * 3];
+					position[0] = i*spread;
+					position[1] = j*spread;
+					position[2] = k*spread + 10.0f;
+					color[0] = (i%2 == 0) * 0.7f + 0.3f;
+					color[1] = (j%2 == 0) * 0.7f + 0.3f;
+					color[2] = (k%2 == 0) * 0.7f + 0.3f;
+					scene.objectMeshes[object] = meshIds[i % meshIds.size()];
+				}
+	});
+
+	// Lights are scattered through the grid's bounds
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<> disX(0, x*spread);
+	std::uniform_real_distribution<> disY(0, y*spread);
+	std::uniform_real_distribution<> disZ(0, z*spread);
+
+	for (unsigned int i=0; i<lightCount; i++) {
+		SceneLight light {
+			{(float)disX(gen), (float)disY(gen), (float)disZ(gen) + 10.0f},
+			0.0f,
+			{1.0f, 1.0f, 1.0f},
+			1.0f,
+		};
+		scene.lights.push_back(light);
+	}
+
+	return scene;
+}
@@ -1,18 +1,394 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
 #include <random>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <charconv>
 
 #include <extern/glad/glad.h>
 #include <extern/GLFW/glfw3.h>
 #include <extern/glm/glm.hpp>
 #include <extern/glm/gtc/type_ptr.hpp>
 
+#include "scene_format.hpp"
+#include "grid_scene.hpp"
+#include "mesh_import.hpp"
+#include "bvh.hpp"
+#include "mesh_lod.hpp"
+#include "meshlet.hpp"
+#include "draw_commands.hpp"
+#include "vertex_format.hpp"
+#include "object_pool.hpp"
+#include "object_uploads.hpp"
+#include "render_queue.hpp"
+#include "submission_queue.hpp"
+#include "timing_stats.hpp"
+#include "cpu_profiler.hpp"
+#include "spsc_queue.hpp"
+#include "frame_allocator.hpp"
+#include "allocation_counter.hpp"
+
+// Every heap allocation is counted, the stats line reports them per frame
+ALLOCATION_COUNTER_REPLACE_OPERATORS
+
 constexpr const unsigned int WIDTH = 1400;
 constexpr const unsigned int HEIGHT = 900;
 const std::string TITLE = "OpenGL 4 Testing";
 
+// ========================================
+// GL state cache
+
+// Shadows the bound program, VAO, framebuffers, buffer bindings, texture units and enable flags, and drops calls that
+// would set what is already set. Every bind of tracked state must go through here (and objects be deleted through the
+// delete functions) or the shadow goes stale. Targets and caps that aren't tracked are passed straight through.
+// GL_ELEMENT_ARRAY_BUFFER is VAO state, so it isn't tracked either.
+namespace glState {
+	constexpr const GLuint UNKNOWN = ~0u;
+	constexpr const int BUFFER_TARGETS = 7;
+	constexpr const int INDEXED_BINDINGS = 16;
+	constexpr const int TEXTURE_UNITS = 32;
+	constexpr const int CAPS = 4;
+
+	// Off passes every call through, to compare
+	bool enabled = true;
+
+	GLuint program = UNKNOWN;
+	GLuint vertexArray = UNKNOWN;
+	GLuint drawFramebuffer = UNKNOWN;
+	GLuint readFramebuffer = UNKNOWN;
+	GLuint buffers[BUFFER_TARGETS];
+	GLuint storageBindings[INDEXED_BINDINGS];
+	GLuint uniformBindings[INDEXED_BINDINGS];
+	GLuint textures[TEXTURE_UNITS];
+	int caps[CAPS];	// -1 unknown
+
+	// This frame's calls, and the last finished frame's (see endFrame())
+	uint64_t issued = 0, elided = 0;
+	uint64_t lastIssued = 0, lastElided = 0;
+
+	// Forgets everything, the next call to each piece of state is issued
+	void invalidate() {
+		program = vertexArray = drawFramebuffer = readFramebuffer = UNKNOWN;
+		std::fill(std::begin(buffers), std::end(buffers), UNKNOWN);
+		std::fill(std::begin(storageBindings), std::end(storageBindings), UNKNOWN);
+		std::fill(std::begin(uniformBindings), std::end(uniformBindings), UNKNOWN);
+		std::fill(std::begin(textures), std::end(textures), UNKNOWN);
+		std::fill(std::begin(caps), std::end(caps), -1);
+	}
+
+	int bufferSlot(GLenum target) {
+		switch (target) {
+			case GL_ARRAY_BUFFER: return 0;
+			case GL_COPY_READ_BUFFER: return 1;
+			case GL_COPY_WRITE_BUFFER: return 2;
+			case GL_DRAW_INDIRECT_BUFFER: return 3;
+			case GL_PARAMETER_BUFFER: return 4;
+			case GL_SHADER_STORAGE_BUFFER: return 5;
+			case GL_UNIFORM_BUFFER: return 6;
+			default: return -1;
+		}
+	}
+
+	int capSlot(GLenum cap) {
+		switch (cap) {
+			case GL_DEPTH_TEST: return 0;
+			case GL_STENCIL_TEST: return 1;
+			case GL_CULL_FACE: return 2;
+			case GL_BLEND: return 3;
+			default: return -1;
+		}
+	}
+
+	// True (and counted as issued) when the call has to reach GL, updates the shadow
+	bool change(GLuint& shadow, GLuint value) {
+		if (enabled && shadow == value) {
+			elided++;
+			return false;
+		}
+		shadow = value;
+		issued++;
+		return true;
+	}
+
+	void useProgram(GLuint id) {
+		if (change(program, id)) glUseProgram(id);
+	}
+
+	void bindVertexArray(GLuint id) {
+		if (change(vertexArray, id)) glBindVertexArray(id);
+	}
+
+	void bindFramebuffer(GLenum target, GLuint id) {
+		if (target == GL_FRAMEBUFFER) {
+			if (enabled && drawFramebuffer == id && readFramebuffer == id) {
+				elided++;
+				return;
+			}
+			drawFramebuffer = readFramebuffer = id;
+			issued++;
+			glBindFramebuffer(target, id);
+		}
+		else if (change(target == GL_DRAW_FRAMEBUFFER ? drawFramebuffer : readFramebuffer, id)) glBindFramebuffer(target, id);
+	}
+
+	void bindBuffer(GLenum target, GLuint id) {
+		int slot = bufferSlot(target);
+		if (slot < 0) {
+			issued++;
+			glBindBuffer(target, id);
+		}
+		else if (change(buffers[slot], id)) glBindBuffer(target, id);
+	}
+
+	// Also binds the generic target, as GL does
+	void bindBufferBase(GLenum target, GLuint index, GLuint id) {
+		GLuint* indexed = target == GL_SHADER_STORAGE_BUFFER ? storageBindings : target == GL_UNIFORM_BUFFER ? uniformBindings : nullptr;
+		if (!indexed || index >= INDEXED_BINDINGS) {
+			issued++;
+			glBindBufferBase(target, index, id);
+			if (bufferSlot(target) >= 0) buffers[bufferSlot(target)] = id;
+			return;
+		}
+		if (enabled && indexed[index] == id && buffers[bufferSlot(target)] == id) {
+			elided++;
+			return;
+		}
+		indexed[index] = buffers[bufferSlot(target)] = id;
+		issued++;
+		glBindBufferBase(target, index, id);
+	}
+
+	// 2D textures, one per unit (DSA, no active unit to switch)
+	void bindTextureUnit(GLuint unit, GLuint id) {
+		if (unit >= TEXTURE_UNITS) {
+			issued++;
+			glBindTextureUnit(unit, id);
+		}
+		else if (change(textures[unit], id)) glBindTextureUnit(unit, id);
+	}
+
+	void setCap(GLenum cap, bool on) {
+		int slot = capSlot(cap);
+		if (slot >= 0 && enabled && caps[slot] == (int)on) {
+			elided++;
+			return;
+		}
+		if (slot >= 0) caps[slot] = on;
+		issued++;
+		if (on) glEnable(cap);
+		else glDisable(cap);
+	}
+
+	void enable(GLenum cap) {
+		setCap(cap, true);
+	}
+
+	void disable(GLenum cap) {
+		setCap(cap, false);
+	}
+
+	// Deleting a bound buffer unbinds it, and its name may come back from glGenBuffers
+	void deleteBuffers(GLsizei count, const GLuint* ids) {
+		for (GLsizei i=0; i<count; i++) {
+			for (auto& binding : buffers) if (binding == ids[i]) binding = 0;
+			for (auto& binding : storageBindings) if (binding == ids[i]) binding = 0;
+			for (auto& binding : uniformBindings) if (binding == ids[i]) binding = 0;
+		}
+		glDeleteBuffers(count, ids);
+	}
+
+	void deleteTextures(GLsizei count, const GLuint* ids) {
+		for (GLsizei i=0; i<count; i++)
+			for (auto& binding : textures) if (binding == ids[i]) binding = 0;
+		glDeleteTextures(count, ids);
+	}
+
+	void deleteFramebuffers(GLsizei count, const GLuint* ids) {
+		for (GLsizei i=0; i<count; i++) {
+			if (drawFramebuffer == ids[i]) drawFramebuffer = 0;
+			if (readFramebuffer == ids[i]) readFramebuffer = 0;
+		}
+		glDeleteFramebuffers(count, ids);
+	}
+
+	void deleteVertexArrays(GLsizei count, const GLuint* ids) {
+		for (GLsizei i=0; i<count; i++) if (vertexArray == ids[i]) vertexArray = 0;
+		glDeleteVertexArrays(count, ids);
+	}
+
+	void endFrame() {
+		lastIssued = issued;
+		lastElided = elided;
+		issued = elided = 0;
+	}
+}
+
+// ========================================
+// GL resources
+
+// Owning handles for buffers, textures, framebuffers, renderbuffers and vertex arrays. Objects are created and edited
+// through DSA (no binding to edit, so no bind state to save and restore) and storage is immutable: resizing or
+// respecifying means assigning a new handle, which deletes the old object. Handles are move-only and convert to their
+// GL name. Objects still alive at exit are freed with the context, handles destroyed after contextAlive is cleared
+// skip the delete.
+namespace glResources {
+	bool contextAlive = false;
+}
+
+template <void (*Delete)(GLuint)>
+class GlObject {
+protected:
+	GLuint id = 0;
+
+public:
+	GlObject() = default;
+	GlObject(GlObject&& other) noexcept : id(other.id) {
+		other.id = 0;
+	}
+	GlObject& operator=(GlObject&& other) noexcept {
+		if (this != &other) {
+			reset();
+			id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+	~GlObject() {
+		reset();
+	}
+
+	void reset() {
+		if (id && glResources::contextAlive) Delete(id);
+		id = 0;
+	}
+
+	operator GLuint() const {
+		return id;
+	}
+};
+
+inline void deleteGlBuffer(GLuint id) { glState::deleteBuffers(1, &id); }
+inline void deleteGlTexture(GLuint id) { glState::deleteTextures(1, &id); }
+inline void deleteGlFramebuffer(GLuint id) { glState::deleteFramebuffers(1, &id); }
+inline void deleteGlRenderbuffer(GLuint id) { glDeleteRenderbuffers(1, &id); }
+inline void deleteGlVertexArray(GLuint id) { glState::deleteVertexArrays(1, &id); }
+
+class GlBuffer : public GlObject<deleteGlBuffer> {
+	size_t bytes = 0;
+
+public:
+	GlBuffer() = default;
+	// flags as glBufferStorage: GL_DYNAMIC_STORAGE_BIT for update(), map bits for map(). Never smaller than 16 bytes
+	GlBuffer(size_t size, const void* data, GLbitfield flags) : bytes(std::max<size_t>(size, 16)) {
+		glCreateBuffers(1, &id);
+		glNamedBufferStorage(id, bytes, size ? data : NULL, flags);
+	}
+
+	size_t size() const {
+		return bytes;
+	}
+
+	void update(size_t offset, size_t size, const void* data) {
+		glNamedBufferSubData(id, offset, size, data);
+	}
+
+	// The whole buffer
+	void* map(GLbitfield access) {
+		return glMapNamedBufferRange(id, 0, bytes, access);
+	}
+};
+
+class GlTexture : public GlObject<deleteGlTexture> {
+public:
+	GlTexture() = default;
+	// 2D with nearest filtering, levels > 1 samples the nearest level too
+	GlTexture(GLenum internalFormat, GLsizei width, GLsizei height, GLsizei levels = 1) {
+		glCreateTextures(GL_TEXTURE_2D, 1, &id);
+		glTextureStorage2D(id, levels, internalFormat, width, height);
+		glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+		glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+};
+
+class GlRenderbuffer : public GlObject<deleteGlRenderbuffer> {
+public:
+	GlRenderbuffer() = default;
+	GlRenderbuffer(GLenum internalFormat, GLsizei width, GLsizei height) {
+		glCreateRenderbuffers(1, &id);
+		glNamedRenderbufferStorage(id, internalFormat, width, height);
+	}
+};
+
+class GlFramebuffer : public GlObject<deleteGlFramebuffer> {
+public:
+	GlFramebuffer() = default;
+	// Attaches level 0 of each texture, the color attachments are the draw buffers in the order given
+	GlFramebuffer(std::initializer_list<std::pair<GLenum, GLuint>> textures) {
+		glCreateFramebuffers(1, &id);
+		std::vector<GLenum> drawBuffers;
+		for (auto& [attachment, texture] : textures) {
+			attach(attachment, texture);
+			if (attachment >= GL_COLOR_ATTACHMENT0 && attachment <= GL_COLOR_ATTACHMENT15) drawBuffers.push_back(attachment);
+		}
+		setDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+	}
+
+	void attach(GLenum attachment, GLuint texture) {
+		glNamedFramebufferTexture(id, attachment, texture, 0);
+	}
+
+	void attachRenderbuffer(GLenum attachment, GLuint renderbuffer) {
+		glNamedFramebufferRenderbuffer(id, attachment, GL_RENDERBUFFER, renderbuffer);
+	}
+
+	void setDrawBuffers(GLsizei count, const GLenum* attachments) {
+		glNamedFramebufferDrawBuffers(id, count, attachments);
+	}
+};
+
+class GlVertexArray : public GlObject<deleteGlVertexArray> {
+public:
+	static GlVertexArray create() {
+		GlVertexArray vertexArray;
+		glCreateVertexArrays(1, &vertexArray.id);
+		return vertexArray;
+	}
+
+	// Attribute index reads from its own buffer binding (same index), divisor 1 advances once per instance / draw
+	void setAttribute(GLuint index, GLuint buffer, size_t offset, GLsizei stride, GLint size, GLenum type, bool normalized, GLuint divisor = 0) {
+		glVertexArrayAttribFormat(id, index, size, type, normalized, 0);
+		setupBinding(index, buffer, offset, stride, divisor);
+	}
+
+	// Integer attribute, not converted to float
+	void setIntegerAttribute(GLuint index, GLuint buffer, size_t offset, GLsizei stride, GLint size, GLenum type, GLuint divisor = 0) {
+		glVertexArrayAttribIFormat(id, index, size, type, 0);
+		setupBinding(index, buffer, offset, stride, divisor);
+	}
+
+	// Points an attribute set up above at another buffer
+	void setBuffer(GLuint index, GLuint buffer, size_t offset, GLsizei stride) {
+		glVertexArrayVertexBuffer(id, index, buffer, offset, stride);
+	}
+
+private:
+	void setupBinding(GLuint index, GLuint buffer, size_t offset, GLsizei stride, GLuint divisor) {
+		glVertexArrayAttribBinding(id, index, index);
+		glVertexArrayVertexBuffer(id, index, buffer, offset, stride);
+		glVertexArrayBindingDivisor(id, index, divisor);
+		glEnableVertexArrayAttrib(id, index);
+	}
+};
+
 // ========================================
 // Shader
 
@@ -25,6 +401,12 @@ std::string loadShaderSource(std::string inputPath) {
     std::string inputText = "";
 
     for (std::string line; getline(input, line);) {
+		// #include "file" is resolved relative to the including shader so passes can share G-buffer decoding
+		if (line.rfind("#include", 0) == 0) {
+			auto nameStart = line.find('"') + 1;
+			auto name = line.substr(nameStart, line.rfind('"') - nameStart);
+			line = loadShaderSource(inputPath.substr(0, inputPath.find_last_of("/\\") + 1) + name);
+		}
         inputText = inputText + "\n" + line;
     }
 
@@ -36,7 +418,18 @@ std::string loadShaderSource(std::string inputPath) {
     return inputText;
 }
 
+// Inserts preprocessor defines directly after the #version directive so one shader file can build several variants
+std::string addShaderDefines(std::string source, std::vector<std::string> defines) {
+	auto versionEnd = source.find('\n', source.find("#version"));
+	std::string defineText = "";
+	for (auto& define : defines) defineText += "\n#define " + define;
+	return source.insert(versionEnd, defineText);
+}
+
 class Shader {
+	// Looked up once per name, a frame's uniforms then cost neither a string nor a driver query
+	std::vector<std::pair<std::string, int>> uniformLocations;
+
 	void getCompilationErrors(unsigned int shader, std::string type) {
 		int success;
 		char infoLog[512];
@@ -75,39 +468,66 @@ public:
 		glDeleteShader(vert);
 	}
 
+	explicit Shader(std::string computeSource) {
+		auto cs = computeSource.c_str();
+
+		unsigned int comp = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(comp, 1, &cs, NULL);
+		glCompileShader(comp);
+		getCompilationErrors(comp, "Compute");
+
+		id = glCreateProgram();
+		glAttachShader(id, comp);
+		glLinkProgram(id);
+
+		glDeleteShader(comp);
+	}
+
 	void bind() {
-		glUseProgram(id);
+		glState::useProgram(id);
 	} 
 
-	static void unbind() {
-		glUseProgram(NULL);
+	int uniformLocation(std::string_view name) {
+		for (auto& [uniform, location] : uniformLocations)
+			if (uniform == name) return location;
+		uniformLocations.emplace_back(std::string(name), 0);
+		uniformLocations.back().second = glGetUniformLocation(id, uniformLocations.back().first.c_str());
+		return uniformLocations.back().second;
 	}
 
-	void setUniform(std::string location, int x);
-	void setUniform(std::string location, float x);
-	void setUniform(std::string location, glm::vec2 x);
-	void setUniform(std::string location, glm::vec3 x);
-	void setUniform(std::string location, glm::mat3 x);
-	void setUniform(std::string location, glm::mat4 x);
+	void setUniform(std::string_view location, int x);
+	void setUniform(std::string_view location, unsigned int x);
+	void setUniform(std::string_view location, float x);
+	void setUniform(std::string_view location, glm::vec2 x);
+	void setUniform(std::string_view location, glm::ivec2 x);
+	void setUniform(std::string_view location, glm::vec3 x);
+	void setUniform(std::string_view location, glm::mat3 x);
+	void setUniform(std::string_view location, glm::mat4 x);
 };
 
-void Shader::setUniform(std::string location, int x) {
-	glUniform1i(glGetUniformLocation(id, location.c_str()), x);
+void Shader::setUniform(std::string_view location, int x) {
+	glUniform1i(uniformLocation(location), x);
+}
+void Shader::setUniform(std::string_view location, unsigned int x) {
+	glUniform1ui(uniformLocation(location), x);
 }
-void Shader::setUniform(std::string location, float x) {
-	glUniform1f(glGetUniformLocation(id, location.c_str()), x);
+void Shader::setUniform(std::string_view location, float x) {
+	glUniform1f(uniformLocation(location), x);
 }
-void Shader::setUniform(std::string location, glm::vec2 x) {
-	glUniform2fv(glGetUniformLocation(id, location.c_str()), 1, glm::value_ptr(x));
+void Shader::setUniform(std::string_view location, glm::vec2 x) {
+	glUniform2fv(uniformLocation(location), 1, glm::value_ptr(x));
 }
-void Shader::setUniform(std::string location, glm::vec3 x) {
-	glUniform3fv(glGetUniformLocation(id, location.c_str()), 1, glm::value_ptr(x));
+void Shader::setUniform(std::string_view location, glm::ivec2 x) {
+	glUniform2iv(uniformLocation(location), 1, glm::value_ptr(x));
 }
-void Shader::setUniform(std::string location, glm::mat3 x) {
-	glUniformMatrix3fv(glGetUniformLocation(id, location.c_str()), 1, GL_FALSE, glm::value_ptr(x));
+void Shader::setUniform(std::string_view location, glm::vec3 x) {
+	glUniform3fv(uniformLocation(location), 1, glm::value_ptr(x));
 }
-void Shader::setUniform(std::string location, glm::mat4 x) {
-	glUniformMatrix4fv(glGetUniformLocation(id, location.c_str()), 1, GL_FALSE, glm::value_ptr(x));
+void Shader::setUniform(std::string_view location, glm::mat3 x) {
+	glUniformMatrix3fv(uniformLocation(location), 1, GL_FALSE, glm::value_ptr(x));
+}
+void Shader::setUniform(std::string_view location, glm::mat4 x) {
+	glUniformMatrix4fv(uniformLocation(location), 1, GL_FALSE, glm::value_ptr(x));
 }
 
 // ========================================
@@ -119,6 +539,10 @@ class Camera {
 	glm::vec3 forward;
 	glm::mat4 viewMatrix;
 	glm::mat4 projectionMatrix;
+
+	// Last frame's state, for temporal reprojection
+	glm::mat4 previousViewProjection;
+	glm::vec3 previousPosition;
 	
 	// const glm::vec3 correctCoords {-1.0, 1.0, 1.0};
 
@@ -136,6 +560,24 @@ public:
 		return projectionMatrix;
 	}
 
+	glm::mat4 getViewProjectionMatrix() {
+		return projectionMatrix * viewMatrix;
+	}
+
+	glm::mat4 getPreviousViewProjectionMatrix() {
+		return previousViewProjection;
+	}
+
+	glm::vec3 getPreviousPosition() {
+		return previousPosition;
+	}
+
+	// Call once the frame has been drawn
+	void storePreviousFrame() {
+		previousViewProjection = getViewProjectionMatrix();
+		previousPosition = position;
+	}
+
 	glm::vec3 getPosition() {
 		return position;
 	}
@@ -158,48 +600,54 @@ public:
 		setPosition(position);
 		setForward(forward);
 		projectionMatrix = glm::perspective<float>(fov, (float)WIDTH/HEIGHT, near, far);
+		storePreviousFrame();
 	}
 
 };
 
 // ========================================
-// Drawable
+// Scene
 
-class Drawable {
-protected:
-	unsigned int vertexCount;
-	std::vector<float> verts;
+// Mesh table, SoA object tables and lights, either mapped from a scene file or generated in memory (see scene_format.hpp)
+SceneView g_scene;
 
-public:
-	Drawable(std::vector<float> verts): verts(verts) {
-		vertexCount = (unsigned int)verts.size()/6;
-	}
+// Object bounds hierarchy for culling and picking (see bvh.hpp)
+Bvh g_bvh;
 
-	virtual void draw() = 0;
-};
+// LOD chain per scene mesh, generated levels live after the scene's vertices in the vertex buffer (see mesh_lod.hpp)
+MeshLodRegistry g_meshLods;
+
+// Meshlets of large meshes, drawn per cluster at full detail, their vertices follow the LOD levels (see meshlet.hpp)
+MeshletRegistry g_meshlets;
+
+// Mutable per-object tables by slot, g_scene's object streams point into it (see object_pool.hpp)
+ObjectPool g_objectPool;
 
 // ========================================
-// Object Data
+// Drawable
 
-struct ObjectData {
-	glm::vec3 position;
-	glm::vec3 color;
+class Drawable {
+public:
+	virtual void draw() = 0;
 };
 
 // ========================================
 // Object
 
+// Handle to an object pool slot, which compaction may move
 class Object : public Drawable {
-	ObjectData data;
+	ObjectHandle handle;
 
 public:
-	Object(std::vector<float> verts, ObjectData data): data(data), Drawable(verts) {
+	Object(ObjectHandle handle): handle(handle) {
 
 	}
 
-	void draw();
+	ObjectHandle getHandle() const {
+		return handle;
+	}
 
-	friend void drawObjects(std::vector<Object*> objects, Camera& camera);
+	void draw();
 };
 
 // ========================================
@@ -221,11 +669,19 @@ public:
 // ========================================
 // Draw definitions
 
-std::vector<Object*> g_objects {};
+// Any thread can draw(), each submits into its own queue
+SubmissionQueues g_submissionQueues;
+// Slots of the objects submitted this frame, merged from the queues by drawDispatched()
+std::vector<unsigned int> g_objects {};
 // std::vector<ObjectInstanced*> g_instancedObjects {};
 
+namespace submissionStats {
+	double mergeMs = 0.0;
+	size_t queues = 0;
+}
+
 void Object::draw() {
-	g_objects.push_back(this);
+	g_submissionQueues.submit(g_objectPool.slot(handle));
 }
 
 // void ObjectInstanced::draw() {
@@ -233,63 +689,133 @@ void Object::draw() {
 // }
 
 // ========================================
-// Draw indirect command declarations
+// Draw (MDI)
 
-struct DrawArraysIndirectCommand {
-	unsigned int count;
-    unsigned int instanceCount;
-    unsigned int firstVertex;
-    unsigned int baseInstance;
+// One set of pass shaders per G-buffer layout
+struct GBufferShaders {
+	Shader gBuffer;
+	Shader gBufferQuantised;	// Decodes VERTEX_FORMAT_QUANTISED vertices
+	Shader deferred;
+	Shader deferredLowRes;
+	Shader deferredTemporal;
+	Shader upsample;
 };
 
-// ========================================
-// Draw (MDI)
+GBufferShaders shadersFull;
+GBufferShaders shadersCompact;
+
+GBufferShaders loadGBufferShaders(std::string shaderDirectory, std::vector<std::string> defines) {
+	auto screenVS = loadShaderSource(shaderDirectory + "deferred.vs");
+	auto deferredFS = loadShaderSource(shaderDirectory + "deferred.fs");
+
+	auto lowResDefines = defines;
+	lowResDefines.push_back("LOW_RES_LIGHTING");
+	auto temporalDefines = defines;
+	temporalDefines.push_back("TEMPORAL_LIGHTING");
+
+	auto gBufferVS = loadShaderSource(shaderDirectory + "gBuffer.vs");
+	auto gBufferFS = addShaderDefines(loadShaderSource(shaderDirectory + "gBuffer.fs"), defines);
+
+	GBufferShaders shaders;
+	shaders.gBuffer = Shader(gBufferVS, gBufferFS);
+	shaders.gBufferQuantised = Shader(addShaderDefines(gBufferVS, {"QUANTISED_VERTICES"}), gBufferFS);
+	shaders.deferred = Shader(screenVS, addShaderDefines(deferredFS, defines));
+	shaders.deferredLowRes = Shader(screenVS, addShaderDefines(deferredFS, lowResDefines));
+	shaders.deferredTemporal = Shader(screenVS, addShaderDefines(deferredFS, temporalDefines));
+	shaders.upsample = Shader(screenVS, addShaderDefines(loadShaderSource(shaderDirectory + "upsample.fs"), defines));
+	return shaders;
+}
+
+// FULL:	position RGBA16F + normal RGBA16F + color RGBA16 (24 bytes/pixel)
+// COMPACT:	octahedral normal RG16_SNORM + albedo RGBA8 (8 bytes/pixel), position reconstructed from depth
+enum GBufferLayout {
+	GBUFFER_LAYOUT_FULL,
+	GBUFFER_LAYOUT_COMPACT
+};
+
+GBufferLayout gBufferLayout = GBUFFER_LAYOUT_COMPACT;
 
-Shader shaderGBuffer;
-Shader shaderDeferred;
+GBufferShaders& activeShaders() {
+	return gBufferLayout == GBUFFER_LAYOUT_COMPACT ? shadersCompact : shadersFull;
+}
+
+VertexFormat vertexFormat = VERTEX_FORMAT_QUANTISED;
+
+Shader& activeGeometryShader() {
+	return vertexFormat == VERTEX_FORMAT_QUANTISED ? activeShaders().gBufferQuantised : activeShaders().gBuffer;
+}
+
+// 1 = full resolution lighting, 2 = half, 4 = quarter (bilaterally upsampled to full resolution)
+int lightingDownscale = 1;
+// Lights are split into this many interleaved slices, one slice is shaded per frame and accumulated in a reprojected history
+int temporalLightSlices = 1;
+// Set from the key callback, compares the next reduced resolution / temporal frame against full lighting
+bool measureLightingPSNR = false;
 
 namespace drawObjectBuffers {
-	unsigned int VAO;
-	unsigned int VertexBuffer;
-	unsigned int UniformsBuffer;
-	unsigned int IndirectDrawBuffer;
+	GlVertexArray VAO;
+	GlBuffer VertexBuffer;
+	GlBuffer UniformsBuffer;
+	unsigned int IndirectDrawBuffer;	// The current frame's, see frameResources
+	GlBuffer MeshQuantisation;	// Per mesh decode bounds for VERTEX_FORMAT_QUANTISED
+	GlBuffer TransformsBuffer;	// Scale table, rotations are per frame (see frameResources)
 	
-	unsigned int GBuffer;
-	unsigned int ScreenQuadVAO;
-	unsigned int GBufferRBO;
-
-	unsigned int LightsUBO;
+	GlFramebuffer GBuffer;
+	GlFramebuffer GBufferCompact;
+	GlFramebuffer LowResLighting;
+	GlFramebuffer Lit;
+	GlRenderbuffer LitRBO;
+	GlVertexArray ScreenQuadVAO;
+	GlBuffer ScreenQuadVBO;
+
+	GlBuffer LightsUBO;
+
+	// Occlusion culling: world space object bounds, compacted commands per phase, phase 1 rejects and counters
+	GlBuffer ObjectBounds;
+	GlBuffer OcclusionVisible;
+	GlBuffer OcclusionOccluded;
+	GlBuffer OcclusionVisiblePhase2;
+	GlBuffer OcclusionCounters;
+	GlBuffer OcclusionReadback[2];
 }
 
 namespace drawObjectTextures {
-	unsigned int GPosition;
-	unsigned int GNormal;
-	unsigned int GColor;
-}
+	GlTexture GPosition;
+	GlTexture GNormal;
+	GlTexture GColor;
 
-std::vector<glm::vec3> lightPositions {};
-int lightCount = 200;
+	GlTexture GNormalPacked;
+	GlTexture GAlbedo;
 
-void attachTextureToFramebuffer(unsigned int FBO, unsigned int Texture, unsigned int InternalFormat, unsigned int DataType, unsigned int attachmentId) {
-	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-	glBindTexture(GL_TEXTURE_2D, Texture);
+	// Shared by both layouts, sampled to reconstruct position in the compact layout
+	GlTexture GDepth;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, InternalFormat, WIDTH, HEIGHT, 0, GL_RGBA, DataType, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, attachmentId, GL_TEXTURE_2D, Texture, 0);
-	
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Reduced resolution lighting, allocated at half resolution (quarter uses a sub-rectangle)
+	GlTexture GLightDiffuse;
+	GlTexture GLightSpecular;
+	GlTexture GLightGuide;
+
+	// Lit scene at internal resolution, upscaled to the window for presentation
+	GlTexture GLit;
+
+	// Temporal lighting history (lighting, view distance), ping-ponged each frame
+	GlTexture GHistory[2];
+
+	// Farthest depth pyramid (R32F, full mip chain) for occlusion culling
+	GlTexture HiZ;
 }
 
+// Must not exceed MAX_LIGHTS in deferred.fs
+constexpr const unsigned int MAX_LIGHTS = 1000;
+int lightCount = 0;
+
 void setupDrawObjects() {
-	// Draw data buffers
-	glGenVertexArrays(1, &drawObjectBuffers::VAO);
-	glGenBuffers(1, &drawObjectBuffers::VertexBuffer);
-	glGenBuffers(1, &drawObjectBuffers::UniformsBuffer);
-	glGenBuffers(1, &drawObjectBuffers::IndirectDrawBuffer);
-	
+	using namespace drawObjectBuffers;
+	using namespace drawObjectTextures;
+
+	// Draw data, the buffers are created by the uploads
+	VAO = GlVertexArray::create();
+
 	// Screen quad
 	std::vector<float> screenQuadVerts {
 		-1.0f, -1.0f, 0.0f,		0.0f, 0.0f,
@@ -300,267 +826,1231 @@ void setupDrawObjects() {
 		1.0f, -1.0f, 0.0f,		1.0f, 0.0f,
 		1.0f, 1.0f, 0.0f,		1.0f, 1.0f
 	};
-	glGenVertexArrays(1, &drawObjectBuffers::ScreenQuadVAO);
-	glBindVertexArray(drawObjectBuffers::ScreenQuadVAO);
+	ScreenQuadVBO = GlBuffer(sizeof(float) * screenQuadVerts.size(), screenQuadVerts.data(), 0);
+	ScreenQuadVAO = GlVertexArray::create();
+	ScreenQuadVAO.setAttribute(0, ScreenQuadVBO, 0, sizeof(float) * 5, 3, GL_FLOAT, false);	// Positions
+	ScreenQuadVAO.setAttribute(1, ScreenQuadVBO, sizeof(float) * 3, sizeof(float) * 5, 2, GL_FLOAT, false);	// UVs
+
+	// GBuffer FBO (full layout)
+	GPosition = GlTexture(GL_RGBA16F, WIDTH, HEIGHT);
+	GNormal = GlTexture(GL_RGBA16F, WIDTH, HEIGHT);
+	GColor = GlTexture(GL_RGBA16, WIDTH, HEIGHT);
+	GDepth = GlTexture(GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+	GBuffer = GlFramebuffer({{GL_COLOR_ATTACHMENT0, GPosition}, {GL_COLOR_ATTACHMENT1, GNormal}, {GL_COLOR_ATTACHMENT2, GColor}, {GL_DEPTH_STENCIL_ATTACHMENT, GDepth}});
+
+	// GBuffer FBO (compact layout)
+	GNormalPacked = GlTexture(GL_RG16_SNORM, WIDTH, HEIGHT);
+	GAlbedo = GlTexture(GL_RGBA8, WIDTH, HEIGHT);
+	GBufferCompact = GlFramebuffer({{GL_COLOR_ATTACHMENT0, GNormalPacked}, {GL_COLOR_ATTACHMENT1, GAlbedo}, {GL_DEPTH_STENCIL_ATTACHMENT, GDepth}});
+
+	// Reduced resolution lighting FBO
+	unsigned int lowResWidth = (WIDTH + 1) / 2;
+	unsigned int lowResHeight = (HEIGHT + 1) / 2;
+	GLightDiffuse = GlTexture(GL_RGBA16F, lowResWidth, lowResHeight);
+	GLightSpecular = GlTexture(GL_RGBA16F, lowResWidth, lowResHeight);
+	GLightGuide = GlTexture(GL_RGBA16F, lowResWidth, lowResHeight);
+	LowResLighting = GlFramebuffer({{GL_COLOR_ATTACHMENT0, GLightDiffuse}, {GL_COLOR_ATTACHMENT1, GLightSpecular}, {GL_COLOR_ATTACHMENT2, GLightGuide}});
+
+	// Lit FBO, its depth/stencil receives the GBuffer stencil so lighting can be stencil tested
+	GLit = GlTexture(GL_RGBA16F, WIDTH, HEIGHT);
+	Lit = GlFramebuffer({{GL_COLOR_ATTACHMENT0, GLit}});
+	LitRBO = GlRenderbuffer(GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+	Lit.attachRenderbuffer(GL_DEPTH_STENCIL_ATTACHMENT, LitRBO);
+
+	// Temporal lighting history, attached to the Lit FBO as the second draw buffer while in use
+	for (auto& history : GHistory) history = GlTexture(GL_RGBA16F, WIDTH, HEIGHT);
+
+	// Lights UBO, created by uploadScene()
+	for (auto shaders : {&shadersFull, &shadersCompact}) {
+		glUniformBlockBinding(shaders->deferred.id, glGetUniformBlockIndex(shaders->deferred.id, "LightsBlock"), 0);
+		glUniformBlockBinding(shaders->deferredLowRes.id, glGetUniformBlockIndex(shaders->deferredLowRes.id, "LightsBlock"), 0);
+		glUniformBlockBinding(shaders->deferredTemporal.id, glGetUniformBlockIndex(shaders->deferredTemporal.id, "LightsBlock"), 0);
+	}
+}
 
-	unsigned int ScreenQuadVBO;
-	glGenBuffers(1, &ScreenQuadVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, ScreenQuadVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * screenQuadVerts.size(), &screenQuadVerts[0], GL_STATIC_DRAW);
+// (Re)creates the vertex buffer in the given format and points attributes 0/1 at it. Generated LOD levels then meshlets
+// follow the scene's own vertices
+void uploadVertices(const SceneView& scene, const MeshLodRegistry& meshLods, const MeshletRegistry& meshlets, VertexFormat format) {
+	uint64_t lodVertexCount = meshLods.vertices.size() / SCENE_FLOATS_PER_VERTEX;
+	uint64_t meshletVertexCount = meshlets.vertices.size() / SCENE_FLOATS_PER_VERTEX;
+	uint64_t vertexCount = scene.vertexCount + lodVertexCount + meshletVertexCount;
+
+	auto& VAO = drawObjectBuffers::VAO;
+	auto& VertexBuffer = drawObjectBuffers::VertexBuffer;
+
+	if (format == VERTEX_FORMAT_FLOAT) {
+		// Three sources, filled after creation
+		size_t sceneVerticesSize = sizeof(float) * SCENE_FLOATS_PER_VERTEX * scene.vertexCount;
+		size_t lodVerticesSize = sizeof(float) * meshLods.vertices.size();
+		VertexBuffer = GlBuffer(vertexFormatSize(format) * vertexCount, NULL, GL_DYNAMIC_STORAGE_BIT);
+		VertexBuffer.update(0, sceneVerticesSize, scene.vertices);
+		VertexBuffer.update(sceneVerticesSize, lodVerticesSize, meshLods.vertices.data());
+		VertexBuffer.update(sceneVerticesSize + lodVerticesSize, sizeof(float) * meshlets.vertices.size(), meshlets.vertices.data());
+
+		VAO.setAttribute(0, VertexBuffer, 0, sizeof(float) * 6, 3, GL_FLOAT, false);
+		VAO.setAttribute(1, VertexBuffer, sizeof(float) * 3, sizeof(float) * 6, 3, GL_FLOAT, false);
+	}
+	else {
+		// Every vertex is quantised against the bounds of the scene mesh it belongs to, LOD levels and meshlets of a
+		// mesh lie within its bounds
+		std::vector<MeshQuantisation> quantisation(scene.meshCount);
+		std::vector<QuantisedVertex> vertices(vertexCount);
+		auto quantiseRange = [&](uint64_t firstVertex, uint64_t count, const MeshQuantisation& meshQuantisation) {
+			const float* source = firstVertex < scene.vertexCount ? scene.vertices + firstVertex * SCENE_FLOATS_PER_VERTEX
+				: firstVertex < scene.vertexCount + lodVertexCount ? meshLods.vertices.data() + (firstVertex - scene.vertexCount) * SCENE_FLOATS_PER_VERTEX
+				: meshlets.vertices.data() + (firstVertex - scene.vertexCount - lodVertexCount) * SCENE_FLOATS_PER_VERTEX;
+			quantiseVertices(source, count, meshQuantisation, vertices.data() + firstVertex);
+		};
 
-	// Positions
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (void*)0);
-	glEnableVertexAttribArray(0);
+		for (uint64_t m=0; m<scene.meshCount; m++) {
+			auto& mesh = scene.meshes[m];
+			quantisation[m] = computeMeshQuantisation(scene.vertices + (uint64_t)mesh.firstVertex * SCENE_FLOATS_PER_VERTEX, mesh.vertexCount);
+			quantiseRange(mesh.firstVertex, mesh.vertexCount, quantisation[m]);
+
+			if (m < meshLods.chains.size()) {
+				auto& chain = meshLods.chains[m];
+				for (uint32_t l=1; l<chain.lodCount; l++) {
+					auto& lod = meshLods.lods[chain.firstLod + l];
+					if (lod.vertexCount) quantiseRange(lod.firstVertex, lod.vertexCount, quantisation[m]);
+				}
+			}
+			if (m < meshlets.ranges.size()) {
+				auto& range = meshlets.ranges[m];
+				for (uint32_t i=0; i<range.meshletCount; i++) {
+					auto& meshlet = meshlets.meshlets[range.firstMeshlet + i];
+					quantiseRange(meshlet.firstVertex, meshlet.vertexCount, quantisation[m]);
+				}
+			}
+		}
 
-	// UVs
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (void*)(sizeof(float)*3));
-	glEnableVertexAttribArray(1);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glDeleteBuffers(1, &ScreenQuadVBO);
-
-	// GBuffer FBO
-	glGenFramebuffers(1, &drawObjectBuffers::GBuffer);
-	glGenTextures(1, &drawObjectTextures::GPosition);
-	glGenTextures(1, &drawObjectTextures::GNormal);
-	glGenTextures(1, &drawObjectTextures::GColor);
-
-	attachTextureToFramebuffer(drawObjectBuffers::GBuffer, drawObjectTextures::GPosition, GL_RGBA16F, GL_FLOAT, GL_COLOR_ATTACHMENT0);
-	attachTextureToFramebuffer(drawObjectBuffers::GBuffer, drawObjectTextures::GNormal, GL_RGBA16F, GL_FLOAT,  GL_COLOR_ATTACHMENT1);
-	attachTextureToFramebuffer(drawObjectBuffers::GBuffer, drawObjectTextures::GColor, GL_RGBA16, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT2);
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, drawObjectBuffers::GBuffer);
-	unsigned int attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
-	glDrawBuffers(3, attachments);
-
-	glGenRenderbuffers(1, &drawObjectBuffers::GBufferRBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, drawObjectBuffers::GBufferRBO); 
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, drawObjectBuffers::GBufferRBO);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-	// Light positions
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_real_distribution<> dis(0, 50*2.0);
-
-	for (int i=0; i<lightCount; i++)
-		lightPositions.push_back(glm::vec3(dis(gen), dis(gen), dis(gen)+10));
-
-	// Lights UBO
-	// Padded to align with std140 layout rules: https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL
-	struct LightData {			
-		//							Base alignment		aligned offset
-		float position[3];		// 	16 					0
-		float paddingPos;		// 						(12 [+4])
-		float color[3];			//	16 					16
-		float power;			//	4 					28
-	};
+		VertexBuffer = GlBuffer(sizeof(QuantisedVertex) * vertexCount, vertices.data(), 0);
+		VAO.setAttribute(0, VertexBuffer, 0, sizeof(QuantisedVertex), 4, GL_SHORT, true);
+		VAO.setAttribute(1, VertexBuffer, offsetof(QuantisedVertex, normal), sizeof(QuantisedVertex), 4, GL_INT_2_10_10_10_REV, true);
 
-	std::vector<LightData> lights;
-	for (int i=0; i<lightCount; i++) {
-		auto position = lightPositions[i];
-		LightData light {
-			{position.x, position.y, position.z},
-			0.0f,
-			{1.0f, 1.0f, 1.0f},
-			1.0f,
-		};
-		lights.push_back(light);
+		drawObjectBuffers::MeshQuantisation = GlBuffer(sizeof(MeshQuantisation) * quantisation.size(), quantisation.data(), 0);
+		glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, drawObjectBuffers::MeshQuantisation);
 	}
 
-	glGenBuffers(1, &drawObjectBuffers::LightsUBO);
-	glBindBuffer(GL_UNIFORM_BUFFER, drawObjectBuffers::LightsUBO);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightData)*lights.size(), &lights[0], GL_STATIC_DRAW);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, drawObjectBuffers::LightsUBO);
-	glUniformBlockBinding(shaderDeferred.id, glGetUniformBlockIndex(shaderDeferred.id, "LightsBlock"), 0);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	std::cout << "Vertex buffer (" << vertexFormatName(format) << "): " << vertexCount << " vertices, " << vertexFormatSize(format) * vertexCount / (1024.0 * 1024.0) << " MB\n";
 }
 
-// ========================================
-// DRAW OPTIONS:
-// FIXME: ifndef NO_REGENERATING_DRAW_CALLS only draws tris
+// Uploads the scene's vertices and lights, per-object tables come from the object pool (uploadObjectTables())
+void uploadScene(const SceneView& scene, const MeshLodRegistry& meshLods, const MeshletRegistry& meshlets) {
+	uploadVertices(scene, meshLods, meshlets, vertexFormat);
 
-#define STATIC_DRAW
+	// Lights
+	lightCount = (int)std::min<uint64_t>(scene.lightCount, MAX_LIGHTS);
+	if (lightCount < (int)scene.lightCount) std::cout << "Scene has " << scene.lightCount << " lights, only the first " << MAX_LIGHTS << " are used\n";
+
+	drawObjectBuffers::LightsUBO = GlBuffer(sizeof(SceneLight) * lightCount, scene.lights, 0);
+	glState::bindBufferBase(GL_UNIFORM_BUFFER, 0, drawObjectBuffers::LightsUBO);
+
+	g_scene = scene;
+}
 
-#ifdef STATIC_DRAW
-#define NO_REGENERATING_DRAW_CALLS
-#endif
 // ========================================
+// Frames in flight
+
+// Per-frame copies of the buffers the CPU rewrites every frame (indirect commands, the object rotation table, camera
+// matrices), so the CPU fills one frame's set while the GPU still reads the previous frames'. A set is reused once the
+// fence placed after its frame's last draw has signalled. Sets are persistently mapped and written in place, so there is
+// no glBufferData orphaning or glBufferSubData that can stall on a buffer in use
+constexpr const int MAX_FRAMES_IN_FLIGHT = 3;
+// 1 serialises CPU and GPU: every frame waits for the previous one to finish
+int framesInFlight = 2;
+
+// std140 CameraBlock in gbuffer.vs
+struct CameraBlock {
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+};
 
-void drawObjects(std::vector<Object*> objects, Camera& camera) {
-	#ifdef STATIC_DRAW
-	static bool firstRun = true;
-	#endif
+struct FrameResources {
+	GlBuffer indirect;
+	DrawArraysIndirectCommand* indirectMapped = nullptr;
+	size_t indirectCapacity = 0;		// Commands
+	uint64_t commandsVersion = 0;		// Of frameResources::commandsVersion last written
 
-	unsigned int VAO = drawObjectBuffers::VAO;
-	glBindVertexArray(VAO);
+	GlBuffer rotations;
+	float* rotationsMapped = nullptr;
+	size_t rotationCapacity = 0;		// Objects
+	uint64_t rotationsVersion = 0;
 
-	#ifdef NO_REGENERATING_DRAW_CALLS
-	static std::vector<DrawArraysIndirectCommand> drawCommands;
-	#else
-	std::vector<DrawArraysIndirectCommand> drawCommands;
-	#endif
+	GlBuffer camera;
+	CameraBlock* cameraMapped = nullptr;
 
-	std::vector<float> verts;
-	unsigned int numVerts = 0;
-	std::vector<float> uniforms;
-	
-	unsigned int count = 0;
-	for (auto object : objects) {
-		#ifdef NO_REGENERATING_DRAW_CALLS
-		if (firstRun) {
-		#endif
-
-		// Generate draw calls
-		DrawArraysIndirectCommand command {};
-		command.count = object->vertexCount;
-		command.instanceCount = 1;
-		command.firstVertex = numVerts;
-		command.baseInstance = count++;		// Offset so you call the right data from buffers with divisor (instance [1] / divisor [1]) + baseInstance)
-		drawCommands.push_back(command);
-
-		#ifndef NO_REGENERATING_DRAW_CALLS
-		#ifdef STATIC_DRAW
-		if (firstRun) {
-		#endif
-		#endif
-
-		// Aggregate data
-		numVerts += object->vertexCount;
-		for (auto num : object->verts) verts.push_back(num);
-		auto pos = object->data.position;
-		auto col = object->data.color;
-		uniforms.push_back(pos.x); uniforms.push_back(pos.y); uniforms.push_back(pos.z);
-		uniforms.push_back(col.x); uniforms.push_back(col.y); uniforms.push_back(col.z);
-
-		#ifdef STATIC_DRAW
-		}	// firstRun
-		#endif
-	}
-
-	#ifdef STATIC_DRAW
-	if (firstRun) {
-	#endif
+	GLsync fence = 0;
+};
+
+namespace frameResources {
+	FrameResources frames[MAX_FRAMES_IN_FLIGHT];
+	int current = 0;
+	// Bumped whenever the CPU copy changes, each set copies again when its version is behind
+	uint64_t commandsVersion = 1;
+	uint64_t rotationsVersion = 1;
+}
+
+// CPU time spent blocked on the GPU, summed until the stats line takes it
+namespace frameStats {
+	double fenceWaitMs = 0.0;
+	double swapMs = 0.0;
+}
 
-	// Verts
-	unsigned int VertexBuffer = drawObjectBuffers::VertexBuffer;
-	glBindBuffer(GL_ARRAY_BUFFER, VertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * verts.size(), &verts[0], GL_DYNAMIC_DRAW);
+// Heap allocations in the last frame's work after the stats line (which formats strings once a second), 0 once the
+// frame's containers have reached their working sizes
+namespace allocationStats {
+	uint64_t lastFrame = 0;
+}
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)0);
-	glEnableVertexAttribArray(0);
+// Transient per-frame arrays, rewound at the start of every frame
+FrameAllocator g_frameAllocator;
 
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)(sizeof(float) * 3));
-	glEnableVertexAttribArray(1);
+// Time to first frame, from entering main() to the first present
+namespace startupStats {
+	std::chrono::steady_clock::time_point start;
+	bool firstFramePresented = false;
+}
 
-	// Uniforms
-	unsigned int UniformsBuffer = drawObjectBuffers::UniformsBuffer;
-	glBindBuffer(GL_ARRAY_BUFFER, UniformsBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * uniforms.size(), &uniforms[0], GL_DYNAMIC_DRAW);
+// Persistently mapped, coherent write-only storage, replaces buffer
+void* allocatePersistentBuffer(GlBuffer& buffer, size_t size) {
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	buffer = GlBuffer(size, NULL, flags);
+	return buffer.map(flags);
+}
 
-	// Positions
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)0);
-	glEnableVertexAttribArray(2);
-	glVertexAttribDivisor(2, 1);	// Change once per instance / draw call
+FrameResources& currentFrame() {
+	return frameResources::frames[frameResources::current];
+}
 
-	// Color
-	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)(sizeof(float) * 3));
-	glEnableVertexAttribArray(3);
-	glVertexAttribDivisor(3, 1);
+// Moves to the next set, waiting for the GPU to be done with it
+void beginFrameResources() {
+	CPU_PROFILE_ZONE("wait frame fence");
+	using namespace frameResources;
+	current = (current + 1) % framesInFlight;
+	FrameResources& frame = frames[current];
+
+	if (frame.fence) {
+		auto start = std::chrono::steady_clock::now();
+		while (glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(frame.fence);
+		frame.fence = 0;
+		frameStats::fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
 
-	#ifdef STATIC_DRAW
-	} // firstRun
-	firstRun = false;
-	#endif
+	if (!frame.camera) frame.cameraMapped = (CameraBlock*)allocatePersistentBuffer(frame.camera, sizeof(CameraBlock));
+	drawObjectBuffers::IndirectDrawBuffer = frame.indirect;
+}
 
-	// Draw calls (MDI)
-	unsigned int IndirectDrawBuffer = drawObjectBuffers::IndirectDrawBuffer;
-	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, IndirectDrawBuffer);
-	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawArraysIndirectCommand) * drawCommands.size(), &drawCommands[0], GL_DYNAMIC_DRAW);
+// After the frame's last use of its set
+void endFrameResources() {
+	currentFrame().fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-	// Uniforms (object unspecific)
-	shaderGBuffer.setUniform("viewMatrix", camera.getViewMatrix());
-	shaderGBuffer.setUniform("projectionMatrix", camera.getProjectionMatrix());
+// Copies the rotation table into the frame's set if it is out of date and points the rotation attribute at it
+void writeFrameRotations() {
+	CPU_PROFILE_ZONE("write frame rotations");
+	FrameResources& frame = currentFrame();
+	size_t capacity = g_objectPool.capacity();
+	if (frame.rotationCapacity < capacity) {
+		frame.rotationsMapped = (float*)allocatePersistentBuffer(frame.rotations, sizeof(float) * 4 * capacity);
+		frame.rotationCapacity = capacity;
+		frame.rotationsVersion = 0;
+	}
+	if (frame.rotationsVersion != frameResources::rotationsVersion) {
+		copyObjectRotations(g_objectPool, frame.rotationsMapped);
+		frame.rotationsVersion = frameResources::rotationsVersion;
+	}
 
-	// GBuffer
-	unsigned int GBuffer = drawObjectBuffers::GBuffer;
-	glBindFramebuffer(GL_FRAMEBUFFER, GBuffer);
+	drawObjectBuffers::VAO.setBuffer(5, frame.rotations, 0, sizeof(float) * 4);
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Copies the draw commands into the frame's set if they are out of date, the set's buffer is bound as the indirect buffer
+void writeFrameCommands(const std::vector<DrawArraysIndirectCommand>& commands) {
+	CPU_PROFILE_ZONE("write frame commands");
+	FrameResources& frame = currentFrame();
+	if (frame.indirectCapacity < commands.size() || !frame.indirect) {
+		frame.indirectCapacity = std::max<size_t>({commands.size(), frame.indirectCapacity * 2, 1024});
+		frame.indirectMapped = (DrawArraysIndirectCommand*)allocatePersistentBuffer(frame.indirect, sizeof(DrawArraysIndirectCommand) * frame.indirectCapacity);
+		frame.commandsVersion = 0;
+	}
+	if (frame.commandsVersion != frameResources::commandsVersion) {
+		std::copy(commands.begin(), commands.end(), frame.indirectMapped);
+		frame.commandsVersion = frameResources::commandsVersion;
+	}
+	drawObjectBuffers::IndirectDrawBuffer = frame.indirect;
+	glState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, frame.indirect);
+}
 
-	//  Draw
-	glMultiDrawArraysIndirect(GL_TRIANGLES, (const void*)0, drawCommands.size(), 0);
+// Writes the camera into the frame's set and binds it to CameraBlock
+void writeFrameCamera(Camera& camera) {
+	FrameResources& frame = currentFrame();
+	frame.cameraMapped->viewMatrix = camera.getViewMatrix();
+	frame.cameraMapped->projectionMatrix = camera.getProjectionMatrix();
+	glState::bindBufferBase(GL_UNIFORM_BUFFER, 1, frame.camera);
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+// ========================================
+// Object transforms
 
-	shaderDeferred.bind();
+// Every object spins about its own axis
+bool spinObjects = true;
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, drawObjectTextures::GPosition);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, drawObjectTextures::GNormal);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, drawObjectTextures::GColor);
-	
-	shaderDeferred.setUniform("positionTexture", 0);
-	shaderDeferred.setUniform("normalTexture", 1);
-	shaderDeferred.setUniform("colorTexture", 2);
+namespace transformStats {
+	double updateMs = 0.0;
+}
 
-	// Uniforms (object unspecific)
-	shaderDeferred.setUniform("cameraPos", camera.getPosition());
-	
-	shaderDeferred.setUniform("lightCount", lightCount);
+void updateObjectTransforms(float deltaTime) {
+	CPU_PROFILE_ZONE("updateObjectTransforms");
+	// Slots above the high water mark are free
+	uint32_t count = g_objectPool.highWater();
+	if (!spinObjects || count == 0) return;
 
-	// Draw
-	glBindVertexArray(drawObjectBuffers::ScreenQuadVAO);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	
-	shaderDeferred.unbind();
+	auto start = std::chrono::steady_clock::now();
+	g_objectPool.transforms.integrateAll(deltaTime, count);
+	transformStats::updateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-	// Cleanup
-	glBindVertexArray(0);
+	// Copied into the frame's rotation table by writeFrameRotations()
+	frameResources::rotationsVersion++;
 }
 
 // ========================================
-// Draw instanced
+// GPU profiler
+
+// Frames of queries in flight, a frame's results are read back GPU_PROFILER_FRAMES - 1 frames after it was issued
+constexpr const int GPU_PROFILER_FRAMES = 4;
+
+// Named passes timed with GL_TIMESTAMP pairs from a ring of per-frame query sets, so the CPU never waits on the GPU.
+// Timestamps rather than GL_TIME_ELAPSED so passes can nest (the frame pass spans the others). A pass timed more than
+// once in a frame counts as the sum, frames whose results still aren't available when their query set comes round again
+// are dropped rather than waited on
+class GpuProfiler {
+	struct Pass {
+		std::string name;
+		RollingTimings timings;
+	};
 
-// // TODO: Unimplemented
-// void drawInstanced(const ObjectInstanced& object, Camera& camera) {
-// 	auto instances = object.data;
+	struct Scope {
+		int pass;
+		unsigned int begin, end;
+	};
 
-// 	// glDrawArraysInstanced()
-// }
+	struct Frame {
+		std::vector<unsigned int> queries;
+		std::vector<Scope> scopes;
+	};
 
-// ========================================
-// Draw objects dispatched to be rendered
+	std::vector<Pass> passes;
+	std::vector<double> frameMs;
+	Frame frames[GPU_PROFILER_FRAMES];
+	int current = 0;
+	unsigned int usedQueries = 0;
+	uint64_t droppedFrames = 0;
+
+	unsigned int nextQuery() {
+		auto& queries = frames[current].queries;
+		if (usedQueries == queries.size()) {
+			queries.resize(queries.size() + 16);
+			glGenQueries(16, &queries[usedQueries]);
+		}
+		return queries[usedQueries++];
+	}
 
-Camera mainCamera({0.0, 0.0, 0.0}, {0.0, 0.0, 1.0}, 45.0, 0.1, 300.0);
+	void readBack(Frame& frame) {
+		if (frame.scopes.empty()) return;
+
+		int available = 0;
+		glGetQueryObjectiv(frame.scopes.back().end, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			droppedFrames++;
+			frame.scopes.clear();
+			return;
+		}
+
+		frameMs.assign(passes.size(), -1.0);
+		for (auto& scope : frame.scopes) {
+			GLuint64 start, stop;
+			glGetQueryObjectui64v(scope.begin, GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(scope.end, GL_QUERY_RESULT, &stop);
+			frameMs[scope.pass] = std::max(frameMs[scope.pass], 0.0) + (stop - start) / 1000000.0;
+		}
+		for (size_t pass=0; pass<passes.size(); pass++)
+			if (frameMs[pass] >= 0.0) passes[pass].timings.add(frameMs[pass]);
+		frame.scopes.clear();
+	}
 
-void drawDispatched() {
-	shaderGBuffer.bind();
+public:
+	// Pass ids are stable, registering a name twice returns the same id
+	int registerPass(const std::string& name) {
+		for (size_t pass=0; pass<passes.size(); pass++)
+			if (passes[pass].name == name) return (int)pass;
+		passes.push_back({name, {}});
+		return (int)passes.size() - 1;
+	}
 
-	drawObjects(g_objects, mainCamera);
-	// for (auto iObject : g_instancedObjects) {
-	// 	drawInstanced(*iObject, mainCamera);
-	// }
+	// Reads back the oldest frame's results and starts reusing its queries
+	void beginFrame() {
+		current = (current + 1) % GPU_PROFILER_FRAMES;
+		readBack(frames[current]);
+		usedQueries = 0;
+	}
 
-	shaderGBuffer.unbind();
+	// Returns the scope to end()
+	int begin(int pass) {
+		auto& scopes = frames[current].scopes;
+		unsigned int query = nextQuery();
+		glQueryCounter(query, GL_TIMESTAMP);
+		scopes.push_back({pass, query, 0});
+		return (int)scopes.size() - 1;
+	}
 
-	g_objects.clear();
-	// g_instancedObjects.clear();
-}
+	void end(int scope) {
+		unsigned int query = nextQuery();
+		glQueryCounter(query, GL_TIMESTAMP);
+		frames[current].scopes[scope].end = query;
+	}
 
-// ========================================
-// Camera controller
+	// Most recent completed measurement
+	double getLastMs(int pass) const {
+		return passes[pass].timings.last();
+	}
 
-void cameraController(Camera& camera, GLFWwindow* window, double deltaTime) {
-	glm::vec3 offset = {0.0, 0.0, 0.0};
+	TimingSummary getStats(int pass) const {
+		return passes[pass].timings.summary();
+	}
 
-	float speed;
+	// Every pass that has been timed, in registration order
+	std::vector<std::pair<std::string, TimingSummary>> getAllStats() const {
+		std::vector<std::pair<std::string, TimingSummary>> stats;
+		for (auto& pass : passes) {
+			TimingSummary summary = pass.timings.summary();
+			if (summary.samples) stats.emplace_back(pass.name, summary);
+		}
+		return stats;
+	}
+
+	uint64_t getDroppedFrames() const {
+		return droppedFrames;
+	}
+};
+
+GpuProfiler g_gpuProfiler;
+
+// Times a pass until the end of the enclosing block
+class GpuProfileScope {
+	int scope;
+
+public:
+	GpuProfileScope(int pass) : scope(g_gpuProfiler.begin(pass)) {}
+	~GpuProfileScope() {
+		g_gpuProfiler.end(scope);
+	}
+};
+
+namespace gpuPasses {
+	int frame = g_gpuProfiler.registerPass("frame");
+	int geometry = g_gpuProfiler.registerPass("geometry");
+	int hiZ = g_gpuProfiler.registerPass("hi_z");
+	int depthCopy = g_gpuProfiler.registerPass("depth_copy");
+	int lighting = g_gpuProfiler.registerPass("lighting");
+	int upscale = g_gpuProfiler.registerPass("upscale");
+}
+
+// Writes every pass's rolling stats to <path>.csv and <path>.json
+void writeGpuProfile(const std::string& path) {
+	auto stats = g_gpuProfiler.getAllStats();
+	std::ofstream csv(path + ".csv"), json(path + ".json");
+	writeTimingsCsv(csv, stats);
+	writeTimingsJson(json, stats);
+	std::cout << "Wrote GPU pass timings for the last " << TIMING_WINDOW << " frames to " << path << ".csv and " << path << ".json\n";
+}
+
+// ========================================
+// Samples passed counter
+
+// Double buffered GL_SAMPLES_PASSED queries read a frame late, samples passed over the pixels drawn is the
+// overdraw (fragments shaded per pixel)
+class SamplesCounter {
+	unsigned int queries[2] {};
+	bool pending[2] {};
+	double pixelsDrawn[2] {};
+	int current = 0;
+
+	double total = 0.0;
+	unsigned int samples = 0;
+
+public:
+	void init() {
+		glGenQueries(2, queries);
+	}
+
+	void begin() {
+		glBeginQuery(GL_SAMPLES_PASSED, queries[current]);
+	}
+
+	// pixels: the area drawn this frame, so results stay comparable across internal resolutions
+	void end(double pixels) {
+		glEndQuery(GL_SAMPLES_PASSED);
+		pixelsDrawn[current] = pixels;
+		pending[current] = true;
+		current ^= 1;
+
+		if (!pending[current]) return;
+		int available = 0;
+		glGetQueryObjectiv(queries[current], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return;
+
+		GLuint64 passed;
+		glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &passed);
+		pending[current] = false;
+		total += passed / std::max(pixelsDrawn[current], 1.0);
+		samples++;
+	}
+
+	// Average samples passed per pixel since the last call
+	double takeAverage() {
+		double average = samples ? total / samples : 0.0;
+		total = 0.0;
+		samples = 0;
+		return average;
+	}
+};
+
+// G-buffer pass overdraw
+SamplesCounter g_geometrySamples;
+
+// ========================================
+// Dynamic resolution
+
+// Render targets are allocated at WIDTH x HEIGHT, the scene is rendered into a renderWidth x renderHeight viewport of them
+unsigned int renderWidth = WIDTH;
+unsigned int renderHeight = HEIGHT;
+
+// Adjusts the internal resolution each frame to keep GPU frame time within budget
+class DynamicResolutionController {
+public:
+	bool enabled = false;
+	double budgetMs = 1000.0 / 60.0;
+	float minScale = 0.5f;
+	float maxScale = 1.0f;
+	float scale = 1.0f;
+
+	void update(double gpuFrameMs) {
+		if (!enabled) {
+			scale = maxScale;
+			return;
+		}
+		// Dead zone so the resolution doesn't oscillate around the budget
+		if (gpuFrameMs <= 0.0 || std::abs(gpuFrameMs - budgetMs) < budgetMs * 0.05) return;
+
+		// GPU cost scales roughly with pixel count (scale squared), damped since timings lag a frame
+		float idealScale = scale * (float)std::sqrt(budgetMs / gpuFrameMs);
+		scale = glm::clamp(scale + (idealScale - scale) * 0.2f, minScale, maxScale);
+	}
+};
+
+DynamicResolutionController dynamicResolution;
+
+// ========================================
+// Occlusion culling
+
+namespace occlusionCulling {
+	bool enabled = true;
+
+	Shader cull;
+	Shader hiZFromDepth;
+	Shader hiZDownsample;
+
+	// Level 0 is the largest power of two that fits the window, built from the rendered region of the depth
+	unsigned int hiZWidth = 1;
+	unsigned int hiZHeight = 1;
+	int hiZLevels = 1;
+	// Only when last frame built the pyramid does it match the camera's previous view projection
+	bool hiZAvailable = false;
+
+	// Counters are read a frame late behind a fence so the CPU never waits on the culling
+	int readbackIndex = 0;
+	GLsync readbackFences[2] {};
+	unsigned int readbackCandidates[2] {};
+
+	// Commands the per-phase buffers can hold, meshlets can make it more than one per object
+	size_t commandCapacity = 0;
+
+	// Last completed frame
+	unsigned int candidates = 0;
+	unsigned int phase1Visible = 0;
+	unsigned int phase2Visible = 0;
+}
+
+void setupOcclusionCulling(std::string shaderDirectory) {
+	using namespace occlusionCulling;
+	cull = Shader(loadShaderSource(shaderDirectory + "occlusionCull.comp"));
+	hiZFromDepth = Shader(addShaderDefines(loadShaderSource(shaderDirectory + "hiZ.comp"), {"HIZ_FROM_DEPTH"}));
+	hiZDownsample = Shader(loadShaderSource(shaderDirectory + "hiZ.comp"));
+
+	while (hiZWidth * 2 <= WIDTH) hiZWidth *= 2;
+	while (hiZHeight * 2 <= HEIGHT) hiZHeight *= 2;
+	while ((1u << hiZLevels) <= std::max(hiZWidth, hiZHeight)) hiZLevels++;
+
+	drawObjectTextures::HiZ = GlTexture(GL_R32F, hiZWidth, hiZHeight, hiZLevels);
+
+	// Object bounds and the command buffers are created by uploadOcclusionData()
+	drawObjectBuffers::OcclusionCounters = GlBuffer(sizeof(unsigned int) * 4, NULL, 0);
+	for (auto& readback : drawObjectBuffers::OcclusionReadback) readback = GlBuffer(sizeof(unsigned int) * 4, NULL, GL_CLIENT_STORAGE_BIT);
+}
+
+// Grows the per-phase command buffers to hold at least commandCount commands
+void reserveOcclusionCommands(size_t commandCount) {
+	using namespace occlusionCulling;
+	if (commandCount <= commandCapacity) return;
+
+	commandCapacity = std::max(commandCount, commandCapacity + commandCapacity / 2);
+	for (auto buffer : {&drawObjectBuffers::OcclusionVisible, &drawObjectBuffers::OcclusionOccluded, &drawObjectBuffers::OcclusionVisiblePhase2})
+		*buffer = GlBuffer(sizeof(DrawArraysIndirectCommand) * commandCapacity, NULL, 0);
+}
+
+// Object bounds for the cull shader, command buffers start sized for one command per object
+void uploadOcclusionData(const std::vector<Aabb>& objectBounds) {
+	drawObjectBuffers::ObjectBounds = GlBuffer(sizeof(Aabb) * objectBounds.size(), objectBounds.data(), GL_DYNAMIC_STORAGE_BIT);
+
+	reserveOcclusionCommands(std::max<size_t>(objectBounds.size(), 1));
+}
+
+// Farthest depth pyramid of the rendered region of GDepth
+void buildHiZ() {
+	using namespace occlusionCulling;
+
+	hiZFromDepth.bind();
+	glState::bindTextureUnit(0, drawObjectTextures::GDepth);
+	hiZFromDepth.setUniform("depthTexture", 0);
+	hiZFromDepth.setUniform("depthSize", glm::ivec2(renderWidth, renderHeight));
+	glBindImageTexture(1, drawObjectTextures::HiZ, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((hiZWidth + 7) / 8, (hiZHeight + 7) / 8, 1);
+
+	hiZDownsample.bind();
+	for (int level=1; level<hiZLevels; level++) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		unsigned int levelWidth = std::max(hiZWidth >> level, 1u);
+		unsigned int levelHeight = std::max(hiZHeight >> level, 1u);
+		glBindImageTexture(0, drawObjectTextures::HiZ, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, drawObjectTextures::HiZ, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+	}
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	hiZAvailable = true;
+}
+
+// Phase 1 tests the uploaded commands, phase 2 the commands phase 1 rejected (see occlusionCull.comp)
+void dispatchOcclusionCull(int phase, glm::mat4 viewProjection, unsigned int candidateCount) {
+	using namespace occlusionCulling;
+
+	cull.bind();
+	cull.setUniform("phase", phase);
+	cull.setUniform("candidateCount", candidateCount);
+	cull.setUniform("viewProjection", viewProjection);
+
+	glState::bindTextureUnit(0, drawObjectTextures::HiZ);
+	cull.setUniform("hiZ", 0);
+	cull.setUniform("hiZSize", glm::ivec2(hiZWidth, hiZHeight));
+	cull.setUniform("hiZLevels", hiZLevels);
+	cull.setUniform("hiZAvailable", (int)hiZAvailable);
+
+	glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, phase == 1 ? drawObjectBuffers::IndirectDrawBuffer : drawObjectBuffers::OcclusionOccluded);
+	glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, phase == 1 ? drawObjectBuffers::OcclusionVisible : drawObjectBuffers::OcclusionVisiblePhase2);
+	glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawObjectBuffers::OcclusionOccluded);
+	glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, drawObjectBuffers::OcclusionCounters);
+	glState::bindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawObjectBuffers::ObjectBounds);
+
+	// Phase 2 can't have more candidates than phase 1, the shader reads the real count
+	glDispatchCompute((candidateCount + 255) / 256, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// Replaces the single MDI call of the geometry pass, expects the G-buffer bound and the indirect buffer uploaded
+void drawOcclusionCulled(Camera& camera, Shader& gBufferShader, unsigned int commandCount) {
+	using namespace occlusionCulling;
+
+	reserveOcclusionCommands(commandCount);
+
+	glClearNamedBufferData(drawObjectBuffers::OcclusionCounters, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+	// Phase 1: last frame's pyramid through last frame's camera
+	dispatchOcclusionCull(1, camera.getPreviousViewProjectionMatrix(), commandCount);
+	gBufferShader.bind();
+	glState::bindBuffer(GL_PARAMETER_BUFFER, drawObjectBuffers::OcclusionCounters);
+	glState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawObjectBuffers::OcclusionVisible);
+	glMultiDrawArraysIndirectCount(GL_TRIANGLES, (const void*)0, 0, commandCount, 0);
+
+	// Phase 2: this frame's phase 1 depth, the pyramid is kept as next frame's
+	{
+		GpuProfileScope profile(gpuPasses::hiZ);
+		buildHiZ();
+	}
+	dispatchOcclusionCull(2, camera.getViewProjectionMatrix(), commandCount);
+	gBufferShader.bind();
+	glState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawObjectBuffers::OcclusionVisiblePhase2);
+	glMultiDrawArraysIndirectCount(GL_TRIANGLES, (const void*)0, sizeof(unsigned int) * 2, commandCount, 0);
+
+	glState::bindBuffer(GL_PARAMETER_BUFFER, 0);
+	glState::bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawObjectBuffers::IndirectDrawBuffer);
+
+	// Stats
+	glCopyNamedBufferSubData(drawObjectBuffers::OcclusionCounters, drawObjectBuffers::OcclusionReadback[readbackIndex], 0, 0, sizeof(unsigned int) * 4);
+	if (readbackFences[readbackIndex]) glDeleteSync(readbackFences[readbackIndex]);
+	readbackFences[readbackIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readbackCandidates[readbackIndex] = commandCount;
+	readbackIndex ^= 1;
+
+	if (readbackFences[readbackIndex] && glClientWaitSync(readbackFences[readbackIndex], 0, 0) != GL_TIMEOUT_EXPIRED) {
+		unsigned int counters[4];
+		glGetNamedBufferSubData(drawObjectBuffers::OcclusionReadback[readbackIndex], 0, sizeof(counters), counters);
+		candidates = readbackCandidates[readbackIndex];
+		phase1Visible = counters[0];
+		phase2Visible = counters[2];
+		glDeleteSync(readbackFences[readbackIndex]);
+		readbackFences[readbackIndex] = 0;
+	}
+}
+
+// ========================================
+// Lighting pass
+
+void bindGBufferTextures(Shader& shader, Camera& camera) {
+	if (gBufferLayout == GBUFFER_LAYOUT_COMPACT) {
+		glState::bindTextureUnit(0, drawObjectTextures::GDepth);
+		glState::bindTextureUnit(1, drawObjectTextures::GNormalPacked);
+		glState::bindTextureUnit(2, drawObjectTextures::GAlbedo);
+
+		shader.setUniform("depthTexture", 0);
+		shader.setUniform("inverseViewProjection", glm::inverse(camera.getProjectionMatrix() * camera.getViewMatrix()));
+	}
+	else {
+		glState::bindTextureUnit(0, drawObjectTextures::GPosition);
+		glState::bindTextureUnit(1, drawObjectTextures::GNormal);
+		glState::bindTextureUnit(2, drawObjectTextures::GColor);
+
+		shader.setUniform("positionTexture", 0);
+	}
+	
+	shader.setUniform("normalTexture", 1);
+	shader.setUniform("colorTexture", 2);
+
+	// Uniforms (object unspecific)
+	shader.setUniform("cameraPos", camera.getPosition());
+	shader.setUniform("renderSize", glm::vec2(renderWidth, renderHeight));
+}
+
+namespace temporalLighting {
+	int historyIndex = 0;
+	unsigned int frameIndex = 0;
+	// False when last frame didn't write history, every pixel then shades all lights
+	bool historyAvailable = false;
+	unsigned int previousRenderWidth = WIDTH;
+	unsigned int previousRenderHeight = HEIGHT;
+}
+
+void drawTemporalLightingPass(Camera& camera, int slices) {
+	using namespace temporalLighting;
+	auto& shader = activeShaders().deferredTemporal;
+
+	// Write this frame's history alongside the lit colour, read last frame's
+	auto& Lit = drawObjectBuffers::Lit;
+	Lit.attach(GL_COLOR_ATTACHMENT1, drawObjectTextures::GHistory[historyIndex]);
+	unsigned int attachments[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	Lit.setDrawBuffers(2, attachments);
+	float rejected[] = {0.0f, 0.0f, 0.0f, -1.0f};
+	glClearNamedFramebufferfv(Lit, GL_COLOR, 1, rejected);
+
+	shader.bind();
+	bindGBufferTextures(shader, camera);
+	shader.setUniform("lightCount", lightCount);
+
+	glState::bindTextureUnit(3, drawObjectTextures::GHistory[historyIndex ^ 1]);
+	shader.setUniform("historyTexture", 3);
+	shader.setUniform("historyAvailable", (int)historyAvailable);
+	shader.setUniform("previousViewProjection", camera.getPreviousViewProjectionMatrix());
+	shader.setUniform("previousCameraPos", camera.getPreviousPosition());
+	shader.setUniform("previousRenderSize", glm::vec2(previousRenderWidth, previousRenderHeight));
+	shader.setUniform("temporalSlices", slices);
+	shader.setUniform("frameIndex", (int)(frameIndex % slices));
+	// Each frame's estimate is weighted by less than 1/slices so the cycling slices don't visibly flicker
+	shader.setUniform("historyWeight", 1.0f - 1.0f / (2.0f * slices));
+
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	Lit.setDrawBuffers(1, attachments);
+	historyIndex ^= 1;
+	historyAvailable = true;
+}
+
+// Expects the Lit FBO bound with the GBuffer stencil and the stencil test set up, see drawObjects()
+void drawLightingPass(Camera& camera, int downscale, int slices) {
+	auto& shaders = activeShaders();
+	glState::bindVertexArray(drawObjectBuffers::ScreenQuadVAO);
+
+	// Temporal accumulation only applies to full resolution lighting
+	if (downscale == 1 && slices > 1) {
+		drawTemporalLightingPass(camera, slices);
+		return;
+	}
+
+	if (downscale == 1) {
+		shaders.deferred.bind();
+		bindGBufferTextures(shaders.deferred, camera);
+		shaders.deferred.setUniform("lightCount", lightCount);
+
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+		return;
+	}
+
+	int lowResWidth = (renderWidth + downscale - 1) / downscale;
+	int lowResHeight = (renderHeight + downscale - 1) / downscale;
+
+	// Light at reduced resolution, no stencil here so background texels write a rejected guide instead
+	glState::bindFramebuffer(GL_FRAMEBUFFER, drawObjectBuffers::LowResLighting);
+	glViewport(0, 0, lowResWidth, lowResHeight);
+
+	shaders.deferredLowRes.bind();
+	bindGBufferTextures(shaders.deferredLowRes, camera);
+	shaders.deferredLowRes.setUniform("lightCount", lightCount);
+	shaders.deferredLowRes.setUniform("lightingDownscale", downscale);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+
+	glState::bindFramebuffer(GL_FRAMEBUFFER, drawObjectBuffers::Lit);
+	glViewport(0, 0, renderWidth, renderHeight);
+
+	// Depth and normal aware upsample into the stencil tested Lit FBO
+	shaders.upsample.bind();
+	bindGBufferTextures(shaders.upsample, camera);
+
+	glState::bindTextureUnit(3, drawObjectTextures::GLightDiffuse);
+	glState::bindTextureUnit(4, drawObjectTextures::GLightSpecular);
+	glState::bindTextureUnit(5, drawObjectTextures::GLightGuide);
+
+	shaders.upsample.setUniform("diffuseTexture", 3);
+	shaders.upsample.setUniform("specularTexture", 4);
+	shaders.upsample.setUniform("guideTexture", 5);
+	shaders.upsample.setUniform("lightingDownscale", downscale);
+	shaders.upsample.setUniform("lowResSize", glm::ivec2(lowResWidth, lowResHeight));
+
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+// Reads the rendered region of the bound read framebuffer
+std::vector<unsigned char> readFramebufferPixels() {
+	std::vector<unsigned char> pixels(renderWidth * renderHeight * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, renderWidth, renderHeight, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+	return pixels;
+}
+
+double computePSNR(const std::vector<unsigned char>& reference, const std::vector<unsigned char>& image) {
+	double squaredError = 0.0;
+	for (size_t i=0; i<reference.size(); i++) {
+		double diff = (double)reference[i] - image[i];
+		squaredError += diff * diff;
+	}
+	double mse = squaredError / reference.size();
+	if (mse == 0.0) return INFINITY;
+	return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+// ========================================
+// Object pool
+
+namespace objectPoolStats {
+	double syncMs = 0.0;
+	uint32_t uploadedSlots = 0;
+	uint32_t compacted = 0;
+}
+
+// Objects moved per frame while the pool is fragmented
+constexpr const uint32_t OBJECT_COMPACTION_BUDGET = 4096;
+
+// (Re)allocates every per-object table at the pool's capacity and uploads it, g_scene's object streams are pointed at
+// the pool's tables
+void uploadObjectTables() {
+	CPU_PROFILE_ZONE("uploadObjectTables");
+	size_t capacity = g_objectPool.capacity();
+	auto& VAO = drawObjectBuffers::VAO;
+	auto& UniformsBuffer = drawObjectBuffers::UniformsBuffer;
+
+	// Uniforms, one table after the other in the same buffer
+	size_t tableSize = sizeof(float) * 3 * capacity;
+	size_t meshTableSize = sizeof(uint32_t) * capacity;
+	UniformsBuffer = GlBuffer(objectUniformsSize(capacity), NULL, GL_DYNAMIC_STORAGE_BIT);
+	UniformsBuffer.update(0, tableSize, g_objectPool.positions.data());
+	UniformsBuffer.update(tableSize, tableSize, g_objectPool.colors.data());
+	UniformsBuffer.update(tableSize * 2, meshTableSize, g_objectPool.meshes.data());
+
+	// Divisor 1, change once per instance / draw call
+	VAO.setAttribute(2, UniformsBuffer, 0, sizeof(float) * 3, 3, GL_FLOAT, false, 1);	// Positions
+	VAO.setAttribute(3, UniformsBuffer, tableSize, sizeof(float) * 3, 3, GL_FLOAT, false, 1);	// Color
+	VAO.setIntegerAttribute(4, UniformsBuffer, tableSize * 2, sizeof(uint32_t), 1, GL_UNSIGNED_INT, 1);	// Mesh, selects the quantisation bounds
+
+	// Rotations, the buffer is the frame's set (see writeFrameRotations())
+	VAO.setAttribute(5, 0, 0, sizeof(float) * 4, 4, GL_FLOAT, false, 1);
+
+	// Scale
+	drawObjectBuffers::TransformsBuffer = GlBuffer(sizeof(float) * capacity, g_objectPool.transforms.scales.data(), GL_DYNAMIC_STORAGE_BIT);
+	VAO.setAttribute(6, drawObjectBuffers::TransformsBuffer, 0, sizeof(float), 1, GL_FLOAT, false, 1);
+
+	uploadOcclusionData(g_objectPool.bounds);
+
+	g_scene.objectPositions = g_objectPool.positions.data();
+	g_scene.objectColors = g_objectPool.colors.data();
+	g_scene.objectMeshes = g_objectPool.meshes.data();
+	g_scene.objectCount = capacity;
+
+	g_objectPool.grown = false;
+	g_objectPool.dirtySlots.clear();
+	frameResources::rotationsVersion++;
+}
+
+// Once per frame: a step of compaction, then the pool's changes to the GPU tables and the BVH. Only changed slots are
+// uploaded (in contiguous runs) unless the pool grew
+void syncObjectPool() {
+	CPU_PROFILE_ZONE("syncObjectPool");
+	auto start = std::chrono::steady_clock::now();
+	objectPoolStats::compacted = g_objectPool.compact(OBJECT_COMPACTION_BUDGET);
+	objectPoolStats::uploadedSlots = 0;
+
+	if (g_objectPool.grown) {
+		objectPoolStats::uploadedSlots = g_objectPool.capacity();
+		uploadObjectTables();
+		g_bvh.build(g_objectPool.bounds);
+	}
+	else if (!g_objectPool.dirtySlots.empty()) {
+		uploadDirtySlots(g_objectPool, drawObjectBuffers::UniformsBuffer, drawObjectBuffers::TransformsBuffer, drawObjectBuffers::ObjectBounds);
+
+		auto& dirty = g_objectPool.dirtySlots;
+		for (auto slot : dirty) g_bvh.setObjectBounds(slot, g_objectPool.bounds[slot]);
+		g_bvh.refit();
+
+		objectPoolStats::uploadedSlots = (uint32_t)dirty.size();
+		dirty.clear();
+		frameResources::rotationsVersion++;
+	}
+	objectPoolStats::syncMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Objects of the loaded scene, then batches spawned at runtime
+std::vector<Object> g_sceneObjects;
+std::vector<std::vector<Object>> g_spawnedBatches;
+
+constexpr const uint32_t SPAWN_BATCH_SIZE = 1000;
+
+// A cloud of objects with random meshes and colors in front of the camera
+void spawnBatch(Camera& camera) {
+	static std::mt19937 gen(7);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> channel(0.0f, 1.0f);
+	std::uniform_int_distribution<uint32_t> mesh(0, (uint32_t)std::max<uint64_t>(g_scene.meshCount, 1) - 1);
+
+	glm::vec3 center = camera.getPosition() + camera.getForward() * 15.0f;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Object> batch;
+	batch.reserve(SPAWN_BATCH_SIZE);
+	for (uint32_t i=0; i<SPAWN_BATCH_SIZE; i++) {
+		glm::vec3 position = center + glm::vec3(unit(gen), unit(gen), unit(gen)) * 8.0f;
+		float color[3] = {channel(gen), channel(gen), channel(gen)};
+		batch.emplace_back(g_objectPool.spawn(glm::value_ptr(position), color, mesh(gen), 0.5f + channel(gen) * 0.5f));
+	}
+	g_spawnedBatches.push_back(std::move(batch));
+
+	std::cout << "Spawned " << SPAWN_BATCH_SIZE << " objects in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms ("
+		<< g_objectPool.liveCount() << " live, " << g_objectPool.capacity() << " slots)\n";
+}
+
+// Despawns a random spawned batch, leaving holes for compaction
+void despawnBatch() {
+	static std::mt19937 gen(11);
+	if (g_spawnedBatches.empty()) return;
+
+	size_t index = std::uniform_int_distribution<size_t>(0, g_spawnedBatches.size() - 1)(gen);
+	auto start = std::chrono::steady_clock::now();
+	for (auto& object : g_spawnedBatches[index]) g_objectPool.despawn(object.getHandle());
+	std::swap(g_spawnedBatches[index], g_spawnedBatches.back());
+	g_spawnedBatches.pop_back();
+
+	std::cout << "Despawned " << SPAWN_BATCH_SIZE << " objects in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms ("
+		<< g_objectPool.liveCount() << " live, fragmentation " << g_objectPool.fragmentation() * 100.0f << "%)\n";
+}
+
+// ========================================
+// DRAW OPTIONS:
+
+// Per-object data and vertices are uploaded once by uploadScene(), this also keeps the draw commands from the first frame
+// while the object list doesn't change (frustum culling changes it every frame)
+#define NO_REGENERATING_DRAW_CALLS
+// ========================================
+
+bool frustumCulling = true;
+
+// Screen space error LOD selection, the coarsest level whose error projects to at most lodErrorPixels is drawn
+bool lodSelection = true;
+float lodErrorPixels = 1.0f;
+
+namespace lodStats {
+	uint64_t triangles = 0;
+	uint64_t fullDetailTriangles = 0;
+}
+
+// Full detail large meshes are drawn per meshlet, skipping meshlets outside the frustum or facing away
+bool meshletCulling = true;
+
+namespace meshletStats {
+	uint64_t drawn = 0;
+	uint64_t frustumCulled = 0;
+	uint64_t backfaceCulled = 0;
+}
+
+// Visible objects are drawn in render key order (front to back) rather than submission order
+bool renderQueueSorting = true;
+
+enum RenderPass {
+	RENDER_PASS_GBUFFER
+};
+
+RenderQueue g_renderQueue;
+
+namespace renderQueueStats {
+	double sortMs = 0.0;
+	int passes = 0;
+}
+
+void drawObjects(const unsigned int* objects, size_t objectCount, Camera& camera) {
+	CPU_PROFILE_ZONE("drawObjects");
+	unsigned int VAO = drawObjectBuffers::VAO;
+	glState::bindVertexArray(VAO);
+
+	#ifdef NO_REGENERATING_DRAW_CALLS
+	static bool firstRun = true;
+	static bool generatedWithMeshletCulling = false;
+	static uint64_t generatedLayoutVersion = 0;
+	static std::vector<DrawArraysIndirectCommand> drawCommands;
+	#else
+	std::vector<DrawArraysIndirectCommand> drawCommands;
+	#endif
+
+	#ifdef NO_REGENERATING_DRAW_CALLS
+	// Meshlet culling is view dependent, and turning it off has to bring back the ranges it dropped. The commands'
+	// baseInstance values are slots, which spawning, despawning and compaction change without always changing the count
+	if (firstRun || frustumCulling || lodSelection || renderQueueSorting || meshletCulling || generatedWithMeshletCulling ||
+		generatedLayoutVersion != g_objectPool.layoutVersion || drawCommands.size() != objectCount) {
+	drawCommands.clear();
+	generatedWithMeshletCulling = meshletCulling;
+	generatedLayoutVersion = g_objectPool.layoutVersion;
+	#endif
+	CPU_PROFILE_ZONE("generate draw commands");
+
+	glm::vec3 cameraPosition = camera.getPosition();
+	Frustum frustum(glm::value_ptr(camera.getViewProjectionMatrix()));
+	DrawCommandSettings settings {
+		{cameraPosition.x, cameraPosition.y, cameraPosition.z},
+		&frustum,
+		camera.getProjectionMatrix()[1][1] * renderHeight * 0.5f,
+		lodErrorPixels,
+		lodSelection,
+		meshletCulling,
+	};
+	DrawCommandStats stats;
+	generateDrawCommands(objects, objectCount, g_scene.objectMeshes, g_scene.objectPositions, g_objectPool.transforms, g_meshLods, g_meshlets, settings, drawCommands, stats);
+
+	lodStats::triangles = stats.triangles;
+	lodStats::fullDetailTriangles = stats.fullDetailTriangles;
+	meshletStats::drawn = stats.meshletsDrawn;
+	meshletStats::frustumCulled = stats.meshletsFrustumCulled;
+	meshletStats::backfaceCulled = stats.meshletsBackfaceCulled;
+
+	frameResources::commandsVersion++;
+	#ifdef NO_REGENERATING_DRAW_CALLS
+	} // firstRun
+	firstRun = false;
+	#endif
+
+	// Draw calls (MDI)
+	writeFrameCommands(drawCommands);
+
+	// Uniforms (object unspecific)
+	Shader& gBufferShader = activeGeometryShader();
+	writeFrameCamera(camera);
+
+	// GBuffer
+	unsigned int GBuffer = gBufferLayout == GBUFFER_LAYOUT_COMPACT ? drawObjectBuffers::GBufferCompact : drawObjectBuffers::GBuffer;
+	glState::bindFramebuffer(GL_FRAMEBUFFER, GBuffer);
+
+	// Tag covered pixels in the stencil so the lighting pass only runs on geometry
+	glState::enable(GL_STENCIL_TEST);
+	glStencilMask(0xFF);
+	glStencilFunc(GL_ALWAYS, 1, 0xFF);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+	glViewport(0, 0, renderWidth, renderHeight);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+	//  Draw
+	int geometryScope = g_gpuProfiler.begin(gpuPasses::geometry);
+	g_geometrySamples.begin();
+	if (occlusionCulling::enabled && !drawCommands.empty()) {
+		drawOcclusionCulled(camera, gBufferShader, drawCommands.size());
+	}
+	else {
+		glMultiDrawArraysIndirect(GL_TRIANGLES, (const void*)0, drawCommands.size(), 0);
+		occlusionCulling::hiZAvailable = false;
+	}
+	g_geometrySamples.end((double)renderWidth * renderHeight);
+	g_gpuProfiler.end(geometryScope);
+
+	// Copy depth/stencil into the Lit FBO, the GBuffer depth texture can't be attached while it is sampled
+	{
+		GpuProfileScope profile(gpuPasses::depthCopy);
+		glState::bindFramebuffer(GL_READ_FRAMEBUFFER, GBuffer);
+		glState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, drawObjectBuffers::Lit);
+		glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	}
+
+	glState::bindFramebuffer(GL_FRAMEBUFFER, drawObjectBuffers::Lit);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Lighting only where the stencil was tagged, the screen quad must not be depth tested against the copied depth
+	glStencilMask(0x00);
+	glStencilFunc(GL_EQUAL, 1, 0xFF);
+	glState::disable(GL_DEPTH_TEST);
+
+	bool temporal = lightingDownscale == 1 && temporalLightSlices > 1;
+
+	std::vector<unsigned char> referencePixels;
+	if (measureLightingPSNR && (lightingDownscale > 1 || temporal)) {
+		drawLightingPass(camera, 1, 1);
+		referencePixels = readFramebufferPixels();
+	}
+
+	{
+		GpuProfileScope profile(gpuPasses::lighting);
+		drawLightingPass(camera, lightingDownscale, temporalLightSlices);
+	}
+
+	if (!referencePixels.empty()) {
+		std::cout << "Lighting 1/" << lightingDownscale << " resolution, 1/" << (temporal ? temporalLightSlices : 1) << " lights per frame PSNR vs full lighting: " << computePSNR(referencePixels, readFramebufferPixels()) << " dB\n";
+		measureLightingPSNR = false;
+	}
+
+	temporalLighting::historyAvailable = temporalLighting::historyAvailable && temporal;
+	temporalLighting::frameIndex++;
+	temporalLighting::previousRenderWidth = renderWidth;
+	temporalLighting::previousRenderHeight = renderHeight;
+
+	glState::enable(GL_DEPTH_TEST);
+	glState::disable(GL_STENCIL_TEST);
+	glStencilMask(0xFF);
+
+	// Upscale the internal resolution to the window
+	{
+		GpuProfileScope profile(gpuPasses::upscale);
+		glState::bindFramebuffer(GL_READ_FRAMEBUFFER, drawObjectBuffers::Lit);
+		glState::bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+	glState::bindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, WIDTH, HEIGHT);
+}
+
+// ========================================
+// Draw instanced
+
+// // TODO: Unimplemented
+// void drawInstanced(const ObjectInstanced& object, Camera& camera) {
+// 	auto instances = object.data;
+
+// 	// glDrawArraysInstanced()
+// }
+
+// ========================================
+// Draw objects dispatched to be rendered
+
+Camera mainCamera({0.0, 0.0, 0.0}, {0.0, 0.0, 1.0}, 45.0, 0.1, 300.0);
+
+namespace cullingStats {
+	double cullMs = 0.0;
+	unsigned int submitted = 0;
+	unsigned int visible = 0;
+}
+
+// Drops submitted objects outside the camera frustum using the BVH
+void cullObjects(std::vector<unsigned int>& objects, Camera& camera) {
+	CPU_PROFILE_ZONE("cullObjects");
+	static std::vector<unsigned char> visibleMask;
+
+	auto start = std::chrono::steady_clock::now();
+	cullingStats::submitted = objects.size();
+
+	// Transient, room for every object the BVH holds
+	uint32_t* visible = g_frameAllocator.allocate<uint32_t>(g_bvh.objectCount());
+	g_bvh.cullSubmitted(Frustum(glm::value_ptr(camera.getViewProjectionMatrix())), visible, visibleMask, objects);
+
+	cullingStats::visible = objects.size();
+	cullingStats::cullMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Visible objects are sorted by render key (pass, program, view depth, mesh) so opaque draws go front to back
+void sortObjects(std::vector<unsigned int>& objects, Camera& camera) {
+	CPU_PROFILE_ZONE("sortObjects");
+	auto start = std::chrono::steady_clock::now();
+
+	glm::vec3 cameraPosition = camera.getPosition();
+	glm::vec3 forward = camera.getForward();
+	sortByRenderKey(g_renderQueue, objects.data(), objects.size(), g_objectPool.positions.data(), g_objectPool.meshes.data(),
+		glm::value_ptr(cameraPosition), glm::value_ptr(forward), RENDER_PASS_GBUFFER, vertexFormat);
+
+	renderQueueStats::passes = g_renderQueue.sortPasses();
+	renderQueueStats::sortMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void drawDispatched() {
+	auto mergeStart = std::chrono::steady_clock::now();
+	{
+		CPU_PROFILE_ZONE("merge submissions");
+		g_submissionQueues.merge(g_objects);
+	}
+	submissionStats::queues = g_submissionQueues.queueCount();
+	submissionStats::mergeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mergeStart).count();
+
+	if (frustumCulling) cullObjects(g_objects, mainCamera);
+	else cullingStats::submitted = cullingStats::visible = g_objects.size();
+	if (renderQueueSorting) sortObjects(g_objects, mainCamera);
+
+	// Pick this frame's internal resolution from the latest GPU frame time
+	dynamicResolution.update(g_gpuProfiler.getLastMs(gpuPasses::frame));
+	renderWidth = glm::clamp((unsigned int)(WIDTH * dynamicResolution.scale), 1u, WIDTH);
+	renderHeight = glm::clamp((unsigned int)(HEIGHT * dynamicResolution.scale), 1u, HEIGHT);
+
+	g_gpuProfiler.beginFrame();
+	int frameScope = g_gpuProfiler.begin(gpuPasses::frame);
+	activeGeometryShader().bind();
+
+	writeFrameRotations();
+	drawObjects(g_objects.data(), g_objects.size(), mainCamera);
+	// for (auto iObject : g_instancedObjects) {
+	// 	drawInstanced(*iObject, mainCamera);
+	// }
+
+	g_gpuProfiler.end(frameScope);
+	endFrameResources();
+
+	mainCamera.storePreviousFrame();
+
+	g_objects.clear();
+	// g_instancedObjects.clear();
+}
+
+// ========================================
+// Camera controller
+
+void cameraController(Camera& camera, GLFWwindow* window, double deltaTime) {
+	glm::vec3 offset = {0.0, 0.0, 0.0};
+
+	float speed;
 	if (glfwGetKey(window, GLFW_KEY_F)) speed = 8.0f * deltaTime;
 	else speed = 30.0f * deltaTime;
 	
@@ -586,15 +2076,390 @@ void cameraController(Camera& camera, GLFWwindow* window, double deltaTime) {
 	if (glfwGetKey(window, GLFW_KEY_DOWN)) camera.setForward(glm::normalize(camera.getForward() + up*-rotSpeed));
 }
 
+// ========================================
+// Settings
+
+// Render state changes, on the thread that owns the GL context
+void handleKey(int key) {
+	if (key == GLFW_KEY_G) {
+		gBufferLayout = gBufferLayout == GBUFFER_LAYOUT_COMPACT ? GBUFFER_LAYOUT_FULL : GBUFFER_LAYOUT_COMPACT;
+		std::cout << "G-buffer layout: " << (gBufferLayout == GBUFFER_LAYOUT_COMPACT ? "compact" : "full") << "\n";
+	}
+
+	if (key == GLFW_KEY_L) {
+		lightingDownscale = lightingDownscale == 4 ? 1 : lightingDownscale * 2;
+		std::cout << "Lighting resolution: 1/" << lightingDownscale << "\n";
+	}
+
+	if (key == GLFW_KEY_R) {
+		dynamicResolution.enabled = !dynamicResolution.enabled;
+		std::cout << "Dynamic resolution: " << (dynamicResolution.enabled ? "on" : "off") << ", budget " << dynamicResolution.budgetMs << " ms\n";
+	}
+
+	if (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) {
+		dynamicResolution.budgetMs = glm::max(dynamicResolution.budgetMs + (key == GLFW_KEY_RIGHT_BRACKET ? 1.0 : -1.0), 1.0);
+		std::cout << "Dynamic resolution budget: " << dynamicResolution.budgetMs << " ms\n";
+	}
+
+	if (key == GLFW_KEY_T) {
+		temporalLightSlices = temporalLightSlices == 8 ? 1 : temporalLightSlices * 2;
+		std::cout << "Temporal lighting: 1/" << temporalLightSlices << " lights per frame" << (lightingDownscale > 1 ? " (full resolution lighting only)" : "") << "\n";
+	}
+
+	if (key == GLFW_KEY_K) {
+		lodSelection = !lodSelection;
+		std::cout << "LOD selection: " << (lodSelection ? "on" : "off") << ", " << lodErrorPixels << " px error\n";
+	}
+
+	if (key == GLFW_KEY_MINUS || key == GLFW_KEY_EQUAL) {
+		lodErrorPixels = glm::clamp(lodErrorPixels * (key == GLFW_KEY_EQUAL ? 2.0f : 0.5f), 0.125f, 64.0f);
+		std::cout << "LOD error threshold: " << lodErrorPixels << " px\n";
+	}
+
+	if (key == GLFW_KEY_M) {
+		meshletCulling = !meshletCulling;
+		std::cout << "Meshlet culling: " << (meshletCulling ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_V) {
+		vertexFormat = vertexFormat == VERTEX_FORMAT_QUANTISED ? VERTEX_FORMAT_FLOAT : VERTEX_FORMAT_QUANTISED;
+		uploadVertices(g_scene, g_meshLods, g_meshlets, vertexFormat);
+	}
+
+	if (key == GLFW_KEY_N) spawnBatch(mainCamera);
+	if (key == GLFW_KEY_B) despawnBatch();
+
+	if (key == GLFW_KEY_X) {
+		spinObjects = !spinObjects;
+		std::cout << "Spinning objects: " << (spinObjects ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_Q) writeGpuProfile("gpu_profile");
+
+	if (key == GLFW_KEY_I) {
+		framesInFlight = framesInFlight % MAX_FRAMES_IN_FLIGHT + 1;
+		std::cout << "Frames in flight: " << framesInFlight << "\n";
+	}
+
+	if (key == GLFW_KEY_J) {
+		std::ofstream trace("cpu_trace.json");
+		uint64_t zones = CpuProfiler::instance().writeChromeTrace(trace);
+		std::cout << "Wrote " << zones << " CPU profiler zones to cpu_trace.json (chrome://tracing)\n";
+	}
+
+	if (key == GLFW_KEY_U) {
+		glState::enabled = !glState::enabled;
+		glState::invalidate();
+		std::cout << "GL state cache: " << (glState::enabled ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_Z) {
+		renderQueueSorting = !renderQueueSorting;
+		std::cout << "Front to back sorting: " << (renderQueueSorting ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_O) {
+		occlusionCulling::enabled = !occlusionCulling::enabled;
+		std::cout << "Occlusion culling: " << (occlusionCulling::enabled ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_C) {
+		frustumCulling = !frustumCulling;
+		std::cout << "Frustum culling: " << (frustumCulling ? "on" : "off") << "\n";
+	}
+
+	if (key == GLFW_KEY_P) {
+		if (lightingDownscale > 1 || temporalLightSlices > 1) measureLightingPSNR = true;
+		else std::cout << "PSNR: lighting is already at full resolution with every light\n";
+	}
+}
+
+// ========================================
+// Frame packets
+
+// Input / simulation state handed to the render thread (--render-thread), which owns the GL context. Keys and clicks
+// are forwarded rather than handled on the input thread since they change render state and the object pool
+struct FramePacket {
+	uint64_t tick = 0;
+	double sampleTime = 0.0;	// glfwGetTime() after the events were polled
+	glm::vec3 cameraPosition {0.0f};
+	glm::vec3 cameraForward {0.0f, 0.0f, 1.0f};
+	std::vector<int> keys;
+	std::vector<glm::dvec2> clicks;		// Cursor positions
+};
+
+// Input is sampled and the camera moved at this rate in render thread mode
+constexpr const double SIMULATION_TICK_HZ = 120.0;
+
+namespace renderThread {
+	std::atomic<bool> running {false};
+	SpscQueue<FramePacket, 8> packets;
+	// Filled by the GLFW callbacks on the input thread until it is pushed
+	FramePacket pending;
+
+	// glfwSetWindowTitle is main thread only, the render thread leaves the stats here
+	std::mutex titleMutex;
+	std::string title;
+
+	std::atomic<uint64_t> simulationTicks {0};
+}
+
+// Sample time to glfwSwapBuffers returning, for frames drawn with new input
+namespace latencyStats {
+	RollingTimings inputToPresent;
+}
+
+// Casts a ray through the cursor against the BVH and reports the closest object
+void handlePick(double cursorX, double cursorY) {
+	glm::vec2 ndc = {cursorX / WIDTH * 2.0 - 1.0, 1.0 - cursorY / HEIGHT * 2.0};
+
+	glm::mat4 inverseViewProjection = glm::inverse(mainCamera.getViewProjectionMatrix());
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0, 1.0);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0, 1.0);
+	glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+	glm::vec3 direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+
+	auto start = std::chrono::steady_clock::now();
+	uint32_t object;
+	float distance;
+	bool hit = g_bvh.raycast(glm::value_ptr(origin), glm::value_ptr(direction), 1000.0f, object, distance);
+	double pickMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	if (hit) std::cout << "Picked object " << object << " (mesh " << g_objectPool.meshes[object] << ") at distance " << distance << " in " << pickMs << " ms\n";
+	else std::cout << "Picked nothing in " << pickMs << " ms\n";
+}
+
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+	if (action != GLFW_PRESS) return;
+	if (renderThread::running) renderThread::pending.keys.push_back(key);
+	else handleKey(key);
+}
+
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+	if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+
+	double cursorX, cursorY;
+	glfwGetCursorPos(window, &cursorX, &cursorY);
+	if (renderThread::running) renderThread::pending.clicks.push_back({cursorX, cursorY});
+	else handlePick(cursorX, cursorY);
+}
+
+// ========================================
+// Frame
+
+// Everything after input for one frame: stats, object updates, submission, drawing and presenting. sampleTime is when
+// the frame's input was sampled, negative when it has no new input
+void renderFrame(GLFWwindow* window, double deltaTime, double sampleTime) {
+	static double statsTime = 0.0;
+	static unsigned int statsFrames = 0;
+	double currentTime = glfwGetTime();
+
+	// Stats once a second, in the title and on stdout so modes can be compared live
+	statsFrames++;
+	if (currentTime - statsTime >= 1.0) {
+		TimingSummary gpuFrame = g_gpuProfiler.getStats(gpuPasses::frame);
+		std::ostringstream stats;
+		stats << std::fixed << std::setprecision(2)
+			<< (currentTime - statsTime) * 1000.0 / statsFrames << " ms"
+			<< " | GPU " << gpuFrame.averageMs << " ms (p95 " << gpuFrame.p95Ms << ")"
+			<< " | " << renderWidth << "x" << renderHeight << (dynamicResolution.enabled ? " (dynamic)" : "")
+			<< " | geometry " << g_gpuProfiler.getStats(gpuPasses::geometry).averageMs << " ms (" << vertexFormatName(vertexFormat) << ")"
+			<< " | lighting 1/" << lightingDownscale << (temporalLightSlices > 1 ? " temporal 1/" + std::to_string(temporalLightSlices) : "") << " " << g_gpuProfiler.getStats(gpuPasses::lighting).averageMs << " ms"
+			<< " | G-buffer " << (gBufferLayout == GBUFFER_LAYOUT_COMPACT ? "compact" : "full")
+			<< " | visible " << cullingStats::visible << "/" << cullingStats::submitted;
+		if (frustumCulling) stats << " (cull " << cullingStats::cullMs << " ms)";
+		TimingSummary latency = latencyStats::inputToPresent.summary();
+		stats << " | input to present " << latency.averageMs << " ms (p95 " << latency.p95Ms << ")";
+		if (renderThread::running) {
+			static uint64_t statsTicks = 0;
+			uint64_t ticks = renderThread::simulationTicks;
+			stats << " | render thread, simulation " << (ticks - statsTicks) / (currentTime - statsTime) << " Hz";
+			statsTicks = ticks;
+		}
+		stats << " | heap allocations " << allocationStats::lastFrame << "/frame, frame arena " << g_frameAllocator.blockBytes() / 1024 << " KB";
+		stats << " | GL calls " << glState::lastIssued << " issued, " << glState::lastElided << " elided" << (glState::enabled ? "" : " (cache off)");
+		stats << " | submission " << submissionStats::queues << " queues, merge " << submissionStats::mergeMs << " ms";
+		if (spinObjects) stats << " | transforms " << transformStats::updateMs << " ms";
+		stats << " | " << framesInFlight << " frames in flight, CPU blocked " << (frameStats::fenceWaitMs + frameStats::swapMs) / statsFrames << " ms (fence "
+			<< frameStats::fenceWaitMs / statsFrames << ", swap " << frameStats::swapMs / statsFrames << ")";
+		frameStats::fenceWaitMs = frameStats::swapMs = 0.0;
+		stats << " | overdraw " << g_geometrySamples.takeAverage() << " fragments/px";
+		if (renderQueueSorting) stats << " (front to back, sort " << renderQueueStats::sortMs << " ms " << renderQueueStats::passes << " passes)";
+		else stats << " (unsorted)";
+		if (!g_spawnedBatches.empty() || g_objectPool.fragmentation() > 0.0f)
+			stats << " | pool " << g_objectPool.liveCount() << "/" << g_objectPool.capacity() << " (" << g_objectPool.fragmentation() * 100.0f << "% holes, sync " << objectPoolStats::syncMs << " ms)";
+		stats << " | triangles " << lodStats::triangles / 1000 << "k/" << lodStats::fullDetailTriangles / 1000 << "k" << (lodSelection ? " (LOD)" : "");
+		if (meshletCulling && !g_meshlets.meshlets.empty())
+			stats << " | meshlets " << meshletStats::drawn << " drawn, " << meshletStats::frustumCulled << " frustum, " << meshletStats::backfaceCulled << " backface culled";
+		if (occlusionCulling::enabled && occlusionCulling::candidates) {
+			using namespace occlusionCulling;
+			stats << " | occluded " << 100.0 * (candidates - phase1Visible - phase2Visible) / candidates << "% (phase 1 " << phase1Visible << ", phase 2 +" << phase2Visible << ")";
+		}
+
+		std::cout << stats.str() << "\n";
+		if (renderThread::running) {
+			std::lock_guard<std::mutex> lock(renderThread::titleMutex);
+			renderThread::title = TITLE + " | " + stats.str();
+		}
+		else glfwSetWindowTitle(window, (TITLE + " | " + stats.str()).c_str());
+		statsTime = currentTime;
+		statsFrames = 0;
+	}
+
+	uint64_t frameAllocations = allocationCount();
+	g_frameAllocator.reset();
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	beginFrameResources();
+	syncObjectPool();
+	updateObjectTransforms((float)deltaTime);
+
+	// ========================================
+	// Draw
+
+	// obj1.draw();
+	// obj2.draw();
+	// Submitted from worker threads, drawDispatched() merges their queues
+	{
+		CPU_PROFILE_ZONE("submit");
+		parallelFor(g_sceneObjects.size(), 1 << 15, [](size_t begin, size_t end) {
+			CPU_PROFILE_ZONE("submit objects");
+			for (size_t i=begin; i<end; i++) g_sceneObjects[i].draw();
+		});
+		for (auto& batch : g_spawnedBatches) for (auto& object : batch) object.draw();
+	}
+	drawDispatched();
+
+	// ========================================
+
+	{
+		CPU_PROFILE_ZONE("glfwSwapBuffers");
+		auto swapStart = std::chrono::steady_clock::now();
+		glfwSwapBuffers(window);
+		glState::endFrame();
+		frameStats::swapMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - swapStart).count();
+	}
+	allocationStats::lastFrame = allocationCount() - frameAllocations;
+	if (!startupStats::firstFramePresented) {
+		startupStats::firstFramePresented = true;
+		std::cout << "First frame presented " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupStats::start).count()
+			<< " ms after startup (" << g_objectPool.liveCount() << " objects)\n";
+	}
+	if (sampleTime >= 0.0) latencyStats::inputToPresent.add((glfwGetTime() - sampleTime) * 1000.0);
+}
+
+// ========================================
+// Render thread
+
+// Owns the GL context: drains the packets sent since the last frame (their keys and clicks in order, the newest
+// camera) and draws, at whatever rate the GPU allows
+void renderThreadMain(GLFWwindow* window) {
+	glfwMakeContextCurrent(window);
+
+	FramePacket packet;
+	double previousTime = glfwGetTime();
+	while (renderThread::running.load(std::memory_order_acquire)) {
+		double sampleTime = -1.0;
+		while (renderThread::packets.tryPop(packet)) {
+			mainCamera.setPosition(packet.cameraPosition);
+			mainCamera.setForward(packet.cameraForward);
+			for (auto key : packet.keys) handleKey(key);
+			for (auto click : packet.clicks) handlePick(click.x, click.y);
+			sampleTime = packet.sampleTime;
+		}
+
+		double currentTime = glfwGetTime();
+		renderFrame(window, currentTime - previousTime, sampleTime);
+		previousTime = currentTime;
+	}
+
+	glfwMakeContextCurrent(NULL);
+}
+
+// Input and camera at a fixed tick on the main thread (GLFW events must be polled there) while the render thread draws
+void runWithRenderThread(GLFWwindow* window) {
+	Camera simulationCamera = mainCamera;
+
+	glfwMakeContextCurrent(NULL);
+	renderThread::running = true;
+	std::thread renderer(renderThreadMain, window);
+
+	const double tick = 1.0 / SIMULATION_TICK_HZ;
+	auto nextTick = std::chrono::steady_clock::now();
+	while (!glfwWindowShouldClose(window)) {
+		{
+			CPU_PROFILE_ZONE("glfwPollEvents");
+			glfwPollEvents();
+		}
+		double pollTime = glfwGetTime();
+		{
+			CPU_PROFILE_ZONE("cameraController");
+			cameraController(simulationCamera, window, tick);
+		}
+
+		auto& pending = renderThread::pending;
+		pending.tick = ++renderThread::simulationTicks;
+		pending.sampleTime = pollTime;
+		pending.cameraPosition = simulationCamera.getPosition();
+		pending.cameraForward = simulationCamera.getForward();
+		// A full queue keeps this tick's keys and clicks for the next one
+		if (renderThread::packets.tryPush(std::move(pending))) pending = FramePacket();
+
+		{
+			std::lock_guard<std::mutex> lock(renderThread::titleMutex);
+			if (!renderThread::title.empty()) glfwSetWindowTitle(window, renderThread::title.c_str());
+			renderThread::title.clear();
+		}
+
+		// Ticks missed by more than a quarter second are dropped rather than caught up
+		nextTick += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(tick));
+		auto now = std::chrono::steady_clock::now();
+		if (now - nextTick > std::chrono::milliseconds(250)) nextTick = now;
+		std::this_thread::sleep_until(nextTick);
+	}
+
+	renderThread::running = false;
+	renderer.join();
+	glfwMakeContextCurrent(window);
+}
+
 // ========================================
 // Main
 
-int main() {
+int main(int argc, char** argv) {
+	startupStats::start = std::chrono::steady_clock::now();
+
+	// --render-thread: GL on its own thread, fed frame packets by the input / simulation thread
+	// --grid N: N*N*N objects in the generated grid instead of 50*50*50
+	bool useRenderThread = false;
+	unsigned int gridSide = 50;
+	std::vector<char*> arguments;
+	for (int i=0; i<argc; i++) {
+		if (std::string(argv[i]) == "--render-thread") useRenderThread = true;
+		else if (std::string(argv[i]) == "--grid" && i + 1 < argc) {
+			std::string_view value = argv[++i];
+			auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), gridSide);
+			// Object indices are 32 bit, 1625^3 is the largest cube that fits
+			if (error != std::errc() || end != value.data() + value.size() || gridSide < 1 || gridSide > 1625) {
+				std::cout << "--grid takes a side length from 1 to 1625, got \"" << value << "\"\n"
+					<< "Usage: OpenGL4Testing [--render-thread] [--grid N] [scene.mdis | mesh.obj | mesh.glb]\n";
+				return 1;
+			}
+		}
+		else arguments.push_back(argv[i]);
+	}
+	argc = (int)arguments.size();
+	argv = arguments.data();
+
 	glfwInit();
 
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	// Must match the GBuffer depth/stencil format so it can be blitted across
+	glfwWindowHint(GLFW_DEPTH_BITS, 24);
+	glfwWindowHint(GLFW_STENCIL_BITS, 8);
 
     auto window = glfwCreateWindow(WIDTH, HEIGHT, TITLE.c_str(), NULL, NULL);
 
@@ -603,115 +2468,70 @@ int main() {
 	glfwSwapInterval(0);
 
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	glState::invalidate();
+	glResources::contextAlive = true;
 
 	// shaderGBuffer = Shader(loadShaderSource("../../resources/shaders/gBuffer.vs"), loadShaderSource("../../resources/shaders/gBuffer.fs"));
 	// shaderDeferred = Shader(loadShaderSource("../../resources/shaders/deferred.vs"), loadShaderSource("../../resources/shaders/deferred.fs"));
 
-	shaderGBuffer = Shader(loadShaderSource("D:/Programming/C++/code/OpenGL4Testing/resources/shaders/gBuffer.vs"), loadShaderSource("D:/Programming/C++/code/OpenGL4Testing/resources/shaders/gBuffer.fs"));
-	shaderDeferred = Shader(loadShaderSource("D:/Programming/C++/code/OpenGL4Testing/resources/shaders/deferred.vs"), loadShaderSource("D:/Programming/C++/code/OpenGL4Testing/resources/shaders/deferred.fs"));
+	std::string shaderDirectory = "D:/Programming/C++/code/OpenGL4Testing/resources/shaders/";
+	shadersFull = loadGBufferShaders(shaderDirectory, {});
+	shadersCompact = loadGBufferShaders(shaderDirectory, {"COMPACT_GBUFFER"});
+
+	glfwSetKeyCallback(window, keyCallback);
+	glfwSetMouseButtonCallback(window, mouseButtonCallback);
 
 
 	// ========================================
 	// Setup
 
-	std::vector<float> tri {
-		// Front
-		-0.5f, -0.5f, -0.5f,	0.0f, 0.5f, -1.0f,
-		0.0f, 0.5f, 0.0f,		0.0f, 0.5f, -1.0f,
-		0.5f, -0.5f, -0.5f,		0.0f, 0.5f, -1.0f,
-
-		// Back
-		-0.5f, -0.5f, 0.5f,		0.0f, -0.5f, 1.0f,
-		0.5f, -0.5f, 0.5f,		0.0f, -0.5f, 1.0f,
-		0.0f, 0.5f, 0.0f,		0.0f, -0.5f, 1.0f,
-
-		// Right
-		-0.5f, -0.5f, -0.5f,	-1.0f, 0.5f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		-1.0f, 0.5f, 0.0f,
-		0.0f, 0.5f, 0.0f,		-1.0f, 0.5f, 0.0f,
-
-		// Left
-		0.5f, -0.5f, -0.5f,		1.0f, -0.5f, 0.0f,
-		0.0f, 0.5f, 0.0f,		1.0f, -0.5f, 0.0f,
-		0.5f, -0.5f, 0.5f,		1.0f, -0.5f, 0.0f,
-
-		// Bottom
-		-0.5f, -0.5f, -0.5f,	0.0f, -1.0f, 0.0f,
-		0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
-
-		0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
-		0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f
-	};
-
-	std::vector<float> quad {
-		// Front
-		-0.5f, -0.5f, -0.5f,	0.0f, 0.0f, -1.0f,
-		-0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
-		0.5f, -0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
-
-		-0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
-		0.5f, 0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
-		0.5f, -0.5f, -0.5f,		0.0f, 0.0f, -1.0f,
-
-		// Back
-		-0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-		0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-		-0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-
-		-0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-		0.5f, -0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-		0.5f, 0.5f, 0.5f,		0.0f, 0.0f, 1.0f,
-
-		// Right
-		-0.5f, -0.5f, -0.5f,	-1.0f, 0.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
-		-0.5f, 0.5f, -0.5f,		-1.0f, 0.0f, 0.0f,
-
-		-0.5f, 0.5f, -0.5f,		-1.0f, 0.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
-		-0.5f, 0.5f, 0.5f,		-1.0f, 0.0f, 0.0f,
-
-		// Left
-		0.5f, -0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
-		0.5f, 0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
-		0.5f, -0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
-
-		0.5f, 0.5f, -0.5f,		1.0f, 0.0f, 0.0f,
-		0.5f, 0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
-		0.5f, -0.5f, 0.5f,		1.0f, 0.0f, 0.0f,
-
-		// Top
-		-0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
-		-0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
-		0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
-
-		0.5f, 0.5f, -0.5f,		0.0f, 1.0f, 0.0f,
-		-0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
-		0.5f, 0.5f, 0.5f,		0.0f, 1.0f, 0.0f,
-
-		// Bottom
-		-0.5f, -0.5f, -0.5f,	0.0f, -1.0f, 0.0f,
-		0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
-
-		0.5f, -0.5f, -0.5f,		0.0f, -1.0f, 0.0f,
-		0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f,
-		-0.5f, -0.5f, 0.5f,		0.0f, -1.0f, 0.0f
-	};
-
-	std::vector<Object*> objects = {};
-	unsigned int x, y, z;
-	float spread = 2.0;
-	// float spread = 3.0;
-	x = 50; y = 50; z = 50;
-	for (int i=0; i<x; i++)
-		for (int j=0; j<y; j++)
-			for (int k=0; k<z; k++) {
-				auto color = glm::vec3(i%2 == 0, j%2 == 0, k%2 == 0)*glm::vec3(0.7, 0.7, 0.7) + glm::vec3(0.3, 0.3, 0.3);
-				objects.push_back(new Object(i%2 == 0 ? tri : quad, {{i*spread, j*spread, k*spread + 10.0}, color}));
+	// Usage: OpenGL4Testing [--render-thread] [--grid N] [scene.mdis], without a scene file the default 50x50x50 grid is generated
+	auto loadStart = std::chrono::steady_clock::now();
+
+	MappedScene mappedScene;
+	SceneData generatedScene;
+	SceneView scene;
+	std::string sceneArgument = argc > 1 ? argv[1] : "";
+	std::string sceneExtension = sceneArgument.substr(sceneArgument.find_last_of('.') + 1);
+	if (sceneExtension == "obj" || sceneExtension == "glb") {
+		// Imported meshes replace the pyramids and cubes of the default grid
+		std::vector<std::vector<float>> meshes;
+		MeshImportStats importStats;
+		auto importStart = std::chrono::steady_clock::now();
+		for (int i=1; i<argc; i++) {
+			meshes.emplace_back();
+			auto error = importMesh(argv[i], meshes.back(), &importStats);
+			if (!error.empty()) {
+				std::cout << "Failed to import mesh " << error << "\n";
+				glfwTerminate();
+				return 1;
 			}
+			fitMeshToUnitCube(meshes.back());
+		}
+		double importSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - importStart).count();
+		std::cout << "Imported " << importStats.triangles << " triangles from " << importStats.bytes << " bytes in " << importSeconds * 1000.0 << " ms ("
+			<< importStats.bytes / importSeconds / (1024.0 * 1024.0) << " MB/s, " << importStats.triangles / importSeconds / 1e6 << " M triangles/s)\n";
+
+		generatedScene = generateGridScene(gridSide, gridSide, gridSide, 200, std::random_device{}(), 2.0f, meshes);
+		scene = generatedScene.view();
+	}
+	else if (argc > 1) {
+		auto error = mappedScene.open(argv[1]);
+		if (!error.empty()) {
+			std::cout << "Failed to load scene " << argv[1] << ": " << error << "\n";
+			glfwTerminate();
+			return 1;
+		}
+		scene = mappedScene.view();
+	}
+	else {
+		generatedScene = generateGridScene(gridSide, gridSide, gridSide, 200, std::random_device{}());
+		scene = generatedScene.view();
+	}
+
+	// Handle i is scene object i, see ObjectPool::init()
+	g_sceneObjects.reserve(scene.objectCount);
+	for (unsigned int i=0; i<scene.objectCount; i++) g_sceneObjects.emplace_back(ObjectHandle {i, 0});
 
 	// Object obj1(tri, {glm::vec3(-0.5, 0.0, 5.0), glm::vec3(1.0, 0.0, 0.0)});
 	// Object obj2(quad, {glm::vec3(0.5, 0.0, 5.0), glm::vec3(0.0, 1.0, 0.0)});
@@ -719,50 +2539,58 @@ int main() {
 	// ========================================
 
 	setupDrawObjects();
+	setupOcclusionCulling(shaderDirectory);
+	auto lodStart = std::chrono::steady_clock::now();
+	g_meshLods = buildMeshLods(scene);
+	std::cout << "Built " << g_meshLods.lods.size() << " LOD levels for " << scene.meshCount << " meshes in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lodStart).count() << " ms\n";
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glClearColor(0.0, 0.0, 0.0, 1.0);
-
-	double deltaTime = 0.0;
-	double prevTime = 0.0;
+	auto meshletStart = std::chrono::steady_clock::now();
+	g_meshlets = buildMeshlets(scene, scene.vertexCount + g_meshLods.vertices.size() / SCENE_FLOATS_PER_VERTEX);
+	std::cout << "Built " << g_meshlets.meshlets.size() << " meshlets in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - meshletStart).count() << " ms\n";
 
-	while (!glfwWindowShouldClose(window)) {
-		auto currentTime = glfwGetTime();
-		deltaTime = currentTime - prevTime;
-		prevTime = currentTime;
-
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	uploadScene(scene, g_meshLods, g_meshlets);
+	g_objectPool.init(scene, 1, 2.0f);
+	uploadObjectTables();
+	glFinish();
 
-		cameraController(mainCamera, window, deltaTime);
+	auto bvhStart = std::chrono::steady_clock::now();
+	g_bvh.build(g_objectPool.bounds);
+	std::cout << "Built BVH (" << g_bvh.nodeCount() << " nodes) in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvhStart).count() << " ms\n";
 
-		// ========================================
-		// Draw
+	std::cout << "Loaded " << scene.objectCount << " objects, " << scene.meshCount << " meshes, " << scene.lightCount << " lights in "
+		<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count() << " ms\n";
 
-		// obj1.draw();
-		// obj2.draw();
-		for (auto object : objects) object->draw();
-		drawDispatched();
+	g_geometrySamples.init();
 
-		// ========================================
+	glState::enable(GL_DEPTH_TEST);
+	glState::enable(GL_CULL_FACE);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+	if (useRenderThread) runWithRenderThread(window);
+	else {
+		double prevTime = glfwGetTime();
+		// Key state is sampled when events are polled, at the end of the previous frame
+		double pollTime = prevTime;
+		while (!glfwWindowShouldClose(window)) {
+			double currentTime = glfwGetTime();
+			double deltaTime = currentTime - prevTime;
+			prevTime = currentTime;
+
+			{
+				CPU_PROFILE_ZONE("cameraController");
+				cameraController(mainCamera, window, deltaTime);
+			}
+			renderFrame(window, deltaTime, pollTime);
+			{
+				CPU_PROFILE_ZONE("glfwPollEvents");
+				glfwPollEvents();
+			}
+			pollTime = glfwGetTime();
+		}
 	}
 
-	// ========================================
-	// Cleanup
-
-	for (auto object : objects) delete object;
-
-	unsigned int buffers[] = {drawObjectBuffers::VertexBuffer, drawObjectBuffers::UniformsBuffer, drawObjectBuffers::IndirectDrawBuffer, drawObjectBuffers::LightsUBO};
-	glDeleteBuffers(4, buffers);
-	unsigned int vertexArrays[] = {drawObjectBuffers::VAO, drawObjectBuffers::ScreenQuadVAO};
-	glDeleteVertexArrays(2, vertexArrays);
-	glDeleteFramebuffers(1, &drawObjectBuffers::GBuffer);
-	glDeleteRenderbuffers(1, &drawObjectBuffers::GBufferRBO);
-
-	// ========================================
+	// GL objects go with the context at exit
+	glResources::contextAlive = false;
 
 	return 0;
 }
\ No newline at end of file
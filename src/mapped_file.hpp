@@ -0,0 +1,101 @@
+#pragma once
+
+// Read-only memory mapped file (mmap, or a file mapping on Windows)
+
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class MappedFile {
+	const unsigned char* mappedData = nullptr;
+	uint64_t mappedSize = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int file = -1;
+#endif
+
+	std::string fail(std::string error) {
+		close();
+		return error;
+	}
+
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		close();
+	}
+
+	// Returns an error message or "" on success, the mapping is read front to back by every user so it is hinted as sequential
+	std::string open(const std::string& path) {
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return "couldn't open " + path;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize)) return fail("couldn't stat " + path);
+		mappedSize = (uint64_t)fileSize.QuadPart;
+		if (mappedSize == 0) return fail("empty file " + path);
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping) return fail("couldn't map " + path);
+		mappedData = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!mappedData) return fail("couldn't map " + path);
+#else
+		file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0) return "couldn't open " + path;
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0) return fail("couldn't stat " + path);
+		mappedSize = (uint64_t)fileStat.st_size;
+		if (mappedSize == 0) return fail("empty file " + path);
+		void* mapped = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapped == MAP_FAILED) return fail("couldn't map " + path);
+		mappedData = (const unsigned char*)mapped;
+		madvise(mapped, mappedSize, MADV_SEQUENTIAL);
+		madvise(mapped, mappedSize, MADV_WILLNEED);
+#endif
+		return "";
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (mappedData) UnmapViewOfFile(mappedData);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (mappedData) munmap((void*)mappedData, mappedSize);
+		if (file >= 0) ::close(file);
+		file = -1;
+#endif
+		mappedData = nullptr;
+		mappedSize = 0;
+	}
+
+	const unsigned char* data() const {
+		return mappedData;
+	}
+
+	uint64_t size() const {
+		return mappedSize;
+	}
+};
@@ -0,0 +1,554 @@
+#pragma once
+
+// OBJ and glTF 2.0 binary (.glb) importers
+//
+// Meshes are written straight into the scene vertex format (SCENE_FLOATS_PER_VERTEX floats: position, normal) as
+// non-indexed triangles, ready for glDrawArrays. Files are memory mapped and tokenized in place: the only allocations
+// are the output vertices and per-file index tables, no per-token strings. Normals are generated (smooth, area
+// weighted) wherever a face or primitive doesn't provide them.
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "scene_format.hpp"
+
+struct MeshImportStats {
+	uint64_t bytes = 0;
+	uint64_t triangles = 0;
+	uint64_t generatedNormals = 0;	// Output vertices whose normal was generated
+};
+
+namespace meshImport {
+	struct Vec3 {
+		float x, y, z;
+	};
+
+	inline Vec3 sub(Vec3 a, Vec3 b) {
+		return {a.x - b.x, a.y - b.y, a.z - b.z};
+	}
+
+	inline Vec3 cross(Vec3 a, Vec3 b) {
+		return {a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x};
+	}
+
+	inline Vec3 normalizeOrUp(Vec3 v) {
+		float length = std::sqrt(v.x*v.x + v.y*v.y + v.z*v.z);
+		if (length < 1e-20f) return {0.0f, 1.0f, 0.0f};
+		return {v.x / length, v.y / length, v.z / length};
+	}
+
+	inline void emitVertex(std::vector<float>& vertices, Vec3 position, Vec3 normal) {
+		vertices.insert(vertices.end(), {position.x, position.y, position.z, normal.x, normal.y, normal.z});
+	}
+
+	// Area weighted smooth normals for the triangles (a, b, c index triples) flagged as needing them
+	inline std::vector<Vec3> generateNormals(const std::vector<Vec3>& positions, const std::vector<uint32_t>& triangleIndices, const std::vector<bool>& needsNormal) {
+		std::vector<Vec3> normals(positions.size(), {0.0f, 0.0f, 0.0f});
+		for (size_t t=0; t<triangleIndices.size()/3; t++) {
+			if (!needsNormal[t]) continue;
+			auto a = triangleIndices[t*3], b = triangleIndices[t*3 + 1], c = triangleIndices[t*3 + 2];
+			auto faceNormal = cross(sub(positions[b], positions[a]), sub(positions[c], positions[a]));
+			for (auto index : {a, b, c}) {
+				normals[index].x += faceNormal.x;
+				normals[index].y += faceNormal.y;
+				normals[index].z += faceNormal.z;
+			}
+		}
+		for (auto& normal : normals) normal = normalizeOrUp(normal);
+		return normals;
+	}
+
+	// ========================================
+	// OBJ tokenizer
+
+	inline void skipSpaces(const char*& p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	}
+
+	inline void skipLine(const char*& p, const char* end) {
+		while (p < end && *p != '\n') p++;
+		if (p < end) p++;
+	}
+
+	inline bool atLineEnd(const char* p, const char* end) {
+		return p >= end || *p == '\n' || *p == '#';
+	}
+
+	inline bool parseFloat(const char*& p, const char* end, float& out) {
+		skipSpaces(p, end);
+		if (p < end && *p == '+') p++;
+		auto result = std::from_chars(p, end, out);
+		if (result.ec != std::errc()) return false;
+		p = result.ptr;
+		return true;
+	}
+
+	inline bool parseInt(const char*& p, const char* end, long long& out) {
+		auto result = std::from_chars(p, end, out);
+		if (result.ec != std::errc()) return false;
+		p = result.ptr;
+		return true;
+	}
+
+	// OBJ indices are 1 based, negative indices count back from the most recent element
+	inline bool resolveIndex(long long index, size_t count, uint32_t& out) {
+		long long resolved = index < 0 ? (long long)count + index : index - 1;
+		if (resolved < 0 || resolved >= (long long)count) return false;
+		out = (uint32_t)resolved;
+		return true;
+	}
+
+	constexpr const uint32_t NO_NORMAL = UINT32_MAX;
+
+	inline std::string importObj(const char* data, uint64_t size, std::vector<float>& vertices, MeshImportStats& stats) {
+		const char* p = data;
+		const char* end = data + size;
+
+		std::vector<Vec3> positions;
+		std::vector<Vec3> normals;
+		// Triangulated corners, positions and normals indexed separately as in the file
+		std::vector<uint32_t> cornerPositions;
+		std::vector<uint32_t> cornerNormals;
+		uint64_t line = 1;
+
+		auto lineError = [&](const char* message) {
+			return "line " + std::to_string(line) + ": " + message;
+		};
+
+		while (p < end) {
+			skipSpaces(p, end);
+			if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+				p += 2;
+				Vec3 v;
+				if (!parseFloat(p, end, v.x) || !parseFloat(p, end, v.y) || !parseFloat(p, end, v.z)) return lineError("malformed vertex");
+				positions.push_back(v);
+			}
+			else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+				p += 3;
+				Vec3 n;
+				if (!parseFloat(p, end, n.x) || !parseFloat(p, end, n.y) || !parseFloat(p, end, n.z)) return lineError("malformed normal");
+				normals.push_back(normalizeOrUp(n));
+			}
+			else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+				p += 2;
+				// Polygons are fan triangulated around the first corner
+				uint32_t firstPosition = 0, firstNormal = 0, previousPosition = 0, previousNormal = 0;
+				int corners = 0;
+				while (true) {
+					skipSpaces(p, end);
+					if (atLineEnd(p, end)) break;
+
+					long long index;
+					uint32_t position, normal = NO_NORMAL;
+					if (!parseInt(p, end, index) || !resolveIndex(index, positions.size(), position)) return lineError("bad face position index");
+					if (p < end && *p == '/') {
+						p++;
+						// Texture coordinates aren't part of the vertex format
+						if (p < end && *p != '/') {
+							long long ignored;
+							if (!parseInt(p, end, ignored)) return lineError("bad face texture index");
+						}
+						if (p < end && *p == '/') {
+							p++;
+							if (!parseInt(p, end, index) || !resolveIndex(index, normals.size(), normal)) return lineError("bad face normal index");
+						}
+					}
+
+					if (corners == 0) {
+						firstPosition = position;
+						firstNormal = normal;
+					}
+					else if (corners >= 2) {
+						cornerPositions.insert(cornerPositions.end(), {firstPosition, previousPosition, position});
+						cornerNormals.insert(cornerNormals.end(), {firstNormal, previousNormal, normal});
+					}
+					previousPosition = position;
+					previousNormal = normal;
+					corners++;
+				}
+				if (corners < 3) return lineError("face with fewer than 3 corners");
+			}
+			skipLine(p, end);
+			line++;
+		}
+
+		// Smooth normals over shared positions for any triangle missing a normal
+		size_t triangleCount = cornerPositions.size() / 3;
+		std::vector<bool> needsNormal(triangleCount);
+		bool anyMissing = false;
+		for (size_t t=0; t<triangleCount; t++) {
+			needsNormal[t] = cornerNormals[t*3] == NO_NORMAL || cornerNormals[t*3 + 1] == NO_NORMAL || cornerNormals[t*3 + 2] == NO_NORMAL;
+			anyMissing = anyMissing || needsNormal[t];
+		}
+		std::vector<Vec3> generated;
+		if (anyMissing) generated = generateNormals(positions, cornerPositions, needsNormal);
+
+		vertices.reserve(vertices.size() + cornerPositions.size() * SCENE_FLOATS_PER_VERTEX);
+		for (size_t i=0; i<cornerPositions.size(); i++) {
+			bool generate = needsNormal[i / 3];
+			emitVertex(vertices, positions[cornerPositions[i]], generate ? generated[cornerPositions[i]] : normals[cornerNormals[i]]);
+			if (generate) stats.generatedNormals++;
+		}
+
+		stats.bytes += size;
+		stats.triangles += triangleCount;
+		return "";
+	}
+
+	// ========================================
+	// Minimal JSON reader for the glTF JSON chunk, strings are views into the chunk (escapes aren't decoded, glTF keys
+	// we read never need them)
+
+	struct JsonValue {
+		enum Type {NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT};
+
+		Type type = NUL;
+		double number = 0.0;
+		std::string_view string;
+		std::vector<std::pair<std::string_view, JsonValue>> members;
+		std::vector<JsonValue> elements;
+
+		const JsonValue* get(std::string_view key) const {
+			for (auto& member : members) if (member.first == key) return &member.second;
+			return nullptr;
+		}
+
+		const JsonValue* at(size_t index) const {
+			return type == ARRAY && index < elements.size() ? &elements[index] : nullptr;
+		}
+
+		double numberOr(std::string_view key, double fallback) const {
+			auto value = get(key);
+			return value && value->type == NUMBER ? value->number : fallback;
+		}
+
+		// Counts, offsets and indices, false if the number is non-finite, negative, fractional or too big for uint64
+		bool unsignedOr(std::string_view key, uint64_t fallback, uint64_t& out) const {
+			auto value = get(key);
+			if (!value || value->type != NUMBER) {
+				out = fallback;
+				return true;
+			}
+			return value->asUnsigned(out);
+		}
+
+		bool asUnsigned(uint64_t& out) const {
+			if (type != NUMBER || !std::isfinite(number) || number < 0.0 || number != std::floor(number) || number >= 18446744073709551616.0) return false;
+			out = (uint64_t)number;
+			return true;
+		}
+	};
+
+	class JsonParser {
+		const char* p;
+		const char* end;
+		int depth = 0;
+
+		void skipWhitespace() {
+			while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+		}
+
+		bool literal(const char* text) {
+			auto length = std::char_traits<char>::length(text);
+			if ((size_t)(end - p) < length || std::string_view(p, length) != text) return false;
+			p += length;
+			return true;
+		}
+
+		bool parseString(std::string_view& out) {
+			if (p >= end || *p != '"') return false;
+			const char* start = ++p;
+			while (p < end && *p != '"') {
+				if (*p == '\\') p++;
+				p++;
+			}
+			if (p >= end) return false;
+			out = std::string_view(start, p - start);
+			p++;
+			return true;
+		}
+
+	public:
+		JsonParser(const char* data, size_t size): p(data), end(data + size) {}
+
+		bool parse(JsonValue& out) {
+			if (++depth > 64) return false;
+			skipWhitespace();
+			if (p >= end) return false;
+
+			bool ok = true;
+			if (*p == '{') {
+				out.type = JsonValue::OBJECT;
+				p++;
+				skipWhitespace();
+				if (p < end && *p == '}') p++;
+				else while (ok) {
+					skipWhitespace();
+					std::string_view key;
+					if (!parseString(key)) return false;
+					skipWhitespace();
+					if (p >= end || *p++ != ':') return false;
+					out.members.emplace_back(key, JsonValue());
+					if (!parse(out.members.back().second)) return false;
+					skipWhitespace();
+					if (p < end && *p == ',') p++;
+					else if (p < end && *p == '}') { p++; break; }
+					else ok = false;
+				}
+			}
+			else if (*p == '[') {
+				out.type = JsonValue::ARRAY;
+				p++;
+				skipWhitespace();
+				if (p < end && *p == ']') p++;
+				else while (ok) {
+					out.elements.emplace_back();
+					if (!parse(out.elements.back())) return false;
+					skipWhitespace();
+					if (p < end && *p == ',') p++;
+					else if (p < end && *p == ']') { p++; break; }
+					else ok = false;
+				}
+			}
+			else if (*p == '"') {
+				out.type = JsonValue::STRING;
+				ok = parseString(out.string);
+			}
+			else if (literal("true") || literal("false")) {
+				out.type = JsonValue::BOOLEAN;
+				out.number = p[-1] == 'e' && p[-2] == 'u';
+			}
+			else if (literal("null")) {
+				out.type = JsonValue::NUL;
+			}
+			else {
+				out.type = JsonValue::NUMBER;
+				if (p < end && *p == '+') p++;
+				auto result = std::from_chars(p, end, out.number);
+				ok = result.ec == std::errc();
+				p = result.ptr;
+			}
+			depth--;
+			return ok;
+		}
+	};
+
+	// ========================================
+	// glTF binary
+
+	constexpr const uint32_t GLB_MAGIC = 0x46546C67;	// "glTF"
+	constexpr const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+	constexpr const uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+	constexpr const int GLTF_UNSIGNED_BYTE = 5121;
+	constexpr const int GLTF_UNSIGNED_SHORT = 5123;
+	constexpr const int GLTF_UNSIGNED_INT = 5125;
+	constexpr const int GLTF_FLOAT = 5126;
+	constexpr const int GLTF_TRIANGLES = 4;
+
+	inline uint32_t readU32(const unsigned char* p) {
+		return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+	}
+
+	// Strided view of one accessor inside the BIN chunk
+	struct GltfAccessor {
+		const unsigned char* data = nullptr;
+		uint64_t count = 0;
+		uint64_t stride = 0;
+		int componentType = 0;
+		int components = 0;
+	};
+
+	inline int gltfComponentSize(int componentType) {
+		switch (componentType) {
+			case GLTF_UNSIGNED_BYTE: return 1;
+			case GLTF_UNSIGNED_SHORT: return 2;
+			case GLTF_UNSIGNED_INT: return 4;
+			case GLTF_FLOAT: return 4;
+			default: return 0;
+		}
+	}
+
+	inline std::string resolveAccessor(const JsonValue& root, const JsonValue* indexValue, const unsigned char* bin, uint64_t binSize, GltfAccessor& out) {
+		uint64_t accessorIndex = 0, viewIndex = 0;
+		if (!indexValue || indexValue->type != JsonValue::NUMBER) return "missing accessor index";
+		if (!indexValue->asUnsigned(accessorIndex)) return "invalid accessor index";
+		auto accessors = root.get("accessors");
+		auto accessor = accessors && accessorIndex < accessors->elements.size() ? accessors->at((size_t)accessorIndex) : nullptr;
+		if (!accessor) return "accessor out of range";
+		if (accessor->get("sparse")) return "sparse accessors aren't supported";
+
+		auto bufferViews = root.get("bufferViews");
+		auto viewValue = accessor->get("bufferView");
+		if (viewValue && !viewValue->asUnsigned(viewIndex)) return "invalid buffer view index";
+		auto view = bufferViews && viewValue && viewIndex < bufferViews->elements.size() ? bufferViews->at((size_t)viewIndex) : nullptr;
+		if (!view) return "accessor without a buffer view";
+		if (view->numberOr("buffer", 0) != 0) return "only the GLB binary buffer is supported";
+
+		auto type = accessor->get("type");
+		out.components = !type ? 0 : type->string == "SCALAR" ? 1 : type->string == "VEC2" ? 2 : type->string == "VEC3" ? 3 : type->string == "VEC4" ? 4 : 0;
+		out.componentType = (int)accessor->numberOr("componentType", 0);
+		int componentSize = gltfComponentSize(out.componentType);
+		if (!out.components || !componentSize) return "unsupported accessor type";
+
+		uint64_t viewOffset = 0, viewLength = 0, accessorOffset = 0;
+		if (!accessor->unsignedOr("count", 0, out.count) || !accessor->unsignedOr("byteOffset", 0, accessorOffset) ||
+			!view->unsignedOr("byteOffset", 0, viewOffset) || !view->unsignedOr("byteLength", 0, viewLength) ||
+			!view->unsignedOr("byteStride", 0, out.stride))
+			return "invalid accessor or buffer view number";
+		uint64_t elementSize = (uint64_t)componentSize * out.components;
+		if (out.stride == 0) out.stride = elementSize;
+
+		if (viewOffset > binSize || viewLength > binSize - viewOffset) return "buffer view outside the binary chunk";
+		// Divided rather than multiplied out so a huge count or stride can't wrap stride * (count - 1)
+		if (out.count && (accessorOffset > viewLength || elementSize > viewLength - accessorOffset ||
+			out.count - 1 > (viewLength - accessorOffset - elementSize) / out.stride))
+			return "accessor outside its buffer view";
+		out.data = bin + viewOffset + accessorOffset;
+		return "";
+	}
+
+	inline Vec3 readVec3(const GltfAccessor& accessor, uint64_t i) {
+		Vec3 v;
+		std::memcpy(&v, accessor.data + accessor.stride * i, sizeof(v));
+		return v;
+	}
+
+	inline uint32_t readIndex(const GltfAccessor& accessor, uint64_t i) {
+		auto p = accessor.data + accessor.stride * i;
+		switch (accessor.componentType) {
+			case GLTF_UNSIGNED_BYTE: return *p;
+			case GLTF_UNSIGNED_SHORT: return (uint32_t)p[0] | (uint32_t)p[1] << 8;
+			default: return readU32(p);
+		}
+	}
+
+	// Every triangle primitive of every mesh is appended in mesh local space, node transforms aren't applied
+	inline std::string importGlb(const unsigned char* data, uint64_t size, std::vector<float>& vertices, MeshImportStats& stats) {
+		if (size < 20 || readU32(data) != GLB_MAGIC) return "not a binary glTF file";
+		if (readU32(data + 4) != 2) return "only glTF 2.0 is supported";
+		uint64_t length = std::min<uint64_t>(readU32(data + 8), size);
+
+		const unsigned char* json = nullptr;
+		const unsigned char* bin = nullptr;
+		uint64_t jsonSize = 0, binSize = 0;
+		for (uint64_t offset = 12; offset + 8 <= length;) {
+			uint64_t chunkLength = readU32(data + offset);
+			uint32_t chunkType = readU32(data + offset + 4);
+			if (chunkLength > length - offset - 8) return "chunk outside the file";
+			if (chunkType == GLB_CHUNK_JSON && !json) { json = data + offset + 8; jsonSize = chunkLength; }
+			if (chunkType == GLB_CHUNK_BIN && !bin) { bin = data + offset + 8; binSize = chunkLength; }
+			offset += 8 + (chunkLength + 3) / 4 * 4;
+		}
+		if (!json) return "missing JSON chunk";
+
+		JsonValue root;
+		if (!JsonParser((const char*)json, jsonSize).parse(root) || root.type != JsonValue::OBJECT) return "malformed JSON chunk";
+
+		auto meshes = root.get("meshes");
+		if (!meshes || meshes->type != JsonValue::ARRAY) return "no meshes";
+
+		std::vector<Vec3> positions;
+		std::vector<uint32_t> indices;
+		for (auto& mesh : meshes->elements) {
+			auto primitives = mesh.get("primitives");
+			if (!primitives) continue;
+			for (auto& primitive : primitives->elements) {
+				if (primitive.numberOr("mode", GLTF_TRIANGLES) != GLTF_TRIANGLES) continue;
+				auto attributes = primitive.get("attributes");
+				if (!attributes) return "primitive without attributes";
+
+				GltfAccessor positionAccessor, normalAccessor, indexAccessor;
+				auto error = resolveAccessor(root, attributes->get("POSITION"), bin, binSize, positionAccessor);
+				if (!error.empty()) return "POSITION: " + error;
+				if (positionAccessor.componentType != GLTF_FLOAT || positionAccessor.components != 3) return "POSITION must be float VEC3";
+
+				bool hasNormals = attributes->get("NORMAL") != nullptr;
+				if (hasNormals) {
+					error = resolveAccessor(root, attributes->get("NORMAL"), bin, binSize, normalAccessor);
+					if (!error.empty()) return "NORMAL: " + error;
+					if (normalAccessor.componentType != GLTF_FLOAT || normalAccessor.components != 3 || normalAccessor.count != positionAccessor.count) return "NORMAL must be float VEC3 matching POSITION";
+				}
+
+				indices.clear();
+				if (primitive.get("indices")) {
+					error = resolveAccessor(root, primitive.get("indices"), bin, binSize, indexAccessor);
+					if (!error.empty()) return "indices: " + error;
+					if (indexAccessor.components != 1 || indexAccessor.componentType == GLTF_FLOAT) return "indices must be unsigned scalars";
+					for (uint64_t i=0; i<indexAccessor.count; i++) {
+						auto index = readIndex(indexAccessor, i);
+						if (index >= positionAccessor.count) return "index out of range";
+						indices.push_back(index);
+					}
+				}
+				else {
+					for (uint64_t i=0; i<positionAccessor.count; i++) indices.push_back((uint32_t)i);
+				}
+				indices.resize(indices.size() / 3 * 3);
+
+				positions.resize(positionAccessor.count);
+				for (uint64_t i=0; i<positionAccessor.count; i++) positions[i] = readVec3(positionAccessor, i);
+
+				std::vector<Vec3> generated;
+				if (!hasNormals) generated = generateNormals(positions, indices, std::vector<bool>(indices.size() / 3, true));
+
+				vertices.reserve(vertices.size() + indices.size() * SCENE_FLOATS_PER_VERTEX);
+				for (auto index : indices)
+					emitVertex(vertices, positions[index], hasNormals ? normalizeOrUp(readVec3(normalAccessor, index)) : generated[index]);
+
+				stats.triangles += indices.size() / 3;
+				if (!hasNormals) stats.generatedNormals += indices.size();
+			}
+		}
+
+		stats.bytes += size;
+		return "";
+	}
+}
+
+// Appends the mesh's triangles to vertices (chosen by extension: .obj or .glb), returns an error message or "" on success
+inline std::string importMesh(const std::string& path, std::vector<float>& vertices, MeshImportStats* stats = nullptr) {
+	MeshImportStats localStats;
+	if (!stats) stats = &localStats;
+
+	MappedFile file;
+	auto error = file.open(path);
+	if (!error.empty()) return error;
+
+	auto extension = path.substr(path.find_last_of('.') + 1);
+	for (auto& c : extension) c = (char)std::tolower((unsigned char)c);
+
+	size_t firstFloat = vertices.size();
+	if (extension == "obj") error = meshImport::importObj((const char*)file.data(), file.size(), vertices, *stats);
+	else if (extension == "glb") error = meshImport::importGlb(file.data(), file.size(), vertices, *stats);
+	else error = "unsupported mesh format ." + extension + " (expected .obj or .glb)";
+
+	// Leave vertices as they were on failure
+	if (!error.empty()) vertices.resize(firstFloat);
+	return error.empty() ? "" : path + ": " + error;
+}
+
+// Recentres and uniformly scales vertices (from firstFloat on) to fit the unit cube the grid meshes occupy
+inline void fitMeshToUnitCube(std::vector<float>& vertices, size_t firstFloat = 0) {
+	if (vertices.size() <= firstFloat) return;
+	float minimum[3] = {INFINITY, INFINITY, INFINITY};
+	float maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (size_t i=firstFloat; i<vertices.size(); i+=SCENE_FLOATS_PER_VERTEX)
+		for (int axis=0; axis<3; axis++) {
+			minimum[axis] = std::min(minimum[axis], vertices[i + axis]);
+			maximum[axis] = std::max(maximum[axis], vertices[i + axis]);
+		}
+
+	float extent = std::max({maximum[0] - minimum[0], maximum[1] - minimum[1], maximum[2] - minimum[2], 1e-20f});
+	for (size_t i=firstFloat; i<vertices.size(); i+=SCENE_FLOATS_PER_VERTEX)
+		for (int axis=0; axis<3; axis++)
+			vertices[i + axis] = (vertices[i + axis] - (minimum[axis] + maximum[axis]) * 0.5f) / extent;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+// Mesh LOD chains
+//
+// Each scene mesh gets a chain of progressively coarser versions built by vertex clustering: positions are snapped to
+// a grid over the mesh bounds, triangles that collapse are dropped and each cluster vertex takes the mean position and
+// normal of the vertices it replaced. The grid halves per level and a level's geometric error is its cell diagonal,
+// which bounds how far any surface point moved. Every chain ends with an empty level whose error is the mesh's
+// bounding diameter, so meshes smaller than the error threshold on screen aren't drawn at all.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "scene_format.hpp"
+
+struct MeshLod {
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	float error;	// Object space distance the surface may have moved
+};
+
+struct MeshLodChain {
+	uint32_t firstLod;	// Finest first, the first level is the scene mesh itself
+	uint32_t lodCount;
+	float center[3];	// Bounding sphere, for the distance used in selection
+	float radius;
+};
+
+struct MeshLodRegistry {
+	std::vector<float> vertices;	// Generated levels, numbered after the scene's vertices
+	std::vector<MeshLod> lods;
+	std::vector<MeshLodChain> chains;	// One per scene mesh
+};
+
+// Finest clustering grid, cells along the longest axis
+constexpr const uint32_t MESH_LOD_MAX_RESOLUTION = 64;
+// A level is only kept if it has at most this fraction of the previous level's triangles
+constexpr const float MESH_LOD_MIN_REDUCTION = 0.6f;
+
+inline MeshLodRegistry buildMeshLods(const SceneView& scene) {
+	MeshLodRegistry registry;
+	registry.chains.reserve(scene.meshCount);
+
+	for (uint64_t m=0; m<scene.meshCount; m++) {
+		auto& mesh = scene.meshes[m];
+		const float* meshVertices = scene.vertices + (uint64_t)mesh.firstVertex * SCENE_FLOATS_PER_VERTEX;
+
+		float boundsMin[3] = {INFINITY, INFINITY, INFINITY};
+		float boundsMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+		for (uint32_t v=0; v<mesh.vertexCount; v++)
+			for (int axis=0; axis<3; axis++) {
+				boundsMin[axis] = std::min(boundsMin[axis], meshVertices[v*SCENE_FLOATS_PER_VERTEX + axis]);
+				boundsMax[axis] = std::max(boundsMax[axis], meshVertices[v*SCENE_FLOATS_PER_VERTEX + axis]);
+			}
+
+		MeshLodChain chain {};
+		chain.firstLod = (uint32_t)registry.lods.size();
+		if (mesh.vertexCount == 0) for (int axis=0; axis<3; axis++) boundsMin[axis] = boundsMax[axis] = 0.0f;
+		for (int axis=0; axis<3; axis++) chain.center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		for (uint32_t v=0; v<mesh.vertexCount; v++) {
+			const float* p = meshVertices + v*SCENE_FLOATS_PER_VERTEX;
+			float dx = p[0] - chain.center[0], dy = p[1] - chain.center[1], dz = p[2] - chain.center[2];
+			chain.radius = std::max(chain.radius, std::sqrt(dx*dx + dy*dy + dz*dz));
+		}
+
+		registry.lods.push_back({mesh.firstVertex, mesh.vertexCount, 0.0f});
+		uint32_t previousTriangles = mesh.vertexCount / 3;
+
+		float extent = std::max({boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1], boundsMax[2] - boundsMin[2], 1e-20f});
+		std::vector<int32_t> cellClusters;
+		std::vector<float> clusterSums;	// position xyz, normal xyz
+		std::vector<uint32_t> clusterCounts;
+		std::vector<uint32_t> vertexClusters(mesh.vertexCount);
+		std::unordered_set<uint64_t> emitted;
+
+		for (uint32_t resolution = MESH_LOD_MAX_RESOLUTION; resolution >= 2 && previousTriangles > 1; resolution /= 2) {
+			float cellSize = extent / resolution;
+			cellClusters.assign((size_t)resolution * resolution * resolution, -1);
+			clusterSums.clear();
+			clusterCounts.clear();
+
+			for (uint32_t v=0; v<mesh.vertexCount; v++) {
+				const float* p = meshVertices + v*SCENE_FLOATS_PER_VERTEX;
+				uint32_t cell[3];
+				for (int axis=0; axis<3; axis++) cell[axis] = std::min((uint32_t)((p[axis] - boundsMin[axis]) / cellSize), resolution - 1);
+				auto& cluster = cellClusters[(cell[2] * resolution + cell[1]) * resolution + cell[0]];
+				if (cluster < 0) {
+					cluster = (int32_t)clusterCounts.size();
+					clusterCounts.push_back(0);
+					clusterSums.insert(clusterSums.end(), 6, 0.0f);
+				}
+				for (int i=0; i<6; i++) clusterSums[cluster*6 + i] += p[i];
+				clusterCounts[cluster]++;
+				vertexClusters[v] = (uint32_t)cluster;
+			}
+
+			// Surviving triangles: three distinct clusters, each cluster triple once
+			std::vector<uint32_t> triangles;
+			emitted.clear();
+			for (uint32_t t=0; t<mesh.vertexCount/3; t++) {
+				uint32_t a = vertexClusters[t*3], b = vertexClusters[t*3 + 1], c = vertexClusters[t*3 + 2];
+				if (a == b || b == c || a == c) continue;
+				uint32_t sorted[3] = {a, b, c};
+				std::sort(sorted, sorted + 3);
+				if (!emitted.insert((uint64_t)sorted[0] << 42 | (uint64_t)sorted[1] << 21 | sorted[2]).second) continue;
+				triangles.insert(triangles.end(), {a, b, c});
+			}
+
+			uint32_t triangleCount = (uint32_t)triangles.size() / 3;
+			if (triangleCount == 0 || triangleCount > previousTriangles * MESH_LOD_MIN_REDUCTION) continue;
+
+			MeshLod lod {(uint32_t)(scene.vertexCount + registry.vertices.size() / SCENE_FLOATS_PER_VERTEX), triangleCount * 3, cellSize * std::sqrt(3.0f)};
+			for (auto cluster : triangles) {
+				float inverseCount = 1.0f / clusterCounts[cluster];
+				float position[3], normal[3];
+				for (int axis=0; axis<3; axis++) {
+					position[axis] = clusterSums[cluster*6 + axis] * inverseCount;
+					normal[axis] = clusterSums[cluster*6 + 3 + axis];
+				}
+				float length = std::sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+				for (int axis=0; axis<3; axis++) normal[axis] = length > 0.0f ? normal[axis] / length : (axis == 1 ? 1.0f : 0.0f);
+				registry.vertices.insert(registry.vertices.end(), {position[0], position[1], position[2], normal[0], normal[1], normal[2]});
+			}
+			registry.lods.push_back(lod);
+			previousTriangles = triangleCount;
+		}
+
+		registry.lods.push_back({0, 0, chain.radius * 2.0f});
+		chain.lodCount = (uint32_t)registry.lods.size() - chain.firstLod;
+		registry.chains.push_back(chain);
+	}
+
+	return registry;
+}
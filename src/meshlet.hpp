@@ -0,0 +1,207 @@
+#pragma once
+
+// Meshlets
+//
+// Large meshes are split into clusters of at most MESHLET_MAX_VERTICES unique positions and MESHLET_MAX_TRIANGLES
+// triangles, grown breadth first over shared vertices from seeds taken in Morton order so clusters stay compact. Each
+// meshlet's triangles are copied out contiguously (the vertex format is non-indexed) so a meshlet is drawn by one
+// DrawArraysIndirectCommand, and carries a bounding sphere and normal cone for culling before the rasteriser.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "scene_format.hpp"
+
+constexpr const uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr const uint32_t MESHLET_MAX_TRIANGLES = 124;
+// Smaller meshes are cheaper to draw whole than to cull per cluster
+constexpr const uint32_t MESHLET_MIN_MESH_TRIANGLES = MESHLET_MAX_TRIANGLES * 4;
+
+struct Meshlet {
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	float center[3];	// Bounding sphere, mesh space
+	float radius;
+	float coneAxis[3];	// Average face normal
+	float coneCutoff;	// Sine of the cone's half angle, 1 when the normals span a hemisphere or more (never culled)
+};
+
+struct MeshletRange {
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;	// 0 for meshes drawn whole
+};
+
+struct MeshletRegistry {
+	std::vector<float> vertices;	// Meshlet triangles, numbered from the firstVertex passed to buildMeshlets()
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshletRange> ranges;	// One per scene mesh
+};
+
+// True when every triangle of the meshlet faces away from the camera
+inline bool meshletBackfacing(const Meshlet& meshlet, const float center[3], const float cameraPosition[3]) {
+	float view[3] = {center[0] - cameraPosition[0], center[1] - cameraPosition[1], center[2] - cameraPosition[2]};
+	float distance = std::sqrt(view[0]*view[0] + view[1]*view[1] + view[2]*view[2]);
+	float alongAxis = view[0]*meshlet.coneAxis[0] + view[1]*meshlet.coneAxis[1] + view[2]*meshlet.coneAxis[2];
+	return alongAxis >= meshlet.coneCutoff * distance + meshlet.radius;
+}
+
+inline MeshletRegistry buildMeshlets(const SceneView& scene, uint64_t firstVertex) {
+	MeshletRegistry registry;
+	registry.ranges.resize(scene.meshCount);
+
+	std::vector<uint32_t> positionIds;
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	std::vector<uint8_t> assigned;
+	std::vector<uint32_t> queue;
+	std::vector<uint32_t> meshletTriangles;
+	std::vector<uint32_t> meshletPositions;
+
+	for (uint64_t m=0; m<scene.meshCount; m++) {
+		auto& mesh = scene.meshes[m];
+		uint32_t triangleCount = mesh.vertexCount / 3;
+		registry.ranges[m] = {(uint32_t)registry.meshlets.size(), 0};
+		if (triangleCount < MESHLET_MIN_MESH_TRIANGLES) continue;
+
+		const float* meshVertices = scene.vertices + (uint64_t)mesh.firstVertex * SCENE_FLOATS_PER_VERTEX;
+		auto position = [&](uint32_t vertex) { return meshVertices + (uint64_t)vertex * SCENE_FLOATS_PER_VERTEX; };
+
+		// Weld equal positions, meshlet vertex limits count positions rather than soup vertices
+		std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+		positionIds.assign(mesh.vertexCount, 0);
+		uint32_t positionCount = 0;
+		for (uint32_t v=0; v<mesh.vertexCount; v++) {
+			uint32_t bits[3];
+			std::memcpy(bits, position(v), sizeof(bits));
+			uint64_t hash = (uint64_t)bits[0] * 73856093u ^ (uint64_t)bits[1] * 19349663u ^ (uint64_t)bits[2] * 83492791u;
+			auto& bucket = buckets[hash];
+			auto match = std::find_if(bucket.begin(), bucket.end(), [&](uint32_t other) { return std::memcmp(position(other), position(v), sizeof(float) * 3) == 0; });
+			positionIds[v] = match == bucket.end() ? positionCount++ : positionIds[*match];
+			if (match == bucket.end()) bucket.push_back(v);
+		}
+
+		// Triangles sharing each position
+		adjacencyOffsets.assign(positionCount + 1, 0);
+		for (uint32_t v=0; v<mesh.vertexCount; v++) adjacencyOffsets[positionIds[v] + 1]++;
+		for (uint32_t p=0; p<positionCount; p++) adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+		adjacency.resize(mesh.vertexCount);
+		{
+			std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (uint32_t v=0; v<mesh.vertexCount; v++) adjacency[cursor[positionIds[v]]++] = v / 3;
+		}
+
+		// Seeds in Morton order of the triangle centroids
+		float boundsMin[3] = {INFINITY, INFINITY, INFINITY}, boundsMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+		for (uint32_t v=0; v<mesh.vertexCount; v++)
+			for (int axis=0; axis<3; axis++) {
+				boundsMin[axis] = std::min(boundsMin[axis], position(v)[axis]);
+				boundsMax[axis] = std::max(boundsMax[axis], position(v)[axis]);
+			}
+		std::vector<std::pair<uint32_t, uint32_t>> mortonTriangles(triangleCount);
+		for (uint32_t t=0; t<triangleCount; t++) {
+			uint32_t code = 0;
+			for (int axis=0; axis<3; axis++) {
+				float centroid = (position(t*3)[axis] + position(t*3 + 1)[axis] + position(t*3 + 2)[axis]) / 3.0f;
+				float extent = boundsMax[axis] - boundsMin[axis];
+				uint32_t cell = extent > 0.0f ? std::min((uint32_t)((centroid - boundsMin[axis]) / extent * 1024.0f), 1023u) : 0;
+				for (int bit=0; bit<10; bit++) code |= ((cell >> bit) & 1) << (bit*3 + axis);
+			}
+			mortonTriangles[t] = {code, t};
+		}
+		std::sort(mortonTriangles.begin(), mortonTriangles.end());
+
+		assigned.assign(triangleCount, 0);
+		for (auto& seed : mortonTriangles) {
+			if (assigned[seed.second]) continue;
+
+			meshletTriangles.clear();
+			meshletPositions.clear();
+			queue.assign(1, seed.second);
+			assigned[seed.second] = 1;
+
+			for (size_t head=0; head<queue.size() && meshletTriangles.size() < MESHLET_MAX_TRIANGLES; head++) {
+				uint32_t triangle = queue[head];
+
+				uint32_t newPositions = 0;
+				for (uint32_t corner=0; corner<3; corner++)
+					newPositions += std::find(meshletPositions.begin(), meshletPositions.end(), positionIds[triangle*3 + corner]) == meshletPositions.end();
+				if (meshletPositions.size() + newPositions > MESHLET_MAX_VERTICES) {
+					// Doesn't fit, leave it for a later meshlet
+					assigned[triangle] = 0;
+					continue;
+				}
+
+				meshletTriangles.push_back(triangle);
+				for (uint32_t corner=0; corner<3; corner++) {
+					uint32_t id = positionIds[triangle*3 + corner];
+					if (std::find(meshletPositions.begin(), meshletPositions.end(), id) != meshletPositions.end()) continue;
+					meshletPositions.push_back(id);
+					for (uint32_t a=adjacencyOffsets[id]; a<adjacencyOffsets[id + 1]; a++) {
+						uint32_t neighbour = adjacency[a];
+						if (assigned[neighbour]) continue;
+						assigned[neighbour] = 1;
+						queue.push_back(neighbour);
+					}
+				}
+			}
+			// Queued triangles that didn't make it stay available
+			for (auto triangle : queue) assigned[triangle] = 0;
+			for (auto triangle : meshletTriangles) assigned[triangle] = 1;
+
+			Meshlet meshlet {};
+			meshlet.firstVertex = (uint32_t)(firstVertex + registry.vertices.size() / SCENE_FLOATS_PER_VERTEX);
+			meshlet.vertexCount = (uint32_t)meshletTriangles.size() * 3;
+
+			float meshletMin[3] = {INFINITY, INFINITY, INFINITY}, meshletMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+			float axis[3] = {0.0f, 0.0f, 0.0f};
+			std::vector<std::array<float, 3>> faceNormals;
+			for (auto triangle : meshletTriangles) {
+				const float* a = position(triangle*3);
+				const float* b = position(triangle*3 + 1);
+				const float* c = position(triangle*3 + 2);
+				registry.vertices.insert(registry.vertices.end(), a, a + SCENE_FLOATS_PER_VERTEX);
+				registry.vertices.insert(registry.vertices.end(), b, b + SCENE_FLOATS_PER_VERTEX);
+				registry.vertices.insert(registry.vertices.end(), c, c + SCENE_FLOATS_PER_VERTEX);
+				for (auto p : {a, b, c})
+					for (int i=0; i<3; i++) {
+						meshletMin[i] = std::min(meshletMin[i], p[i]);
+						meshletMax[i] = std::max(meshletMax[i], p[i]);
+					}
+
+				// Geometric normal, counter-clockwise front faces
+				float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+				float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+				std::array<float, 3> n = {e1[1]*e2[2] - e1[2]*e2[1], e1[2]*e2[0] - e1[0]*e2[2], e1[0]*e2[1] - e1[1]*e2[0]};
+				float length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+				if (length == 0.0f) continue;
+				for (int i=0; i<3; i++) n[i] /= length;
+				for (int i=0; i<3; i++) axis[i] += n[i];
+				faceNormals.push_back(n);
+			}
+
+			for (int i=0; i<3; i++) meshlet.center[i] = (meshletMin[i] + meshletMax[i]) * 0.5f;
+			for (auto triangle : meshletTriangles)
+				for (uint32_t corner=0; corner<3; corner++) {
+					const float* p = position(triangle*3 + corner);
+					float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1], dz = p[2] - meshlet.center[2];
+					meshlet.radius = std::max(meshlet.radius, std::sqrt(dx*dx + dy*dy + dz*dz));
+				}
+
+			float axisLength = std::sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+			float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+			for (int i=0; i<3; i++) meshlet.coneAxis[i] = axisLength > 0.0f ? axis[i] / axisLength : 0.0f;
+			for (auto& n : faceNormals) minDot = std::min(minDot, n[0]*meshlet.coneAxis[0] + n[1]*meshlet.coneAxis[1] + n[2]*meshlet.coneAxis[2]);
+			meshlet.coneCutoff = minDot > 0.0f ? std::sqrt(1.0f - minDot*minDot) : 1.0f;
+
+			registry.meshlets.push_back(meshlet);
+			registry.ranges[m].meshletCount++;
+		}
+	}
+
+	return registry;
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+// Object pool
+//
+// Every per-object GPU table (position, color, mesh, rotation, scale, bounds) is indexed by slot, so objects are fixed
+// size allocations: slots come from a free list and objects hold generational handles that map to their slot. Spawning
+// or despawning touches one slot of each table and records it as dirty for the renderer to upload. Capacity doubles
+// when the free list runs out (the renderer re-uploads every table then).
+//
+// Freed slots leave holes below the high water mark that culling, the BVH and the spin update still walk. Once the
+// holes pass compactionThreshold of the used range, compact() moves the topmost objects into the lowest holes, a
+// bounded number per call so it can run a little every frame.
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "bvh.hpp"
+#include "object_transforms.hpp"
+#include "parallel.hpp"
+#include "scene_format.hpp"
+
+struct ObjectHandle {
+	uint32_t id = ~0u;
+	uint32_t generation = 0;
+};
+
+class ObjectPool {
+	std::vector<uint32_t> handleSlots;
+	std::vector<uint32_t> handleGenerations;
+	std::vector<uint32_t> freeHandles;
+	std::vector<uint32_t> slotHandles;	// INVALID for free slots
+
+	std::vector<uint32_t> freeSlots;	// Below slotHighWater, popped from the back
+	bool freeSlotsSorted = true;
+	uint32_t slotHighWater = 0;
+
+	std::vector<float> meshRadii;
+	std::mt19937 gen;
+	float maxAngularSpeed = 0.0f;
+
+	void markDirty(uint32_t slot) {
+		dirtySlots.push_back(slot);
+	}
+
+	void grow(uint32_t minimumCapacity) {
+		uint32_t capacity = std::max({minimumCapacity, (uint32_t)slotHandles.size() * 2, 1024u});
+		positions.resize((size_t)capacity * 3, 0.0f);
+		colors.resize((size_t)capacity * 3, 0.0f);
+		meshes.resize(capacity, 0);
+		transforms.resize(capacity);
+		bounds.resize(capacity, Aabb::empty());
+		slotHandles.resize(capacity, INVALID);
+		grown = true;
+	}
+
+public:
+	static constexpr uint32_t INVALID = ~0u;
+
+	// Slot tables, sized to capacity
+	std::vector<float> positions;	// 3 floats per slot
+	std::vector<float> colors;		// 3 floats per slot
+	std::vector<uint32_t> meshes;
+	ObjectTransforms transforms;
+	std::vector<Aabb> bounds;		// Rotation invariant, empty for free slots
+
+	// Slots changed since the renderer last uploaded them, may repeat
+	std::vector<uint32_t> dirtySlots;
+	// Capacity changed, every table needs uploading again
+	bool grown = false;
+	// Bumped whenever an object is added, removed or moved to another slot, anything derived from slot numbers (like
+	// draw commands) is stale once it changes
+	uint64_t layoutVersion = 0;
+
+	// Fraction of the used slot range that is holes before compact() does anything
+	float compactionThreshold = 0.25f;
+
+	// The scene's objects take the first slots, handle i is object i
+	void init(const SceneView& scene, uint32_t seed, float spinSpeed) {
+		uint64_t version = layoutVersion;
+		*this = ObjectPool();
+		layoutVersion = version + 1;
+		gen.seed(seed);
+		maxAngularSpeed = spinSpeed;
+		meshRadii = computeMeshRadii(scene);
+
+		uint32_t objectCount = (uint32_t)scene.objectCount;
+		grow(objectCount + objectCount / 8);
+		transforms.randomiseSpins(objectCount, seed, spinSpeed);
+
+		// Straight into the slot tables, a chunk of objects per thread
+		handleSlots.resize(objectCount);
+		handleGenerations.assign(objectCount, 0);
+		parallelFor(objectCount, 16384, [&](size_t begin, size_t end) {
+			std::copy(scene.objectPositions + begin*3, scene.objectPositions + end*3, positions.begin() + begin*3);
+			std::copy(scene.objectColors + begin*3, scene.objectColors + end*3, colors.begin() + begin*3);
+			std::copy(scene.objectMeshes + begin, scene.objectMeshes + end, meshes.begin() + begin);
+			for (size_t i=begin; i<end; i++) {
+				handleSlots[i] = slotHandles[i] = (uint32_t)i;
+				bounds[i] = rotatedObjectBounds(&positions[i*3], meshRadii[meshes[i]], transforms.scales[i]);
+			}
+		});
+		slotHighWater = objectCount;
+	}
+
+	ObjectHandle spawn(const float position[3], const float color[3], uint32_t mesh, float scale = 1.0f) {
+		uint32_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			if (slotHighWater == capacity()) grow(capacity() + 1);
+			slot = slotHighWater++;
+		}
+
+		ObjectHandle handle;
+		if (!freeHandles.empty()) {
+			handle.id = freeHandles.back();
+			freeHandles.pop_back();
+		}
+		else {
+			handle.id = (uint32_t)handleSlots.size();
+			handleSlots.push_back(INVALID);
+			handleGenerations.push_back(0);
+		}
+		handle.generation = handleGenerations[handle.id];
+		handleSlots[handle.id] = slot;
+		slotHandles[slot] = handle.id;
+
+		std::copy(position, position + 3, &positions[(size_t)slot*3]);
+		std::copy(color, color + 3, &colors[(size_t)slot*3]);
+		meshes[slot] = mesh;
+		float angular[3];
+		ObjectTransforms::randomAngularVelocity(gen, maxAngularSpeed, angular);
+		transforms.setObject(slot, angular, scale);
+		bounds[slot] = rotatedObjectBounds(position, meshRadii[mesh], scale);
+		markDirty(slot);
+		layoutVersion++;
+		return handle;
+	}
+
+	// False for handles that were already despawned
+	bool despawn(ObjectHandle handle) {
+		if (!alive(handle)) return false;
+
+		uint32_t slot = handleSlots[handle.id];
+		handleSlots[handle.id] = INVALID;
+		handleGenerations[handle.id]++;
+		freeHandles.push_back(handle.id);
+
+		slotHandles[slot] = INVALID;
+		bounds[slot] = Aabb::empty();
+		freeSlots.push_back(slot);
+		freeSlotsSorted = false;
+		markDirty(slot);
+		layoutVersion++;
+		return true;
+	}
+
+	bool alive(ObjectHandle handle) const {
+		return handle.id < handleSlots.size() && handleGenerations[handle.id] == handle.generation && handleSlots[handle.id] != INVALID;
+	}
+
+	uint32_t slot(ObjectHandle handle) const {
+		return handleSlots[handle.id];
+	}
+
+	uint32_t capacity() const {
+		return (uint32_t)slotHandles.size();
+	}
+
+	uint32_t highWater() const {
+		return slotHighWater;
+	}
+
+	uint32_t liveCount() const {
+		return slotHighWater - (uint32_t)freeSlots.size();
+	}
+
+	// Holes as a fraction of the used slot range
+	float fragmentation() const {
+		return slotHighWater ? (float)freeSlots.size() / slotHighWater : 0.0f;
+	}
+
+	// Moves up to budget objects from the top of the used range into the lowest holes, returns the number moved
+	uint32_t compact(uint32_t budget) {
+		if (fragmentation() <= compactionThreshold) return 0;
+
+		if (!freeSlotsSorted) {
+			std::sort(freeSlots.begin(), freeSlots.end());
+			freeSlotsSorted = true;
+		}
+
+		uint32_t moved = 0;
+		size_t lowest = 0, end = freeSlots.size();
+		while (lowest < end && moved < budget) {
+			// Holes at the top just lower the high water mark
+			if (freeSlots[end - 1] == slotHighWater - 1) {
+				end--;
+				slotHighWater--;
+				continue;
+			}
+
+			uint32_t from = slotHighWater - 1, to = freeSlots[lowest++];
+			uint32_t handle = slotHandles[from];
+			std::copy(&positions[(size_t)from*3], &positions[(size_t)from*3 + 3], &positions[(size_t)to*3]);
+			std::copy(&colors[(size_t)from*3], &colors[(size_t)from*3 + 3], &colors[(size_t)to*3]);
+			meshes[to] = meshes[from];
+			transforms.copyObject(from, to);
+			bounds[to] = bounds[from];
+			bounds[from] = Aabb::empty();
+			slotHandles[to] = handle;
+			slotHandles[from] = INVALID;
+			handleSlots[handle] = to;
+			markDirty(to);
+			markDirty(from);
+
+			slotHighWater--;
+			moved++;
+		}
+		freeSlots.erase(freeSlots.begin() + end, freeSlots.end());
+		freeSlots.erase(freeSlots.begin(), freeSlots.begin() + lowest);
+		if (moved) layoutVersion++;
+		// Still ascending, popping from the back hands out the highest hole first until the next compaction
+		return moved;
+	}
+};
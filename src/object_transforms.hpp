@@ -0,0 +1,209 @@
+#pragma once
+
+// Per-object rotation and uniform scale
+//
+// Translation stays in the scene's position stream, each object adds a unit quaternion and a scale. Rotations are kept
+// as SoA streams for the update kernel, which integrates every object's angular velocity 4 objects at a time and writes
+// the quaternions out interleaved (x, y, z, w per object) for upload as a vertex attribute. Uniform scale keeps the
+// normal transform a pure rotation.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OBJECT_TRANSFORMS_SSE
+#include <emmintrin.h>
+#endif
+
+#include "bvh.hpp"
+#include "cpu_profiler.hpp"
+#include "parallel.hpp"
+#include "scene_format.hpp"
+
+struct ObjectTransforms {
+	// Rotation quaternion, SoA, padded to a multiple of 4 objects
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+	// Angular velocity, world space radians per second
+	std::vector<float> angularX, angularY, angularZ;
+	std::vector<float> scales;
+
+	// Interleaved quaternions, 4 floats per object, written by integrate()
+	std::vector<float> gpuRotations;
+
+	uint64_t count = 0;
+
+	// Identity rotations and unit scale, spin axes are random with speeds up to maxAngularSpeed
+	void init(uint64_t objectCount, uint32_t seed, float maxAngularSpeed) {
+		resize(0);
+		resize(objectCount);
+		randomiseSpins(objectCount, seed, maxAngularSpeed);
+	}
+
+	// Objects per generator in randomiseSpins(), each block is seeded from its index so the spins don't depend on the
+	// thread count
+	static constexpr uint64_t SPIN_SEED_BLOCK = 16384;
+
+	// Resets objects [0, objectCount) to identity rotations at unit scale with random spins, in parallel
+	void randomiseSpins(uint64_t objectCount, uint32_t seed, float maxAngularSpeed) {
+		uint64_t blocks = (objectCount + SPIN_SEED_BLOCK - 1) / SPIN_SEED_BLOCK;
+		parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+			for (uint64_t block=begin; block<end; block++) {
+				std::seed_seq seeds {seed, (uint32_t)block};
+				std::mt19937 gen(seeds);
+				for (uint64_t i=block * SPIN_SEED_BLOCK; i<std::min(objectCount, (block + 1) * SPIN_SEED_BLOCK); i++) {
+					float angular[3];
+					randomAngularVelocity(gen, maxAngularSpeed, angular);
+					setObject(i, angular, 1.0f);
+				}
+			}
+		});
+	}
+
+	// Keeps existing objects, new ones are identity rotations at unit scale that don't spin
+	void resize(uint64_t objectCount) {
+		count = objectCount;
+		uint64_t padded = (objectCount + 3) & ~(uint64_t)3;
+		for (auto stream : {&rotationX, &rotationY, &rotationZ, &angularX, &angularY, &angularZ}) stream->resize(padded, 0.0f);
+		rotationW.resize(padded, 1.0f);
+		scales.resize(objectCount, 1.0f);
+
+		uint64_t previous = gpuRotations.size() / 4;
+		gpuRotations.resize(padded * 4, 0.0f);
+		for (uint64_t i=previous; i<padded; i++) gpuRotations[i*4 + 3] = 1.0f;
+	}
+
+	void setObject(uint64_t object, const float angular[3], float scale) {
+		rotationX[object] = rotationY[object] = rotationZ[object] = 0.0f;
+		rotationW[object] = 1.0f;
+		angularX[object] = angular[0];
+		angularY[object] = angular[1];
+		angularZ[object] = angular[2];
+		scales[object] = scale;
+		std::fill(&gpuRotations[object*4], &gpuRotations[object*4 + 3], 0.0f);
+		gpuRotations[object*4 + 3] = 1.0f;
+	}
+
+	void copyObject(uint64_t from, uint64_t to) {
+		for (auto stream : {&rotationX, &rotationY, &rotationZ, &rotationW, &angularX, &angularY, &angularZ}) (*stream)[to] = (*stream)[from];
+		scales[to] = scales[from];
+		std::copy(&gpuRotations[from*4], &gpuRotations[from*4 + 4], &gpuRotations[to*4]);
+	}
+
+	// Random axis, speed between a quarter of and maxAngularSpeed
+	static void randomAngularVelocity(std::mt19937& gen, float maxAngularSpeed, float out[3]) {
+		// Uniform on the sphere from z and an angle, cheaper than normalising three normal samples
+		std::uniform_real_distribution<float> axisZ(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> axisAngle(0.0f, 6.28318531f);
+		std::uniform_real_distribution<float> speed(maxAngularSpeed * 0.25f, maxAngularSpeed);
+		float z = axisZ(gen), angle = axisAngle(gen);
+		float s = speed(gen), r = std::sqrt(std::max(1.0f - z*z, 0.0f)) * s;
+		out[0] = r * std::cos(angle);
+		out[1] = r * std::sin(angle);
+		out[2] = z * s;
+	}
+
+	// q += dt/2 * (0, w) * q, renormalised, for objects [begin, end) (begin a multiple of 4)
+	void integrate(float deltaTime, uint64_t begin, uint64_t end) {
+		float h = deltaTime * 0.5f;
+		uint64_t i = begin;
+
+	#ifdef OBJECT_TRANSFORMS_SSE
+		__m128 hh = _mm_set1_ps(h);
+		__m128 half = _mm_set1_ps(0.5f), threeHalves = _mm_set1_ps(1.5f);
+		for (; i + 4 <= end; i += 4) {
+			__m128 x = _mm_loadu_ps(&rotationX[i]), y = _mm_loadu_ps(&rotationY[i]), z = _mm_loadu_ps(&rotationZ[i]), w = _mm_loadu_ps(&rotationW[i]);
+			__m128 ax = _mm_mul_ps(_mm_loadu_ps(&angularX[i]), hh), ay = _mm_mul_ps(_mm_loadu_ps(&angularY[i]), hh), az = _mm_mul_ps(_mm_loadu_ps(&angularZ[i]), hh);
+
+			__m128 nx = _mm_add_ps(x, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(ax, w), _mm_mul_ps(ay, z)), _mm_mul_ps(az, y)));
+			__m128 ny = _mm_add_ps(y, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(ay, w), _mm_mul_ps(az, x)), _mm_mul_ps(ax, z)));
+			__m128 nz = _mm_add_ps(z, _mm_sub_ps(_mm_add_ps(_mm_mul_ps(az, w), _mm_mul_ps(ax, y)), _mm_mul_ps(ay, x)));
+			__m128 nw = _mm_sub_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, x), _mm_mul_ps(ay, y)), _mm_mul_ps(az, z)));
+
+			// rsqrt estimate refined with one Newton step
+			__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_add_ps(_mm_mul_ps(nz, nz), _mm_mul_ps(nw, nw)));
+			__m128 r = _mm_rsqrt_ps(lengthSquared);
+			r = _mm_mul_ps(r, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, lengthSquared), _mm_mul_ps(r, r))));
+			nx = _mm_mul_ps(nx, r);
+			ny = _mm_mul_ps(ny, r);
+			nz = _mm_mul_ps(nz, r);
+			nw = _mm_mul_ps(nw, r);
+
+			_mm_storeu_ps(&rotationX[i], nx);
+			_mm_storeu_ps(&rotationY[i], ny);
+			_mm_storeu_ps(&rotationZ[i], nz);
+			_mm_storeu_ps(&rotationW[i], nw);
+
+			_MM_TRANSPOSE4_PS(nx, ny, nz, nw);
+			_mm_storeu_ps(&gpuRotations[i*4], nx);
+			_mm_storeu_ps(&gpuRotations[i*4 + 4], ny);
+			_mm_storeu_ps(&gpuRotations[i*4 + 8], nz);
+			_mm_storeu_ps(&gpuRotations[i*4 + 12], nw);
+		}
+	#endif
+
+		for (; i<end; i++) {
+			float x = rotationX[i], y = rotationY[i], z = rotationZ[i], w = rotationW[i];
+			float ax = angularX[i] * h, ay = angularY[i] * h, az = angularZ[i] * h;
+			float nx = x + ax*w + ay*z - az*y;
+			float ny = y + ay*w + az*x - ax*z;
+			float nz = z + az*w + ax*y - ay*x;
+			float nw = w - ax*x - ay*y - az*z;
+			float r = 1.0f / std::sqrt(nx*nx + ny*ny + nz*nz + nw*nw);
+			rotationX[i] = gpuRotations[i*4] = nx * r;
+			rotationY[i] = gpuRotations[i*4 + 1] = ny * r;
+			rotationZ[i] = gpuRotations[i*4 + 2] = nz * r;
+			rotationW[i] = gpuRotations[i*4 + 3] = nw * r;
+		}
+	}
+
+	// integrate() over objects [0, count) on the worker pool, chunks stay multiples of 4 objects so only the last one takes
+	// the scalar tail
+	void integrateAll(float deltaTime, uint64_t count) {
+		parallelFor((count + 3) / 4, 1 << 16, [&](size_t begin, size_t end) {
+			CPU_PROFILE_ZONE("integrate rotations");
+			integrate(deltaTime, begin * 4, std::min<uint64_t>(end * 4, count));
+		});
+	}
+
+	// Object space direction to world space (rotation only)
+	void rotate(uint64_t object, const float v[3], float out[3]) const {
+		float qx = rotationX[object], qy = rotationY[object], qz = rotationZ[object], qw = rotationW[object];
+		// v + 2 * cross(q.xyz, cross(q.xyz, v) + w * v)
+		float tx = qy*v[2] - qz*v[1] + qw*v[0];
+		float ty = qz*v[0] - qx*v[2] + qw*v[1];
+		float tz = qx*v[1] - qy*v[0] + qw*v[2];
+		out[0] = v[0] + 2.0f * (qy*tz - qz*ty);
+		out[1] = v[1] + 2.0f * (qz*tx - qx*tz);
+		out[2] = v[2] + 2.0f * (qx*ty - qy*tx);
+	}
+
+	// Object space point to world space
+	void transformPoint(uint64_t object, const float* objectPosition, const float p[3], float out[3]) const {
+		rotate(object, p, out);
+		for (int axis=0; axis<3; axis++) out[axis] = objectPosition[axis] + out[axis] * scales[object];
+	}
+};
+
+// Farthest vertex distance from each mesh's origin
+inline std::vector<float> computeMeshRadii(const SceneView& scene) {
+	std::vector<float> meshRadii(scene.meshCount, 0.0f);
+	for (uint64_t m=0; m<scene.meshCount; m++) {
+		auto& mesh = scene.meshes[m];
+		for (uint32_t v=0; v<mesh.vertexCount; v++) {
+			const float* p = scene.vertices + (uint64_t)(mesh.firstVertex + v) * SCENE_FLOATS_PER_VERTEX;
+			meshRadii[m] = std::max(meshRadii[m], p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+		}
+		meshRadii[m] = std::sqrt(meshRadii[m]);
+	}
+	return meshRadii;
+}
+
+// World space bounds that hold for any rotation: a cube around the object's origin of its mesh's radius, so spinning
+// objects never need a BVH refit
+inline Aabb rotatedObjectBounds(const float position[3], float meshRadius, float scale) {
+	float radius = meshRadius * scale;
+	return {{position[0] - radius, position[1] - radius, position[2] - radius}, {position[0] + radius, position[1] + radius, position[2] + radius}};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+// Object pool slot tables to GPU buffers
+//
+// Positions, colors and meshes sit one table after the other in the uniforms buffer, scales in the transforms buffer
+// and bounds in the occlusion culling buffer, every table indexed by slot. Rotations are copied whole into a
+// persistently mapped buffer per frame in flight. Buffer is anything with update(offset, size, data): GlBuffer in the
+// demo, a mock in renderer_bench.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "object_pool.hpp"
+
+// Uniforms buffer size for capacity slots
+inline size_t objectUniformsSize(size_t capacity) {
+	return (sizeof(float) * 3 * 2 + sizeof(uint32_t)) * capacity;
+}
+
+// Uploads slots [first, first + count) of every per-object table
+template <typename Buffer>
+void uploadObjectSlots(const ObjectPool& pool, uint32_t first, uint32_t count, Buffer& uniforms, Buffer& transforms, Buffer& bounds) {
+	size_t tableSize = sizeof(float) * 3 * pool.capacity();
+	uniforms.update(sizeof(float) * 3 * first, sizeof(float) * 3 * count, &pool.positions[(size_t)first * 3]);
+	uniforms.update(tableSize + sizeof(float) * 3 * first, sizeof(float) * 3 * count, &pool.colors[(size_t)first * 3]);
+	uniforms.update(tableSize * 2 + sizeof(uint32_t) * first, sizeof(uint32_t) * count, &pool.meshes[first]);
+	transforms.update(sizeof(float) * first, sizeof(float) * count, &pool.transforms.scales[first]);
+	bounds.update(sizeof(Aabb) * first, sizeof(Aabb) * count, &pool.bounds[first]);
+}
+
+// Sorts and deduplicates the pool's dirty slots, then uploads them in contiguous runs. The slots are left in dirtySlots
+// for the caller's other updates (the BVH) to clear. Returns the number of runs.
+template <typename Buffer>
+size_t uploadDirtySlots(ObjectPool& pool, Buffer& uniforms, Buffer& transforms, Buffer& bounds) {
+	auto& dirty = pool.dirtySlots;
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+	size_t runs = 0;
+	for (size_t i=0; i<dirty.size(); runs++) {
+		size_t end = i + 1;
+		while (end < dirty.size() && dirty[end] == dirty[end - 1] + 1) end++;
+		uploadObjectSlots(pool, dirty[i], (uint32_t)(end - i), uniforms, transforms, bounds);
+		i = end;
+	}
+	return runs;
+}
+
+// The interleaved rotations of every used slot
+inline void copyObjectRotations(const ObjectPool& pool, float* destination) {
+	std::copy(pool.transforms.gpuRotations.begin(), pool.transforms.gpuRotations.begin() + (size_t)pool.highWater() * 4, destination);
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+// Fork/join helper for CPU side scene and frame work (BVH builds, refits, submission, sorting)
+//
+// Workers are started by the first call and park between calls, so a call costs a wake-up rather than thread spawns and
+// allocates nothing. Chunk i always runs on worker i (the caller is worker 0), so per-thread state like submission
+// queues sees the same share of the work every frame. One call at a time runs on the pool: a call made while it is
+// busy (from inside a chunk, or from a second thread) runs all of its chunks on the calling thread.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline unsigned int workerCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+class WorkerPool {
+	std::vector<std::thread> threads;
+	std::atomic<bool> busy {false};
+
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	uint64_t generation = 0;
+	unsigned int activeWorkers = 0;
+	size_t pendingChunks = 0;
+	bool stopping = false;
+
+	// The running call
+	void (*run)(void*, size_t, size_t) = nullptr;
+	void* context = nullptr;
+	size_t count = 0, chunkSize = 0, chunks = 0;
+
+	void workerMain(size_t worker) {
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+			if (worker >= chunks) continue;
+
+			activeWorkers++;
+			lock.unlock();
+			size_t begin = worker * chunkSize;
+			run(context, begin, std::min(begin + chunkSize, count));
+			lock.lock();
+			pendingChunks--;
+			// The caller waits for every worker to finish before it sets up the next call
+			if (--activeWorkers == 0 && pendingChunks == 0) finished.notify_one();
+		}
+	}
+
+public:
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads) thread.join();
+	}
+
+	// Calls fn over chunkCount chunks of itemsPerChunk (at most workerCount()), false (nothing run) if the pool is already
+	// running a call
+	template <typename Fn>
+	bool tryRun(size_t itemCount, size_t itemsPerChunk, size_t chunkCount, Fn& fn) {
+		if (busy.exchange(true, std::memory_order_acquire)) return false;
+
+		if (threads.empty())
+			for (size_t worker=1; worker<workerCount(); worker++) threads.emplace_back([this, worker]() { workerMain(worker); });
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			run = [](void* fnContext, size_t begin, size_t end) { (*static_cast<Fn*>(fnContext))(begin, end); };
+			context = const_cast<void*>(static_cast<const void*>(&fn));
+			count = itemCount;
+			chunkSize = itemsPerChunk;
+			chunks = chunkCount;
+			pendingChunks = chunkCount - 1;
+			generation++;
+		}
+		wake.notify_all();
+
+		fn((size_t)0, std::min(itemsPerChunk, itemCount));
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [&]() { return pendingChunks == 0 && activeWorkers == 0; });
+		}
+
+		busy.store(false, std::memory_order_release);
+		return true;
+	}
+};
+
+inline WorkerPool& workerPool() {
+	static WorkerPool pool;
+	return pool;
+}
+
+// Calls fn(begin, end) over contiguous chunks of [0, count), chunks are at least minChunk long so small inputs stay on
+// the calling thread, which always takes the first chunk
+template <typename Fn>
+void parallelFor(size_t count, size_t minChunk, Fn&& fn) {
+	size_t chunks = std::min<size_t>(workerCount(), std::max<size_t>(1, count / std::max<size_t>(1, minChunk)));
+	if (chunks <= 1) {
+		if (count) fn((size_t)0, count);
+		return;
+	}
+
+	size_t chunkSize = (count + chunks - 1) / chunks;
+	chunks = (count + chunkSize - 1) / chunkSize;
+	if (workerPool().tryRun(count, chunkSize, chunks, fn)) return;
+
+	for (size_t begin=0; begin<count; begin+=chunkSize) fn(begin, std::min(begin + chunkSize, count));
+}
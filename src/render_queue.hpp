@@ -0,0 +1,176 @@
+#pragma once
+
+// Render queue
+//
+// Submitted draws are (64 bit sort key, object) pairs sorted each frame with a parallel LSD radix sort, 8 bits per
+// pass: every worker histograms its chunk, a prefix sum over (digit, chunk) gives each chunk its scatter offsets and the
+// workers scatter in parallel, keeping the sort stable. Digits that are equal across the whole queue (e.g. a single pass
+// and program) are skipped.
+//
+// Key layout, most significant first:
+//	pass 4 bits | program 8 bits | view depth 24 bits | mesh 20 bits | 8 bits unused
+//
+// Changing mesh inside one multi-draw call costs nothing, so view depth outranks mesh and opaque draws come out front
+// to back.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "parallel.hpp"
+
+constexpr const int RENDER_KEY_PASS_SHIFT = 60;
+constexpr const int RENDER_KEY_PROGRAM_SHIFT = 52;
+constexpr const int RENDER_KEY_DEPTH_SHIFT = 28;
+constexpr const int RENDER_KEY_MESH_SHIFT = 8;
+// Queues shorter than this per worker are sorted on the calling thread
+constexpr const size_t RENDER_QUEUE_MIN_CHUNK = 32768;
+
+// View depth (distance along the view direction) is mapped through d / (d + 1) so no far plane is needed, negative
+// depths (behind the camera) sort first
+inline uint64_t makeRenderKey(uint32_t pass, uint32_t program, float viewDepth, uint32_t mesh) {
+	float depth = std::max(viewDepth, 0.0f);
+	uint64_t quantisedDepth = (uint64_t)(depth / (depth + 1.0f) * (float)((1 << 24) - 1));
+	return (uint64_t)(pass & 0xF) << RENDER_KEY_PASS_SHIFT
+		| (uint64_t)(program & 0xFF) << RENDER_KEY_PROGRAM_SHIFT
+		| quantisedDepth << RENDER_KEY_DEPTH_SHIFT
+		| (uint64_t)(mesh & 0xFFFFF) << RENDER_KEY_MESH_SHIFT;
+}
+
+class RenderQueue {
+	std::vector<uint64_t> keys, keysScratch;
+	std::vector<uint32_t> objects, objectsScratch;
+	std::vector<std::array<uint32_t, 256>> histograms;
+	std::vector<uint64_t> chunkDiffering;
+	int lastSortPasses = 0;
+
+public:
+	void clear() {
+		keys.clear();
+		objects.clear();
+	}
+
+	// Sized up front so workers can fill entries in place
+	void resize(size_t count) {
+		keys.resize(count);
+		objects.resize(count);
+	}
+
+	void push(uint64_t key, uint32_t object) {
+		keys.push_back(key);
+		objects.push_back(object);
+	}
+
+	size_t size() const {
+		return keys.size();
+	}
+
+	uint64_t* keyData() {
+		return keys.data();
+	}
+
+	uint32_t* objectData() {
+		return objects.data();
+	}
+
+	// Objects in key order after sort()
+	const std::vector<uint32_t>& sortedObjects() const {
+		return objects;
+	}
+
+	// Digit passes the last sort() needed
+	int sortPasses() const {
+		return lastSortPasses;
+	}
+
+	void sort() {
+		lastSortPasses = 0;
+		size_t count = keys.size();
+		if (count < 2) return;
+
+		keysScratch.resize(count);
+		objectsScratch.resize(count);
+
+		size_t chunks = std::min<size_t>(workerCount(), std::max<size_t>(1, count / RENDER_QUEUE_MIN_CHUNK));
+		size_t chunkSize = (count + chunks - 1) / chunks;
+		histograms.resize(chunks);
+
+		// Bits that differ from the first key somewhere
+		chunkDiffering.assign(chunks, 0);
+		parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+			for (size_t c=begin; c<end; c++) {
+				const uint64_t* chunkKeys = keys.data();
+				uint64_t first = chunkKeys[0], bits = 0;
+				for (size_t i=c*chunkSize, last=std::min(count, (c + 1)*chunkSize); i<last; i++) bits |= chunkKeys[i] ^ first;
+				chunkDiffering[c] = bits;
+			}
+		});
+		uint64_t differing = 0;
+		for (auto bits : chunkDiffering) differing |= bits;
+
+		for (int shift=0; shift<64; shift+=8) {
+			if (((differing >> shift) & 0xFF) == 0) continue;
+
+			const uint64_t* sourceKeys = keys.data();
+			const uint32_t* sourceObjects = objects.data();
+			uint64_t* destinationKeys = keysScratch.data();
+			uint32_t* destinationObjects = objectsScratch.data();
+
+			parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+				for (size_t c=begin; c<end; c++) {
+					uint32_t* histogram = histograms[c].data();
+					std::fill(histogram, histogram + 256, 0);
+					for (size_t i=c*chunkSize, last=std::min(count, (c + 1)*chunkSize); i<last; i++) histogram[(sourceKeys[i] >> shift) & 0xFF]++;
+				}
+			});
+
+			// Digit major, then chunk: each chunk scatters after the earlier chunks' keys with the same digit
+			uint32_t offset = 0;
+			for (int digit=0; digit<256; digit++)
+				for (size_t c=0; c<chunks; c++) {
+					uint32_t digitCount = histograms[c][digit];
+					histograms[c][digit] = offset;
+					offset += digitCount;
+				}
+
+			parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+				for (size_t c=begin; c<end; c++) {
+					uint32_t* offsets = histograms[c].data();
+					for (size_t i=c*chunkSize, last=std::min(count, (c + 1)*chunkSize); i<last; i++) {
+						uint32_t destination = offsets[(sourceKeys[i] >> shift) & 0xFF]++;
+						destinationKeys[destination] = sourceKeys[i];
+						destinationObjects[destination] = sourceObjects[i];
+					}
+				}
+			});
+
+			keys.swap(keysScratch);
+			objects.swap(objectsScratch);
+			lastSortPasses++;
+		}
+	}
+};
+
+// Queues objects for one pass and program keyed by view depth (position along forward from the camera) and mesh,
+// sorts them and writes the order back over objects
+inline void sortByRenderKey(RenderQueue& queue, uint32_t* objects, size_t count, const float* positions, const uint32_t* meshes,
+	const float cameraPosition[3], const float forward[3], uint32_t pass, uint32_t program) {
+	queue.clear();
+	queue.resize(count);
+	uint64_t* keys = queue.keyData();
+	uint32_t* queued = queue.objectData();
+	parallelFor(count, RENDER_QUEUE_MIN_CHUNK, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			uint32_t object = objects[i];
+			const float* position = &positions[(size_t)object*3];
+			float viewDepth = (position[0] - cameraPosition[0]) * forward[0] + (position[1] - cameraPosition[1]) * forward[1] + (position[2] - cameraPosition[2]) * forward[2];
+			keys[i] = makeRenderKey(pass, program, viewDepth, meshes[object]);
+			queued[i] = object;
+		}
+	});
+
+	queue.sort();
+	auto& sorted = queue.sortedObjects();
+	std::copy(sorted.begin(), sorted.end(), objects);
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+// Binary scene format (.mdis)
+//
+// Little-endian, every section starts on a SCENE_SECTION_ALIGNMENT boundary so a mapped file can be handed to
+// glBufferData section by section with no parsing:
+//
+//	header | vertices (6 floats: position, normal) | meshes | object positions | object colors | object meshes | lights
+//
+// Objects are stored as SoA tables so each table uploads as its own tightly packed vertex attribute stream,
+// lights are stored in the std140 layout of deferred.fs's LightsBlock.
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+
+constexpr const char SCENE_MAGIC[4] = {'M', 'D', 'I', 'S'};
+constexpr const uint32_t SCENE_VERSION = 1;
+constexpr const uint64_t SCENE_SECTION_ALIGNMENT = 64;
+constexpr const unsigned int SCENE_FLOATS_PER_VERTEX = 6;
+
+enum SceneSectionId {
+	SCENE_SECTION_VERTICES,
+	SCENE_SECTION_MESHES,
+	SCENE_SECTION_OBJECT_POSITIONS,
+	SCENE_SECTION_OBJECT_COLORS,
+	SCENE_SECTION_OBJECT_MESHES,
+	SCENE_SECTION_LIGHTS,
+	SCENE_SECTION_COUNT
+};
+
+struct SceneSection {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t count;
+};
+
+struct SceneFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t sectionCount;
+	uint64_t fileSize;
+	SceneSection sections[SCENE_SECTION_COUNT];
+};
+
+struct SceneMesh {
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+};
+
+// Padded to align with std140 layout rules of Light in deferred.fs: https://learnopengl.com/Advanced-OpenGL/Advanced-GLSL
+struct SceneLight {			
+	//							Base alignment		aligned offset
+	float position[3];		// 	16 					0
+	float paddingPos;		// 						(12 [+4])
+	float color[3];			//	16 					16
+	float power;			//	4 					28
+};
+
+static_assert(sizeof(SceneMesh) == 8, "SceneMesh must be tightly packed");
+static_assert(sizeof(SceneLight) == 32, "SceneLight must match the std140 Light layout");
+
+inline uint64_t sceneElementSize(SceneSectionId section) {
+	switch (section) {
+		case SCENE_SECTION_VERTICES: return sizeof(float) * SCENE_FLOATS_PER_VERTEX;
+		case SCENE_SECTION_MESHES: return sizeof(SceneMesh);
+		case SCENE_SECTION_OBJECT_POSITIONS: return sizeof(float) * 3;
+		case SCENE_SECTION_OBJECT_COLORS: return sizeof(float) * 3;
+		case SCENE_SECTION_OBJECT_MESHES: return sizeof(uint32_t);
+		case SCENE_SECTION_LIGHTS: return sizeof(SceneLight);
+		default: return 0;
+	}
+}
+
+// ========================================
+// Scene view
+
+// Non-owning view of a scene, backed by either a SceneData or a MappedScene
+struct SceneView {
+	const float* vertices = nullptr;	// SCENE_FLOATS_PER_VERTEX floats per vertex
+	uint64_t vertexCount = 0;
+	const SceneMesh* meshes = nullptr;
+	uint64_t meshCount = 0;
+
+	const float* objectPositions = nullptr;	// 3 floats per object
+	const float* objectColors = nullptr;		// 3 floats per object
+	const uint32_t* objectMeshes = nullptr;
+	uint64_t objectCount = 0;
+
+	const SceneLight* lights = nullptr;
+	uint64_t lightCount = 0;
+};
+
+// In memory scene, used to generate scenes and as the fallback when no scene file is given
+struct SceneData {
+	std::vector<float> vertices;
+	std::vector<SceneMesh> meshes;
+
+	std::vector<float> objectPositions;
+	std::vector<float> objectColors;
+	std::vector<uint32_t> objectMeshes;
+
+	std::vector<SceneLight> lights;
+
+	uint32_t addMesh(const std::vector<float>& meshVertices) {
+		SceneMesh mesh {(uint32_t)(vertices.size() / SCENE_FLOATS_PER_VERTEX), (uint32_t)(meshVertices.size() / SCENE_FLOATS_PER_VERTEX)};
+		vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+		meshes.push_back(mesh);
+		return (uint32_t)meshes.size() - 1;
+	}
+
+	void addObject(uint32_t mesh, float x, float y, float z, float r, float g, float b) {
+		objectPositions.insert(objectPositions.end(), {x, y, z});
+		objectColors.insert(objectColors.end(), {r, g, b});
+		objectMeshes.push_back(mesh);
+	}
+
+	SceneView view() const {
+		SceneView scene;
+		scene.vertices = vertices.data();
+		scene.vertexCount = vertices.size() / SCENE_FLOATS_PER_VERTEX;
+		scene.meshes = meshes.data();
+		scene.meshCount = meshes.size();
+		scene.objectPositions = objectPositions.data();
+		scene.objectColors = objectColors.data();
+		scene.objectMeshes = objectMeshes.data();
+		scene.objectCount = objectMeshes.size();
+		scene.lights = lights.data();
+		scene.lightCount = lights.size();
+		return scene;
+	}
+};
+
+// ========================================
+// Validation
+
+inline const void* sceneSectionData(const SceneView& scene, SceneSectionId section) {
+	switch (section) {
+		case SCENE_SECTION_VERTICES: return scene.vertices;
+		case SCENE_SECTION_MESHES: return scene.meshes;
+		case SCENE_SECTION_OBJECT_POSITIONS: return scene.objectPositions;
+		case SCENE_SECTION_OBJECT_COLORS: return scene.objectColors;
+		case SCENE_SECTION_OBJECT_MESHES: return scene.objectMeshes;
+		case SCENE_SECTION_LIGHTS: return scene.lights;
+		default: return nullptr;
+	}
+}
+
+inline uint64_t sceneSectionCount(const SceneView& scene, SceneSectionId section) {
+	switch (section) {
+		case SCENE_SECTION_VERTICES: return scene.vertexCount;
+		case SCENE_SECTION_MESHES: return scene.meshCount;
+		case SCENE_SECTION_OBJECT_POSITIONS: return scene.objectCount;
+		case SCENE_SECTION_OBJECT_COLORS: return scene.objectCount;
+		case SCENE_SECTION_OBJECT_MESHES: return scene.objectCount;
+		case SCENE_SECTION_LIGHTS: return scene.lightCount;
+		default: return 0;
+	}
+}
+
+// Checks the header and section table against the file size, returns an error message or "" if valid.
+// Cheap enough to run on every load
+inline std::string validateSceneHeader(const void* data, uint64_t size) {
+	if (size < sizeof(SceneFileHeader)) return "file is smaller than the scene header";
+
+	SceneFileHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	if (std::memcmp(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC)) != 0) return "not a scene file (bad magic)";
+	if (header.version != SCENE_VERSION) return "unsupported scene version " + std::to_string(header.version) + " (expected " + std::to_string(SCENE_VERSION) + ")";
+	if (header.headerSize != sizeof(SceneFileHeader)) return "unexpected header size " + std::to_string(header.headerSize);
+	if (header.sectionCount != SCENE_SECTION_COUNT) return "unexpected section count " + std::to_string(header.sectionCount);
+	if (header.fileSize != size) return "header file size " + std::to_string(header.fileSize) + " doesn't match actual size " + std::to_string(size);
+
+	for (int i=0; i<SCENE_SECTION_COUNT; i++) {
+		auto& section = header.sections[i];
+		auto name = "section " + std::to_string(i);
+		if (section.offset % SCENE_SECTION_ALIGNMENT != 0) return name + " is not aligned to " + std::to_string(SCENE_SECTION_ALIGNMENT) + " bytes";
+		if (section.offset < sizeof(SceneFileHeader) || section.offset > size || section.size > size - section.offset) return name + " lies outside the file";
+		if (section.count > UINT64_MAX / sceneElementSize((SceneSectionId)i) || section.size != section.count * sceneElementSize((SceneSectionId)i)) return name + " size doesn't match its element count";
+	}
+
+	auto objectCount = header.sections[SCENE_SECTION_OBJECT_POSITIONS].count;
+	if (header.sections[SCENE_SECTION_OBJECT_COLORS].count != objectCount || header.sections[SCENE_SECTION_OBJECT_MESHES].count != objectCount)
+		return "object tables have different lengths";
+	if (header.sections[SCENE_SECTION_VERTICES].count > UINT32_MAX) return "too many vertices for 32 bit draw commands";
+
+	return "";
+}
+
+// Checks every mesh and object reference, returns an error message or "" if valid. Linear in scene size
+inline std::string validateSceneContents(const SceneView& scene) {
+	for (uint64_t i=0; i<scene.meshCount; i++) {
+		auto& mesh = scene.meshes[i];
+		if ((uint64_t)mesh.firstVertex + mesh.vertexCount > scene.vertexCount) return "mesh " + std::to_string(i) + " references vertices outside the vertex table";
+		if (mesh.vertexCount % 3 != 0) return "mesh " + std::to_string(i) + " vertex count is not a multiple of 3";
+	}
+	for (uint64_t i=0; i<scene.objectCount; i++) {
+		if (scene.objectMeshes[i] >= scene.meshCount) return "object " + std::to_string(i) + " references missing mesh " + std::to_string(scene.objectMeshes[i]);
+	}
+	return "";
+}
+
+// ========================================
+// Writer
+
+inline std::string writeScene(const std::string& path, const SceneView& scene) {
+	SceneFileHeader header {};
+	std::memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+	header.version = SCENE_VERSION;
+	header.headerSize = sizeof(SceneFileHeader);
+	header.sectionCount = SCENE_SECTION_COUNT;
+
+	uint64_t offset = sizeof(SceneFileHeader);
+	for (int i=0; i<SCENE_SECTION_COUNT; i++) {
+		offset = (offset + SCENE_SECTION_ALIGNMENT - 1) / SCENE_SECTION_ALIGNMENT * SCENE_SECTION_ALIGNMENT;
+		auto& section = header.sections[i];
+		section.offset = offset;
+		section.count = sceneSectionCount(scene, (SceneSectionId)i);
+		section.size = section.count * sceneElementSize((SceneSectionId)i);
+		offset += section.size;
+	}
+	header.fileSize = offset;
+
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file) return "couldn't open " + path + " for writing";
+
+	static const char padding[SCENE_SECTION_ALIGNMENT] = {};
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	uint64_t written = sizeof(header);
+	for (int i=0; i<SCENE_SECTION_COUNT && ok; i++) {
+		auto& section = header.sections[i];
+		ok = std::fwrite(padding, 1, section.offset - written, file) == section.offset - written;
+		if (section.size) ok = ok && std::fwrite(sceneSectionData(scene, (SceneSectionId)i), 1, section.size, file) == section.size;
+		written = section.offset + section.size;
+	}
+
+	ok = std::fclose(file) == 0 && ok;
+	return ok ? "" : "failed writing " + path;
+}
+
+// ========================================
+// Mapped scene
+
+// Read-only memory mapping of a scene file, the SceneView points straight into the mapping
+class MappedScene {
+	MappedFile file;
+	SceneView sceneView;
+
+public:
+	// Maps and validates the header and every mesh/object reference (one linear pass, nothing is copied), returns an
+	// error message or "" on success. Only skip the reference check for files this program just wrote.
+	std::string open(const std::string& path, bool validateContents = true) {
+		close();
+		auto error = file.open(path);
+		if (error.empty()) error = validateSceneHeader(file.data(), file.size());
+		if (!error.empty()) {
+			close();
+			return error;
+		}
+
+		SceneFileHeader header;
+		std::memcpy(&header, file.data(), sizeof(header));
+		auto section = [&](SceneSectionId id) { return file.data() + header.sections[id].offset; };
+
+		sceneView.vertices = (const float*)section(SCENE_SECTION_VERTICES);
+		sceneView.vertexCount = header.sections[SCENE_SECTION_VERTICES].count;
+		sceneView.meshes = (const SceneMesh*)section(SCENE_SECTION_MESHES);
+		sceneView.meshCount = header.sections[SCENE_SECTION_MESHES].count;
+		sceneView.objectPositions = (const float*)section(SCENE_SECTION_OBJECT_POSITIONS);
+		sceneView.objectColors = (const float*)section(SCENE_SECTION_OBJECT_COLORS);
+		sceneView.objectMeshes = (const uint32_t*)section(SCENE_SECTION_OBJECT_MESHES);
+		sceneView.objectCount = header.sections[SCENE_SECTION_OBJECT_MESHES].count;
+		sceneView.lights = (const SceneLight*)section(SCENE_SECTION_LIGHTS);
+		sceneView.lightCount = header.sections[SCENE_SECTION_LIGHTS].count;
+
+		if (validateContents) error = validateSceneContents(sceneView);
+		if (!error.empty()) close();
+		return error;
+	}
+
+	void close() {
+		file.close();
+		sceneView = SceneView();
+	}
+
+	const SceneView& view() const {
+		return sceneView;
+	}
+
+	uint64_t fileSize() const {
+		return file.size();
+	}
+};
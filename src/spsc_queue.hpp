@@ -0,0 +1,46 @@
+#pragma once
+
+// Bounded single producer / single consumer queue
+//
+// One thread pushes, one other thread pops, neither blocks or locks. The producer owns tail and the consumer owns head,
+// each only reads the other's index (acquire) to check for space or items, and publishes its own (release) after
+// touching the slot, so the slot's contents are visible before the index that hands it over. The indices sit on
+// separate cache lines so the two threads don't false share.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+template <typename T, size_t Capacity>
+class SpscQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+	std::array<T, Capacity> slots {};
+	alignas(64) std::atomic<size_t> head {0};	// Next slot to pop
+	alignas(64) std::atomic<size_t> tail {0};	// Next slot to push
+
+public:
+	// Producer only, value is left untouched when the queue is full
+	bool tryPush(T&& value) {
+		size_t position = tail.load(std::memory_order_relaxed);
+		if (position - head.load(std::memory_order_acquire) == Capacity) return false;
+		slots[position & (Capacity - 1)] = std::move(value);
+		tail.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only
+	bool tryPop(T& out) {
+		size_t position = head.load(std::memory_order_relaxed);
+		if (position == tail.load(std::memory_order_acquire)) return false;
+		out = std::move(slots[position & (Capacity - 1)]);
+		head.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Approximate unless called from the producer or consumer with the other idle
+	size_t size() const {
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+// Draw submission queues
+//
+// Any thread can submit object slots: each thread appends to its own queue (found through a thread_local lookup, a
+// mutex is only taken the first time a thread submits), so submitting never contends. merge() concatenates the queues
+// into one list: a prefix sum over the queue sizes gives every queue its offset and the queues are copied in parallel.
+//
+// merge() must not run while threads are still submitting for the frame, the caller provides that ordering (joining
+// the submitting threads, a frame barrier). The merged order is queue registration order, not submission order.
+//
+// A queue is handed back when its thread exits and reused by the next thread to register once its contents have been
+// merged, so threads spawned per frame don't grow the number of queues.
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "parallel.hpp"
+
+// Merges smaller than this copy on the calling thread
+constexpr const size_t SUBMISSION_MERGE_MIN_PARALLEL = 65536;
+
+class SubmissionQueues {
+	// Own cache line so neighbouring threads' pushes don't false share
+	struct alignas(64) ThreadQueue {
+		std::vector<uint32_t> objects;
+		bool released = false;	// Owning thread exited, not yet on the free list
+	};
+
+	struct State {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadQueue>> queues;
+		std::vector<ThreadQueue*> freeQueues;	// Released and merged
+	};
+
+	// Per thread, the queue this thread uses for each SubmissionQueues it has submitted to. Holds the state alive so a
+	// thread outliving its SubmissionQueues can still hand its queue back
+	struct ThreadQueues {
+		std::vector<std::pair<std::shared_ptr<State>, ThreadQueue*>> queues;
+
+		~ThreadQueues() {
+			for (auto& [state, queue] : queues) {
+				std::lock_guard<std::mutex> lock(state->mutex);
+				queue->released = true;
+			}
+		}
+	};
+
+	std::shared_ptr<State> state = std::make_shared<State>();
+	std::vector<size_t> offsets;
+
+	ThreadQueue* registerQueue() {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		if (!state->freeQueues.empty()) {
+			ThreadQueue* queue = state->freeQueues.back();
+			state->freeQueues.pop_back();
+			return queue;
+		}
+		state->queues.push_back(std::make_unique<ThreadQueue>());
+		return state->queues.back().get();
+	}
+
+public:
+	// The calling thread's queue, push_back onto it directly to skip the lookup per object
+	std::vector<uint32_t>& local() {
+		static thread_local ThreadQueues threadQueues;
+		for (auto& [queueState, queue] : threadQueues.queues)
+			if (queueState == state) return queue->objects;
+
+		ThreadQueue* queue = registerQueue();
+		threadQueues.queues.emplace_back(state, queue);
+		return queue->objects;
+	}
+
+	void submit(uint32_t object) {
+		local().push_back(object);
+	}
+
+	// Queues created so far, bounded by the most threads submitting at once
+	size_t queueCount() {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		return state->queues.size();
+	}
+
+	// Replaces out with every queue's objects and empties the queues (keeping their capacity)
+	void merge(std::vector<uint32_t>& out) {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		auto& queues = state->queues;
+
+		offsets.resize(queues.size() + 1);
+		offsets[0] = 0;
+		for (size_t q=0; q<queues.size(); q++) offsets[q + 1] = offsets[q] + queues[q]->objects.size();
+		size_t total = offsets.back();
+		out.resize(total);
+
+		auto copyQueues = [&](size_t begin, size_t end) {
+			for (size_t q=begin; q<end; q++) {
+				auto& objects = queues[q]->objects;
+				std::copy(objects.begin(), objects.end(), out.begin() + offsets[q]);
+				objects.clear();
+			}
+		};
+		if (total < SUBMISSION_MERGE_MIN_PARALLEL) copyQueues(0, queues.size());
+		else parallelFor(queues.size(), 1, copyQueues);
+
+		for (auto& queue : queues)
+			if (queue->released) {
+				queue->released = false;
+				state->freeQueues.push_back(queue.get());
+			}
+	}
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+// Rolling timing statistics
+//
+// Keeps the last TIMING_WINDOW samples of a timed section (a GPU pass, a CPU zone) and summarises them as average,
+// percentiles and max. Summaries of named sections can be written out as CSV or JSON.
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+constexpr const size_t TIMING_WINDOW = 256;
+
+struct TimingSummary {
+	double lastMs = 0.0;
+	double averageMs = 0.0;
+	double p50Ms = 0.0;
+	double p95Ms = 0.0;
+	double p99Ms = 0.0;
+	double maxMs = 0.0;
+	uint32_t samples = 0;	// In the window
+};
+
+class RollingTimings {
+	std::vector<double> window;
+	size_t next = 0;
+	double lastMs = 0.0;
+	mutable std::vector<double> sorted;
+
+public:
+	void add(double ms) {
+		if (window.size() < TIMING_WINDOW) window.push_back(ms);
+		else window[next] = ms;
+		next = (next + 1) % TIMING_WINDOW;
+		lastMs = ms;
+	}
+
+	double last() const {
+		return lastMs;
+	}
+
+	TimingSummary summary() const {
+		TimingSummary summary;
+		summary.lastMs = lastMs;
+		summary.samples = (uint32_t)window.size();
+		if (window.empty()) return summary;
+
+		sorted = window;
+		std::sort(sorted.begin(), sorted.end());
+		auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5))]; };
+		double total = 0.0;
+		for (auto ms : sorted) total += ms;
+		summary.averageMs = total / sorted.size();
+		summary.p50Ms = percentile(0.50);
+		summary.p95Ms = percentile(0.95);
+		summary.p99Ms = percentile(0.99);
+		summary.maxMs = sorted.back();
+		return summary;
+	}
+
+	void clear() {
+		window.clear();
+		next = 0;
+		lastMs = 0.0;
+	}
+};
+
+inline void writeTimingsCsv(std::ostream& out, const std::vector<std::pair<std::string, TimingSummary>>& timings) {
+	out << "name,samples,last_ms,average_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+	for (auto& [name, summary] : timings)
+		out << name << "," << summary.samples << "," << summary.lastMs << "," << summary.averageMs << "," << summary.p50Ms << ","
+			<< summary.p95Ms << "," << summary.p99Ms << "," << summary.maxMs << "\n";
+}
+
+// Names are written as is, they are expected to be plain identifiers
+inline void writeTimingsJson(std::ostream& out, const std::vector<std::pair<std::string, TimingSummary>>& timings) {
+	out << "{\n\t\"timings\": [\n";
+	for (size_t i=0; i<timings.size(); i++) {
+		auto& [name, summary] = timings[i];
+		out << "\t\t{\"name\": \"" << name << "\", \"samples\": " << summary.samples << ", \"last_ms\": " << summary.lastMs
+			<< ", \"average_ms\": " << summary.averageMs << ", \"p50_ms\": " << summary.p50Ms << ", \"p95_ms\": " << summary.p95Ms
+			<< ", \"p99_ms\": " << summary.p99Ms << ", \"max_ms\": " << summary.maxMs << "}" << (i + 1 < timings.size() ? "," : "") << "\n";
+	}
+	out << "\t]\n}\n";
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// GPU vertex formats
+//
+//	FLOAT:		position xyz float, normal xyz float (24 bytes), the scene format as is
+//	QUANTISED:	position xyzw snorm16 relative to its mesh's AABB, normal GL_INT_2_10_10_10_REV snorm (12 bytes)
+//
+// Quantised positions are decoded in gbuffer.vs as center + position * halfExtent with the mesh's MeshQuantisation,
+// which is looked up through the per-object mesh index. Generated vertices (LOD levels, meshlets) stay within their
+// mesh's bounds so they share its quantisation.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "scene_format.hpp"
+
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT,
+	VERTEX_FORMAT_QUANTISED
+};
+
+inline const char* vertexFormatName(VertexFormat format) {
+	return format == VERTEX_FORMAT_QUANTISED ? "snorm16 + 10:10:10:2" : "float";
+}
+
+struct QuantisedVertex {
+	int16_t position[4];	// w unused, keeps the normal 4 byte aligned
+	uint32_t normal;
+};
+
+// std430 layout of MeshQuantisation in gbuffer.vs
+struct MeshQuantisation {
+	float center[3];
+	float paddingCenter;
+	float halfExtent[3];
+	float paddingExtent;
+};
+
+static_assert(sizeof(QuantisedVertex) == 12, "QuantisedVertex must be tightly packed");
+static_assert(sizeof(MeshQuantisation) == 32, "MeshQuantisation must match the std430 layout");
+
+inline uint64_t vertexFormatSize(VertexFormat format) {
+	return format == VERTEX_FORMAT_QUANTISED ? sizeof(QuantisedVertex) : sizeof(float) * SCENE_FLOATS_PER_VERTEX;
+}
+
+inline MeshQuantisation computeMeshQuantisation(const float* vertices, uint64_t vertexCount) {
+	float boundsMin[3] = {0.0f, 0.0f, 0.0f}, boundsMax[3] = {0.0f, 0.0f, 0.0f};
+	for (uint64_t v=0; v<vertexCount; v++)
+		for (int axis=0; axis<3; axis++) {
+			float p = vertices[v*SCENE_FLOATS_PER_VERTEX + axis];
+			boundsMin[axis] = v == 0 ? p : std::min(boundsMin[axis], p);
+			boundsMax[axis] = v == 0 ? p : std::max(boundsMax[axis], p);
+		}
+
+	MeshQuantisation quantisation {};
+	for (int axis=0; axis<3; axis++) {
+		quantisation.center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		// Flat axes still need a non-zero scale to divide by
+		quantisation.halfExtent[axis] = std::max((boundsMax[axis] - boundsMin[axis]) * 0.5f, 1e-20f);
+	}
+	return quantisation;
+}
+
+inline int16_t packSnorm16(float value) {
+	return (int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// x in bits 0-9, y 10-19, z 20-29, each a signed normalised 10 bit value
+inline uint32_t packSnorm1010102(float x, float y, float z) {
+	auto pack = [](float value) { return (uint32_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 511.0f) & 0x3FF; };
+	return pack(x) | pack(y) << 10 | pack(z) << 20;
+}
+
+inline void quantiseVertices(const float* vertices, uint64_t vertexCount, const MeshQuantisation& quantisation, QuantisedVertex* out) {
+	for (uint64_t v=0; v<vertexCount; v++) {
+		const float* vertex = vertices + v*SCENE_FLOATS_PER_VERTEX;
+		for (int axis=0; axis<3; axis++) out[v].position[axis] = packSnorm16((vertex[axis] - quantisation.center[axis]) / quantisation.halfExtent[axis]);
+		out[v].position[3] = 0;
+
+		// Normals are normalised first so every component fits in [-1, 1]
+		float length = std::sqrt(vertex[3]*vertex[3] + vertex[4]*vertex[4] + vertex[5]*vertex[5]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		out[v].normal = packSnorm1010102(vertex[3] * scale, vertex[4] * scale, vertex[5] * scale);
+	}
+}
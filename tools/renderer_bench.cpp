@@ -0,0 +1,476 @@
+// CPU side renderer benchmarks: the per-frame hot paths run over grid scenes of 1k to 8M objects, without GL
+//
+//	renderer_bench [--benchmark_filter=regex] [other Google Benchmark flags]
+//
+//	SceneBuild	The CPU side of the demo's startup (scene, pool, BVH, LODs and meshlets), each step as a counter
+//	Aggregate	Object::draw() submissions from worker threads merged into one list, as in drawDispatched()
+//	Cull		BVH frustum cull from the demo camera
+//	Commands	Draw command generation with LOD selection (src/draw_commands.hpp) over the visible objects
+//	Lights		Per-object light lists built from a BVH sphere query per light
+//	SortKeys	Render keys and the radix sort over the visible objects (sortByRenderKey(), src/render_queue.hpp)
+//	Uploads		A frame's buffer writes against a mock GL layer: dirty slot runs (src/object_uploads.hpp), rotations,
+//				commands, camera block
+//	Uniforms	The same per-object data set through one glUniform call per attribute per object, for comparison
+//	Frame		Steady state CPU frame (spin, submit, merge, cull into the frame allocator, sort, rotations, commands),
+//				fails the run if it makes any heap allocation once warmed up
+//
+// Every hot path calls the same code as the demo, only GL and the glue between steps are local. The argument is the
+// object count. Scenes are built untimed on first use and shared until a benchmark asks for another count, along with
+// the visible list and commands the later hot paths start from.
+
+#include <string>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "grid_scene.hpp"
+#include "bvh.hpp"
+#include "mesh_lod.hpp"
+#include "meshlet.hpp"
+#include "object_pool.hpp"
+#include "object_uploads.hpp"
+#include "draw_commands.hpp"
+#include "render_queue.hpp"
+#include "submission_queue.hpp"
+#include "frame_allocator.hpp"
+#include "allocation_counter.hpp"
+
+#include <benchmark/benchmark.h>
+#include <extern/glm/glm.hpp>
+#include <extern/glm/gtc/matrix_transform.hpp>
+#include <extern/glm/gtc/type_ptr.hpp>
+
+// ========================================
+// Mock GL
+
+// Buffer storage and uniforms in plain memory. Entry points are called through function pointers like glad's, so the
+// compiler can't inline or drop them and every call keeps the cost of an opaque call into the driver
+namespace mockGl {
+	std::vector<std::vector<unsigned char>> buffers;
+	float uniforms[64][4];
+	uint64_t calls = 0;
+	uint64_t bytes = 0;
+
+	unsigned int genBuffer(size_t size) {
+		buffers.emplace_back(size);
+		return (unsigned int)buffers.size() - 1;
+	}
+
+	// Stands in for a persistent mapping
+	void* mapped(unsigned int buffer) {
+		return buffers[buffer].data();
+	}
+
+	void bufferSubDataImpl(unsigned int buffer, size_t offset, size_t size, const void* data) {
+		calls++;
+		bytes += size;
+		std::memcpy(buffers[buffer].data() + offset, data, size);
+	}
+
+	void uniform4fvImpl(int location, const float* value) {
+		calls++;
+		bytes += sizeof(float) * 4;
+		std::memcpy(uniforms[location], value, sizeof(float) * 4);
+	}
+
+	void (*volatile bufferSubData)(unsigned int, size_t, size_t, const void*) = bufferSubDataImpl;
+	void (*volatile uniform4fv)(int, const float*) = uniform4fvImpl;
+
+	void reset() {
+		buffers.clear();
+		calls = bytes = 0;
+	}
+
+	// GlBuffer's update() interface for the shared upload code
+	struct Buffer {
+		unsigned int name;
+
+		void update(size_t offset, size_t size, const void* data) {
+			bufferSubData(name, offset, size, data);
+		}
+	};
+}
+
+// ========================================
+// Camera
+
+// The demo camera: at the origin looking down +z at the grid
+const glm::vec3 CAMERA_POSITION(0.0f);
+const glm::vec3 CAMERA_FORWARD(0.0f, 0.0f, 1.0f);
+const glm::mat4 CAMERA_VIEW = glm::lookAt(CAMERA_POSITION, CAMERA_POSITION + CAMERA_FORWARD, glm::vec3(0.0f, 1.0f, 0.0f));
+const glm::mat4 CAMERA_PROJECTION = glm::perspective<float>(45.0f, 1400.0f/900.0f, 0.1f, 300.0f);
+
+Frustum cameraFrustum() {
+	return Frustum(glm::value_ptr(CAMERA_PROJECTION * CAMERA_VIEW));
+}
+
+// LOD selection and meshlet culling on, as the demo starts
+DrawCommandSettings cameraCommandSettings(const Frustum& frustum) {
+	return {
+		{CAMERA_POSITION.x, CAMERA_POSITION.y, CAMERA_POSITION.z},
+		&frustum,
+		CAMERA_PROJECTION[1][1] * 900.0f * 0.5f,
+		1.0f,
+		true,
+		true,
+	};
+}
+
+
+// ========================================
+// Scenes
+
+// One object count's scene, the renderer side state built from it and the frame results the hot paths start from
+struct BenchScene {
+	uint64_t objectCount = 0;
+	SceneData scene;
+	ObjectPool pool;
+	Bvh bvh;
+	MeshLodRegistry meshLods;
+	MeshletRegistry meshlets;
+	std::vector<ObjectHandle> handles;
+
+	std::vector<uint32_t> visible;
+	std::vector<DrawArraysIndirectCommand> commands;
+};
+
+// Time spent in each step of buildScene()
+struct BuildTimes {
+	double sceneMs, poolMs, bvhMs, meshesMs, framesMs;
+};
+
+std::unique_ptr<BenchScene> g_benchScene;
+
+// The grid closest to a cube with exactly objectCount objects
+void gridDimensions(uint64_t objectCount, unsigned int dimensions[3]) {
+	auto largestDivisorAtMost = [](uint64_t n, uint64_t limit) {
+		uint64_t divisor = std::max<uint64_t>(1, std::min(n, limit));
+		while (n % divisor) divisor--;
+		return divisor;
+	};
+	dimensions[0] = (unsigned int)largestDivisorAtMost(objectCount, (uint64_t)std::ceil(std::cbrt((double)objectCount)));
+	uint64_t rest = objectCount / dimensions[0];
+	dimensions[1] = (unsigned int)largestDivisorAtMost(rest, (uint64_t)std::ceil(std::sqrt((double)rest)));
+	dimensions[2] = (unsigned int)(rest / dimensions[1]);
+}
+
+// Replaces the shared scene, the old one is freed first so only one large scene is ever held
+BuildTimes buildScene(uint64_t objectCount) {
+	BuildTimes times;
+	g_benchScene.reset();
+	g_benchScene = std::make_unique<BenchScene>();
+	BenchScene& bench = *g_benchScene;
+	bench.objectCount = objectCount;
+
+	auto lap = std::chrono::steady_clock::now();
+	auto lapMs = [&]() {
+		auto now = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(now - lap).count();
+		lap = now;
+		return ms;
+	};
+
+	unsigned int dimensions[3];
+	gridDimensions(objectCount, dimensions);
+	bench.scene = generateGridScene(dimensions[0], dimensions[1], dimensions[2], 1000, 0);
+	auto view = bench.scene.view();
+	times.sceneMs = lapMs();
+
+	bench.pool.init(view, 0, 1.0f);
+	bench.handles.resize(view.objectCount);
+	for (uint32_t i=0; i<(uint32_t)view.objectCount; i++) bench.handles[i] = {i, 0};
+	times.poolMs = lapMs();
+
+	bench.bvh.build(bench.pool.bounds);
+	times.bvhMs = lapMs();
+
+	bench.meshLods = buildMeshLods(view);
+	bench.meshlets = buildMeshlets(view, view.vertexCount + bench.meshLods.vertices.size() / SCENE_FLOATS_PER_VERTEX);
+	times.meshesMs = lapMs();
+
+	Frustum frustum = cameraFrustum();
+	bench.bvh.cullFrustum(frustum, bench.visible);
+	DrawCommandStats stats;
+	generateDrawCommands(bench.visible.data(), bench.visible.size(), bench.pool.meshes.data(), bench.pool.positions.data(), bench.pool.transforms, bench.meshLods, bench.meshlets,
+		cameraCommandSettings(frustum), bench.commands, stats);
+	times.framesMs = lapMs();
+	return times;
+}
+
+BenchScene& sharedScene(uint64_t objectCount) {
+	if (!g_benchScene || g_benchScene->objectCount != objectCount) buildScene(objectCount);
+	return *g_benchScene;
+}
+
+// ========================================
+// Benchmarks
+
+ALLOCATION_COUNTER_REPLACE_OPERATORS
+
+// Set by benchmarks whose checks failed, the run then exits with 1
+bool g_benchFailed = false;
+
+// One build per iteration, later benchmarks keep using the last scene built
+void BM_SceneBuild(benchmark::State& state) {
+	BuildTimes times {};
+	for (auto _ : state) {
+		auto start = std::chrono::steady_clock::now();
+		times = buildScene(state.range(0));
+		state.SetIterationTime(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - times.framesMs / 1000.0);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["scene_ms"] = times.sceneMs;
+	state.counters["pool_ms"] = times.poolMs;
+	state.counters["bvh_ms"] = times.bvhMs;
+	state.counters["meshes_ms"] = times.meshesMs;
+}
+// Plus the demo's 50^3, 100^3 and 200^3 grids, the time to first frame sizes
+BENCHMARK(BM_SceneBuild)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->Arg(125000)->Arg(1000000)->Arg(8000000)->Iterations(1)->UseManualTime()->Unit(benchmark::kMillisecond);
+
+void BM_Aggregate(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	SubmissionQueues queues;
+	std::vector<uint32_t> objects;
+	for (auto _ : state) {
+		parallelFor(bench.handles.size(), 1 << 15, [&](size_t begin, size_t end) {
+			for (size_t i=begin; i<end; i++) queues.submit(bench.pool.slot(bench.handles[i]));
+		});
+		queues.merge(objects);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["queues"] = (double)queues.queueCount();
+}
+BENCHMARK(BM_Aggregate)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_Cull(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	Frustum frustum = cameraFrustum();
+	std::vector<uint32_t> visible;
+	visible.reserve(bench.handles.size());
+	for (auto _ : state) {
+		visible.clear();
+		bench.bvh.cullFrustum(frustum, visible);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["visible"] = (double)visible.size();
+}
+BENCHMARK(BM_Cull)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_Commands(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	Frustum frustum = cameraFrustum();
+	DrawCommandSettings settings = cameraCommandSettings(frustum);
+	std::vector<DrawArraysIndirectCommand> commands;
+	DrawCommandStats stats;
+	for (auto _ : state) {
+		commands.clear();
+		stats = DrawCommandStats();
+		generateDrawCommands(bench.visible.data(), bench.visible.size(), bench.pool.meshes.data(), bench.pool.positions.data(), bench.pool.transforms, bench.meshLods, bench.meshlets,
+			settings, commands, stats);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["commands"] = (double)commands.size();
+	state.counters["triangles"] = benchmark::Counter((double)stats.triangles, benchmark::Counter::kDefaults, benchmark::Counter::kIs1000);
+	state.counters["full_triangles"] = benchmark::Counter((double)stats.fullDetailTriangles, benchmark::Counter::kDefaults, benchmark::Counter::kIs1000);
+}
+BENCHMARK(BM_Commands)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Counting sort of the (light, object) pairs by object into per-object lists
+void BM_Lights(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	const float lightRadius = 5.0f;
+	auto& lights = bench.scene.lights;
+	size_t objectCount = bench.pool.highWater();
+	std::vector<uint32_t> lit;
+	std::vector<uint32_t> litEnds(lights.size());
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> objectLights;
+
+	for (auto _ : state) {
+		lit.clear();
+		for (size_t l=0; l<lights.size(); l++) {
+			bench.bvh.querySphere(lights[l].position, lightRadius, lit);
+			litEnds[l] = (uint32_t)lit.size();
+		}
+
+		offsets.assign(objectCount + 1, 0);
+		for (auto object : lit) offsets[object + 1]++;
+		for (size_t i=0; i<objectCount; i++) offsets[i + 1] += offsets[i];
+		objectLights.resize(lit.size());
+		for (size_t l=0, i=0; l<lights.size(); l++)
+			for (; i<litEnds[l]; i++) objectLights[offsets[lit[i]]++] = (uint32_t)l;
+		// Offsets now hold each list's end, shift back to starts
+		for (size_t i=objectCount; i>0; i--) offsets[i] = offsets[i - 1];
+		offsets[0] = 0;
+	}
+
+	size_t litObjects = 0;
+	for (size_t i=0; i<objectCount; i++) litObjects += offsets[i + 1] > offsets[i];
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["lights"] = (double)lights.size();
+	state.counters["lit_objects"] = (double)litObjects;
+	state.counters["pairs"] = (double)lit.size();
+}
+BENCHMARK(BM_Lights)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Each iteration starts again from the cull order (the copy is timed too, it is small next to the sort)
+void BM_SortKeys(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	RenderQueue queue;
+	std::vector<uint32_t> objects;
+	for (auto _ : state) {
+		objects.assign(bench.visible.begin(), bench.visible.end());
+		sortByRenderKey(queue, objects.data(), objects.size(), bench.pool.positions.data(), bench.pool.meshes.data(),
+			glm::value_ptr(CAMERA_POSITION), glm::value_ptr(CAMERA_FORWARD), 0, 0);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["keys"] = (double)objects.size();
+	state.counters["passes"] = (double)queue.sortPasses();
+}
+BENCHMARK(BM_SortKeys)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// The buffer writes syncObjectPool() and the frame resources make for a frame where 1% of the objects changed, through
+// the same upload code (src/object_uploads.hpp), including refilling the pool's dirty list
+void BM_Uploads(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	auto& pool = bench.pool;
+	size_t capacity = pool.capacity();
+
+	mockGl::reset();
+	mockGl::Buffer uniformsBuffer {mockGl::genBuffer(objectUniformsSize(capacity))};
+	mockGl::Buffer transformsBuffer {mockGl::genBuffer(sizeof(float) * capacity)};
+	mockGl::Buffer boundsBuffer {mockGl::genBuffer(sizeof(Aabb) * capacity)};
+	unsigned int rotationsBuffer = mockGl::genBuffer(sizeof(float) * 4 * capacity);
+	unsigned int indirectBuffer = mockGl::genBuffer(sizeof(DrawArraysIndirectCommand) * std::max<size_t>(bench.commands.size(), 1));
+	unsigned int cameraBuffer = mockGl::genBuffer(sizeof(glm::mat4) * 2);
+
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<uint32_t> slot(0, pool.highWater() - 1);
+	std::vector<uint32_t> changed(std::max<size_t>(pool.highWater() / 100, 1));
+	for (auto& s : changed) s = slot(gen);
+
+	pool.dirtySlots.reserve(changed.size());
+	uint64_t calls = 0, bytes = 0;
+	size_t runs = 0;
+	for (auto _ : state) {
+		mockGl::calls = mockGl::bytes = 0;
+		pool.dirtySlots.assign(changed.begin(), changed.end());
+		runs = uploadDirtySlots(pool, uniformsBuffer, transformsBuffer, boundsBuffer);
+
+		// Persistent mapped, plain copies as in writeFrameRotations(), writeFrameCommands() and writeFrameCamera()
+		copyObjectRotations(pool, (float*)mockGl::mapped(rotationsBuffer));
+		std::copy(bench.commands.begin(), bench.commands.end(), (DrawArraysIndirectCommand*)mockGl::mapped(indirectBuffer));
+		glm::mat4 camera[2] = {CAMERA_VIEW, CAMERA_PROJECTION};
+		std::memcpy(mockGl::mapped(cameraBuffer), camera, sizeof(camera));
+
+		calls = mockGl::calls;
+		bytes = mockGl::bytes + sizeof(float) * 4 * pool.highWater() + sizeof(DrawArraysIndirectCommand) * bench.commands.size() + sizeof(camera);
+	}
+	pool.dirtySlots.clear();
+	mockGl::reset();
+
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.SetBytesProcessed(state.iterations() * bytes);
+	state.counters["calls"] = (double)calls;
+	state.counters["runs"] = (double)runs;
+}
+BENCHMARK(BM_Uploads)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Position, color, rotation and scale set per object before its own draw, what one draw call per object needs
+void BM_Uniforms(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	auto& pool = bench.pool;
+	uint64_t calls = 0;
+	for (auto _ : state) {
+		mockGl::calls = mockGl::bytes = 0;
+		for (auto object : bench.visible) {
+			const float* position = &pool.positions[(size_t)object * 3];
+			const float* color = &pool.colors[(size_t)object * 3];
+			float positionScale[4] = {position[0], position[1], position[2], pool.transforms.scales[object]};
+			float colorMesh[4] = {color[0], color[1], color[2], (float)pool.meshes[object]};
+			mockGl::uniform4fv(0, positionScale);
+			mockGl::uniform4fv(1, colorMesh);
+			mockGl::uniform4fv(2, &pool.transforms.gpuRotations[(size_t)object * 4]);
+		}
+		calls = mockGl::calls;
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["calls"] = (double)calls;
+}
+BENCHMARK(BM_Uniforms)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// The CPU work of renderFrame() after warm-up frames, allocations are counted over every timed frame
+void BM_Frame(benchmark::State& state) {
+	auto& bench = sharedScene(state.range(0));
+	auto& pool = bench.pool;
+	SubmissionQueues queues;
+	FrameAllocator frameAllocator;
+	RenderQueue renderQueue;
+	std::vector<uint32_t> objects;
+	std::vector<unsigned char> visibleMask;
+	std::vector<DrawArraysIndirectCommand> commands;
+	std::vector<float> rotations(pool.transforms.gpuRotations.size());
+	std::vector<DrawArraysIndirectCommand> indirect;
+
+	Frustum frustum = cameraFrustum();
+	DrawCommandSettings settings = cameraCommandSettings(frustum);
+
+	// In renderFrame() order: spin, submit, merge, cull, sort, rotations, commands
+	auto frame = [&]() {
+		frameAllocator.reset();
+		pool.transforms.integrateAll(1.0f / 60.0f, pool.highWater());
+
+		parallelFor(bench.handles.size(), 1 << 15, [&](size_t begin, size_t end) {
+			for (size_t i=begin; i<end; i++) queues.submit(pool.slot(bench.handles[i]));
+		});
+		queues.merge(objects);
+
+		uint32_t* visible = frameAllocator.allocate<uint32_t>(bench.bvh.objectCount());
+		bench.bvh.cullSubmitted(frustum, visible, visibleMask, objects);
+		sortByRenderKey(renderQueue, objects.data(), objects.size(), pool.positions.data(), pool.meshes.data(),
+			glm::value_ptr(CAMERA_POSITION), glm::value_ptr(CAMERA_FORWARD), 0, 0);
+
+		// Persistent mapped buffers in the renderer, sized once
+		copyObjectRotations(pool, rotations.data());
+
+		commands.clear();
+		DrawCommandStats stats;
+		generateDrawCommands(objects.data(), objects.size(), pool.meshes.data(), pool.positions.data(), pool.transforms, bench.meshLods, bench.meshlets,
+			settings, commands, stats);
+		if (indirect.size() < commands.size()) indirect.resize(commands.size() + commands.size() / 4);
+		std::copy(commands.begin(), commands.end(), indirect.begin());
+	};
+
+	// Containers reach their working sizes and the worker pool starts
+	for (int i=0; i<2; i++) frame();
+
+	uint64_t allocationsBefore = allocationCount();
+	for (auto _ : state) frame();
+	uint64_t allocations = allocationCount() - allocationsBefore;
+
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+	state.counters["commands"] = (double)commands.size();
+	state.counters["allocations"] = benchmark::Counter((double)allocations, benchmark::Counter::kAvgIterations);
+	state.counters["arena_bytes"] = benchmark::Counter((double)frameAllocator.blockBytes(), benchmark::Counter::kDefaults, benchmark::Counter::kIs1024);
+	if (allocations) {
+		g_benchFailed = true;
+		state.SkipWithError("heap allocations in a steady state frame");
+	}
+}
+BENCHMARK(BM_Frame)->RangeMultiplier(8)->Range(1 << 10, 8 << 20)->Arg(125000)->Arg(1000000)->Arg(8000000)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// ========================================
+// Main
+
+int main(int argc, char** argv) {
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+	benchmark::AddCustomContext("worker_threads", std::to_string(workerCount()));
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return g_benchFailed ? 1 : 0;
+}
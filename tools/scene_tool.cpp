@@ -0,0 +1,677 @@
+// Writes and validates .mdis scene files (see src/scene_format.hpp)
+//
+//	scene_tool write <out.mdis> [--grid X Y Z] [--lights N] [--seed S] [--spread F] [--mesh file.obj|file.glb]...
+//	scene_tool validate <scene.mdis>
+//	scene_tool bench-import <file.obj|file.glb>... [--iterations N]
+//	scene_tool bench-bvh [--grid X Y Z] [--iterations N]
+//	scene_tool bench-vertex [file.obj|file.glb]... [--iterations N]
+//	scene_tool bench-transforms [--objects N] [--iterations N]
+//	scene_tool bench-pool [--grid X Y Z] [--spawn N]
+//	scene_tool bench-sort [--grid X Y Z] [--iterations N]
+//	scene_tool bench-submit [--objects N] [--iterations N]
+//	scene_tool bench-profiler [--zones N] [--threads N] [--trace out.json]
+//	scene_tool bench-spsc [--items N]
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <iomanip>
+#include <fstream>
+#include <thread>
+
+#include "scene_format.hpp"
+#include "grid_scene.hpp"
+#include "mesh_import.hpp"
+#include "bvh.hpp"
+#include "vertex_format.hpp"
+#include "object_pool.hpp"
+#include "render_queue.hpp"
+#include "submission_queue.hpp"
+#include "cpu_profiler.hpp"
+#include "spsc_queue.hpp"
+
+#include <extern/glm/glm.hpp>
+#include <extern/glm/gtc/matrix_transform.hpp>
+#include <extern/glm/gtc/type_ptr.hpp>
+
+int usage() {
+	std::cout << "Usage:\n"
+		<< "  scene_tool write <out.mdis> [--grid X Y Z] [--lights N] [--seed S] [--spread F] [--mesh file.obj|file.glb]...\n"
+		<< "  scene_tool validate <scene.mdis>\n"
+		<< "  scene_tool bench-import <file.obj|file.glb>... [--iterations N]\n"
+		<< "  scene_tool bench-bvh [--grid X Y Z] [--iterations N]\n"
+		<< "  scene_tool bench-vertex [file.obj|file.glb]... [--iterations N]\n"
+		<< "  scene_tool bench-transforms [--objects N] [--iterations N]\n"
+		<< "  scene_tool bench-pool [--grid X Y Z] [--spawn N]\n"
+		<< "  scene_tool bench-sort [--grid X Y Z] [--iterations N]\n"
+		<< "  scene_tool bench-submit [--objects N] [--iterations N]\n"
+		<< "  scene_tool bench-profiler [--zones N] [--threads N] [--trace out.json]\n"
+		<< "  scene_tool bench-spsc [--items N]\n";
+	return 1;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int writeCommand(int argc, char** argv) {
+	std::string path = argv[2];
+	unsigned int x = 50, y = 50, z = 50;
+	unsigned int lights = 200;
+	unsigned int seed = 0;
+	float spread = 2.0f;
+	std::vector<std::vector<float>> meshes;
+
+	for (int i=3; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--grid" && i + 3 < argc) {
+			x = std::stoul(argv[++i]);
+			y = std::stoul(argv[++i]);
+			z = std::stoul(argv[++i]);
+		}
+		else if (option == "--lights" && i + 1 < argc) lights = std::stoul(argv[++i]);
+		else if (option == "--seed" && i + 1 < argc) seed = std::stoul(argv[++i]);
+		else if (option == "--spread" && i + 1 < argc) spread = std::stof(argv[++i]);
+		else if (option == "--mesh" && i + 1 < argc) {
+			meshes.emplace_back();
+			auto error = importMesh(argv[++i], meshes.back());
+			if (!error.empty()) {
+				std::cout << "Import failed: " << error << "\n";
+				return 1;
+			}
+			fitMeshToUnitCube(meshes.back());
+		}
+		else return usage();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	auto scene = generateGridScene(x, y, z, lights, seed, spread, meshes);
+	auto generateMs = millisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	auto error = writeScene(path, scene.view());
+	if (!error.empty()) {
+		std::cout << "Write failed: " << error << "\n";
+		return 1;
+	}
+
+	std::cout << "Wrote " << path << ": " << scene.objectMeshes.size() << " objects, " << scene.meshes.size() << " meshes, "
+		<< scene.lights.size() << " lights (generated in " << generateMs << " ms, written in " << millisecondsSince(start) << " ms)\n";
+	return 0;
+}
+
+int validateCommand(char** argv) {
+	auto start = std::chrono::steady_clock::now();
+
+	MappedScene scene;
+	auto error = scene.open(argv[2]);
+	if (!error.empty()) {
+		std::cout << "Invalid: " << error << "\n";
+		return 1;
+	}
+
+	auto& view = scene.view();
+	std::cout << "Valid scene, version " << SCENE_VERSION << ", " << scene.fileSize() << " bytes\n"
+		<< "  vertices: " << view.vertexCount << "\n"
+		<< "  meshes:   " << view.meshCount << "\n"
+		<< "  objects:  " << view.objectCount << "\n"
+		<< "  lights:   " << view.lightCount << "\n"
+		<< "Mapped and validated in " << millisecondsSince(start) << " ms\n";
+	return 0;
+}
+
+int benchImportCommand(int argc, char** argv) {
+	std::vector<std::string> paths;
+	unsigned int iterations = 10;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else paths.push_back(option);
+	}
+	if (paths.empty()) return usage();
+
+	// Output is reused across iterations so the timing covers parsing rather than growing the vector
+	std::vector<float> vertices;
+	for (auto& path : paths) {
+		MeshImportStats stats;
+		double bestMs = INFINITY;
+		for (unsigned int i=0; i<iterations; i++) {
+			vertices.clear();
+			stats = MeshImportStats();
+			auto start = std::chrono::steady_clock::now();
+			auto error = importMesh(path, vertices, &stats);
+			bestMs = std::min(bestMs, millisecondsSince(start));
+			if (!error.empty()) {
+				std::cout << "Import failed: " << error << "\n";
+				return 1;
+			}
+		}
+
+		double seconds = bestMs / 1000.0;
+		std::cout << path << ": " << stats.bytes << " bytes, " << stats.triangles << " triangles, " << stats.generatedNormals << " generated normals\n"
+			<< "  best of " << iterations << ": " << bestMs << " ms, " << stats.bytes / seconds / (1024.0 * 1024.0) << " MB/s, "
+			<< stats.triangles / seconds / 1e6 << " M triangles/s\n";
+	}
+	return 0;
+}
+
+// Best time of several runs, setup runs before each timed call
+template <typename Setup, typename Fn>
+double bestMilliseconds(unsigned int iterations, Setup&& setup, Fn&& fn) {
+	double best = INFINITY;
+	for (unsigned int i=0; i<iterations; i++) {
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		best = std::min(best, millisecondsSince(start));
+	}
+	return best;
+}
+
+int benchBvhCommand(int argc, char** argv) {
+	unsigned int x = 50, y = 50, z = 50;
+	unsigned int iterations = 5;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--grid" && i + 3 < argc) {
+			x = std::stoul(argv[++i]);
+			y = std::stoul(argv[++i]);
+			z = std::stoul(argv[++i]);
+		}
+		else if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else return usage();
+	}
+
+	auto scene = generateGridScene(x, y, z, 1000, 0);
+	auto bounds = computeObjectBounds(scene.view());
+	uint32_t objectCount = (uint32_t)bounds.size();
+	std::cout << objectCount << " objects, " << workerCount() << " threads, best of " << iterations << "\n";
+
+	Bvh bvh;
+	double buildMs = bestMilliseconds(iterations, []() {}, [&]() { bvh.build(bounds); });
+	std::cout << "  build:            " << buildMs << " ms, " << bvh.nodeCount() << " nodes, SAH cost " << bvh.sahCost() << "\n";
+
+	// Objects jitter by up to half a unit, small enough that the tree is refit rather than rebuilt
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+	auto moved = [&](uint32_t object) {
+		Aabb b = bounds[object];
+		for (int axis=0; axis<3; axis++) {
+			float offset = jitter(gen);
+			b.min[axis] += offset;
+			b.max[axis] += offset;
+		}
+		return b;
+	};
+	bvh.rebuildThreshold = INFINITY;
+	double fullRefitMs = bestMilliseconds(iterations, [&]() { for (uint32_t i=0; i<objectCount; i++) bvh.setObjectBounds(i, moved(i)); }, [&]() { bvh.refit(); });
+	double partialRefitMs = bestMilliseconds(iterations, [&]() { for (uint32_t i=0; i<objectCount; i+=100) bvh.setObjectBounds(i, moved(i)); }, [&]() { bvh.refit(); });
+	std::cout << "  refit all:        " << fullRefitMs << " ms, SAH cost " << bvh.sahCost() << "\n"
+		<< "  refit 1%:         " << partialRefitMs << " ms\n";
+
+	// The demo camera: at the origin looking down +z at the grid
+	glm::mat4 viewProjection = glm::perspective<float>(45.0f, 1400.0f/900.0f, 0.1f, 300.0f) * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum(glm::value_ptr(viewProjection));
+	std::vector<uint32_t> visible;
+	visible.reserve(objectCount);
+	double cullMs = bestMilliseconds(iterations, [&]() { visible.clear(); }, [&]() { bvh.cullFrustum(frustum, visible); });
+	std::cout << "  frustum cull:     " << cullMs << " ms, " << visible.size() << " visible\n";
+
+	const unsigned int rayCount = 10000;
+	std::vector<glm::vec3> rayDirections(rayCount);
+	std::uniform_real_distribution<float> spread(-0.4f, 0.4f);
+	for (auto& direction : rayDirections) direction = glm::normalize(glm::vec3(spread(gen), spread(gen), 1.0f));
+	unsigned int rayHits = 0;
+	double rayMs = bestMilliseconds(iterations, [&]() { rayHits = 0; }, [&]() {
+		float origin[3] = {0.0f, 0.0f, 0.0f};
+		uint32_t object;
+		float distance;
+		for (auto& direction : rayDirections) rayHits += bvh.raycast(origin, glm::value_ptr(direction), 1000.0f, object, distance);
+	});
+	std::cout << "  raycast:          " << rayMs * 1000.0 / rayCount << " us/ray, " << rayHits << "/" << rayCount << " hit\n";
+
+	// Objects within reach of each light
+	const float lightRadius = 5.0f;
+	std::vector<uint32_t> lit;
+	double lightMs = bestMilliseconds(iterations, [&]() { lit.clear(); }, [&]() {
+		for (auto& light : scene.lights) bvh.querySphere(light.position, lightRadius, lit);
+	});
+	std::cout << "  light queries:    " << lightMs * 1000.0 / scene.lights.size() << " us/light, " << (double)lit.size() / scene.lights.size() << " objects/light\n";
+	return 0;
+}
+
+// Compares the GPU vertex formats (see src/vertex_format.hpp): size, encode time, a CPU streaming read of the buffer as
+// a stand in for vertex fetch bandwidth, and the quantisation error
+int benchVertexCommand(int argc, char** argv) {
+	std::vector<std::string> paths;
+	unsigned int iterations = 10;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else paths.push_back(option);
+	}
+
+	// Without meshes the grid scene's cube is replicated to a few million vertices so timings aren't cache resident
+	std::vector<float> vertices;
+	for (auto& path : paths) {
+		auto error = importMesh(path, vertices);
+		if (!error.empty()) {
+			std::cout << "Import failed: " << error << "\n";
+			return 1;
+		}
+	}
+	if (paths.empty()) {
+		auto cube = generateGridScene(1, 1, 1, 0, 0).vertices;
+		for (int i=0; i<100000; i++) vertices.insert(vertices.end(), cube.begin(), cube.end());
+	}
+	uint64_t vertexCount = vertices.size() / SCENE_FLOATS_PER_VERTEX;
+	std::cout << vertexCount << " vertices, best of " << iterations << "\n";
+
+	MeshQuantisation quantisation = computeMeshQuantisation(vertices.data(), vertexCount);
+	std::vector<QuantisedVertex> quantised(vertexCount);
+	double encodeMs = bestMilliseconds(iterations, []() {}, [&]() { quantiseVertices(vertices.data(), vertexCount, quantisation, quantised.data()); });
+
+	auto unpackSnorm10 = [](uint32_t bits) { return std::max((float)((int32_t)(bits << 22) >> 22) / 511.0f, -1.0f); };
+
+	// The GPU's vertex fetch decodes normalised formats for free, so the read is a raw stream over the buffer's words
+	auto streamWords = [](const void* data, uint64_t bytes) {
+		const uint32_t* words = (const uint32_t*)data;
+		uint32_t sum = 0;
+		for (uint64_t i=0; i<bytes/4; i++) sum += words[i];
+		return sum;
+	};
+	volatile uint32_t sink = 0;
+	double floatReadMs = bestMilliseconds(iterations, []() {}, [&]() { sink = streamWords(vertices.data(), sizeof(float) * vertices.size()); });
+	double quantisedReadMs = bestMilliseconds(iterations, []() {}, [&]() { sink = streamWords(quantised.data(), sizeof(QuantisedVertex) * quantised.size()); });
+	(void)sink;
+
+	// Position error relative to the largest extent, normal error as an angle
+	float maxExtent = std::max({quantisation.halfExtent[0], quantisation.halfExtent[1], quantisation.halfExtent[2]}) * 2.0f;
+	double maxPositionError = 0.0, maxNormalDegrees = 0.0;
+	for (uint64_t v=0; v<vertexCount; v++) {
+		const float* vertex = vertices.data() + v*SCENE_FLOATS_PER_VERTEX;
+		for (int axis=0; axis<3; axis++) {
+			float decoded = quantisation.center[axis] + quantised[v].position[axis] / 32767.0f * quantisation.halfExtent[axis];
+			maxPositionError = std::max(maxPositionError, (double)std::abs(decoded - vertex[axis]) / maxExtent);
+		}
+
+		glm::vec3 normal(vertex[3], vertex[4], vertex[5]);
+		if (glm::length(normal) == 0.0f) continue;
+		uint32_t packed = quantised[v].normal;
+		glm::vec3 decoded(unpackSnorm10(packed), unpackSnorm10(packed >> 10), unpackSnorm10(packed >> 20));
+		float cosine = glm::clamp(glm::dot(glm::normalize(normal), glm::normalize(decoded)), -1.0f, 1.0f);
+		maxNormalDegrees = std::max(maxNormalDegrees, (double)glm::degrees(std::acos(cosine)));
+	}
+
+	for (auto format : {VERTEX_FORMAT_FLOAT, VERTEX_FORMAT_QUANTISED}) {
+		double bytes = (double)vertexFormatSize(format) * vertexCount;
+		double readMs = format == VERTEX_FORMAT_FLOAT ? floatReadMs : quantisedReadMs;
+		std::cout << "  " << vertexFormatName(format) << ": " << vertexFormatSize(format) << " bytes/vertex, " << bytes / (1024.0 * 1024.0) << " MB, read "
+			<< readMs << " ms (" << bytes / (readMs / 1000.0) / (1024.0 * 1024.0 * 1024.0) << " GB/s)\n";
+	}
+	std::cout << "  encode:           " << encodeMs << " ms, " << vertexCount / (encodeMs / 1000.0) / 1e6 << " M vertices/s\n"
+		<< "  position error:   " << maxPositionError << " of the mesh extent\n"
+		<< "  normal error:     " << maxNormalDegrees << " degrees\n";
+	return 0;
+}
+
+// Per frame spin update of every object's rotation (see src/object_transforms.hpp), single threaded
+int benchTransformsCommand(int argc, char** argv) {
+	uint64_t objectCount = 125000;
+	unsigned int iterations = 100;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--objects" && i + 1 < argc) objectCount = std::stoull(argv[++i]);
+		else if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else return usage();
+	}
+
+	const float deltaTime = 1.0f / 60.0f;
+	ObjectTransforms transforms;
+	transforms.init(objectCount, 1, 2.0f);
+	double updateMs = bestMilliseconds(iterations, []() {}, [&]() { transforms.integrate(deltaTime, 0, objectCount); });
+	std::cout << objectCount << " objects, best of " << iterations << "\n"
+		<< "  update:           " << updateMs << " ms, " << updateMs * 1e6 / std::max<uint64_t>(objectCount, 1) << " ns/object"
+	#ifdef OBJECT_TRANSFORMS_SSE
+		<< " (SSE)\n";
+	#else
+		<< " (scalar)\n";
+	#endif
+
+	// With a constant angular velocity from identity the exact rotation is the axis angle one, the integrator's drift
+	// after a minute at 60 Hz
+	transforms.init(objectCount, 1, 2.0f);
+	const unsigned int steps = 3600;
+	for (unsigned int step=0; step<steps; step++) transforms.integrate(deltaTime, 0, objectCount);
+	double maxDegrees = 0.0;
+	for (uint64_t i=0; i<objectCount; i++) {
+		glm::vec3 angular(transforms.angularX[i], transforms.angularY[i], transforms.angularZ[i]);
+		float angle = glm::length(angular) * deltaTime * steps;
+		glm::vec3 axis = glm::normalize(angular) * std::sin(angle * 0.5f);
+		float exactDot = axis.x * transforms.rotationX[i] + axis.y * transforms.rotationY[i] + axis.z * transforms.rotationZ[i] + std::cos(angle * 0.5f) * transforms.rotationW[i];
+		maxDegrees = std::max(maxDegrees, (double)glm::degrees(2.0f * std::acos(std::min(std::abs(exactDot), 1.0f))));
+	}
+	std::cout << "  drift after " << steps << " steps: " << maxDegrees << " degrees\n";
+	return 0;
+}
+
+// Runtime spawn / despawn through the object pool (see src/object_pool.hpp) and compacting the holes left behind
+int benchPoolCommand(int argc, char** argv) {
+	unsigned int x = 50, y = 50, z = 50;
+	uint32_t spawnCount = 100000;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--grid" && i + 3 < argc) {
+			x = std::stoul(argv[++i]);
+			y = std::stoul(argv[++i]);
+			z = std::stoul(argv[++i]);
+		}
+		else if (option == "--spawn" && i + 1 < argc) spawnCount = std::max(1ul, std::stoul(argv[++i]));
+		else return usage();
+	}
+
+	auto scene = generateGridScene(x, y, z, 0, 0);
+	auto start = std::chrono::steady_clock::now();
+	ObjectPool pool;
+	pool.init(scene.view(), 1, 2.0f);
+	std::cout << scene.objectMeshes.size() << " scene objects, pool init " << millisecondsSince(start) << " ms\n";
+
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<float> unit(-100.0f, 100.0f);
+	std::vector<ObjectHandle> handles(spawnCount);
+	start = std::chrono::steady_clock::now();
+	for (auto& handle : handles) {
+		float position[3] = {unit(gen), unit(gen), unit(gen)}, color[3] = {1.0f, 1.0f, 1.0f};
+		handle = pool.spawn(position, color, (uint32_t)(gen() % scene.meshes.size()));
+	}
+	double spawnMs = millisecondsSince(start);
+	std::cout << "  spawn:            " << spawnMs * 1e6 / spawnCount << " ns/object (" << pool.capacity() << " slots after growth)\n";
+
+	// Every other scene object and spawned object, the worst case for holes
+	std::vector<ObjectHandle> despawned;
+	for (uint32_t i=0; i<scene.objectMeshes.size(); i+=2) despawned.push_back({i, 0});
+	for (uint32_t i=0; i<spawnCount; i+=2) despawned.push_back(handles[i]);
+	pool.dirtySlots.clear();
+	start = std::chrono::steady_clock::now();
+	for (auto handle : despawned) pool.despawn(handle);
+	double despawnMs = millisecondsSince(start);
+	std::cout << "  despawn:          " << despawnMs * 1e6 / despawned.size() << " ns/object, " << pool.fragmentation() * 100.0f << "% holes\n";
+
+	// At the renderer's per frame budget until below the threshold
+	uint32_t frames = 0, moved = 0;
+	start = std::chrono::steady_clock::now();
+	for (uint32_t step; (step = pool.compact(4096)) > 0; frames++) moved += step;
+	double compactMs = millisecondsSince(start);
+	std::cout << "  compaction:       " << moved << " objects moved over " << frames << " frames, " << compactMs / std::max(frames, 1u) << " ms/frame, "
+		<< pool.fragmentation() * 100.0f << "% holes left, " << pool.dirtySlots.size() << " slot uploads\n";
+	return 0;
+}
+
+// Render queue keys for every grid object seen from a corner of the grid (see src/render_queue.hpp), radix sorted
+// against std::stable_sort of the same pairs
+int benchSortCommand(int argc, char** argv) {
+	unsigned int x = 50, y = 50, z = 50;
+	unsigned int iterations = 20;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--grid" && i + 3 < argc) {
+			x = std::stoul(argv[++i]);
+			y = std::stoul(argv[++i]);
+			z = std::stoul(argv[++i]);
+		}
+		else if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else return usage();
+	}
+
+	auto scene = generateGridScene(x, y, z, 0, 0);
+	auto view = scene.view();
+	glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+	for (uint64_t i=0; i<view.objectCount; i++) {
+		glm::vec3 position = glm::make_vec3(view.objectPositions + i*3);
+		boundsMin = glm::min(boundsMin, position);
+		boundsMax = glm::max(boundsMax, position);
+	}
+	glm::vec3 cameraPosition = boundsMin, forward = glm::normalize(boundsMax - boundsMin);
+
+	std::vector<uint64_t> keys(view.objectCount);
+	for (uint64_t i=0; i<view.objectCount; i++) {
+		float viewDepth = glm::dot(glm::make_vec3(view.objectPositions + i*3) - cameraPosition, forward);
+		keys[i] = makeRenderKey(0, VERTEX_FORMAT_QUANTISED, viewDepth, view.objectMeshes[i]);
+	}
+
+	RenderQueue queue;
+	auto fill = [&]() {
+		queue.clear();
+		for (uint64_t i=0; i<view.objectCount; i++) queue.push(keys[i], (uint32_t)i);
+	};
+	double radixMs = bestMilliseconds(iterations, fill, [&]() { queue.sort(); });
+
+	std::vector<std::pair<uint64_t, uint32_t>> pairs(view.objectCount), referencePairs;
+	for (uint64_t i=0; i<view.objectCount; i++) pairs[i] = {keys[i], (uint32_t)i};
+	double stdMs = bestMilliseconds(iterations, [&]() { referencePairs = pairs; }, [&]() {
+		std::stable_sort(referencePairs.begin(), referencePairs.end(), [](auto& a, auto& b) { return a.first < b.first; });
+	});
+
+	bool matches = true;
+	for (uint64_t i=0; i<view.objectCount; i++) matches = matches && queue.sortedObjects()[i] == referencePairs[i].second;
+
+	std::cout << view.objectCount << " objects, best of " << iterations << ", " << workerCount() << " workers\n"
+		<< "  radix sort:       " << radixMs << " ms, " << queue.sortPasses() << " digit passes\n"
+		<< "  std::stable_sort: " << stdMs << " ms\n"
+		<< "  order:            " << (matches ? "matches" : "DIFFERS") << "\n";
+	return matches ? 0 : 1;
+}
+
+// Objects submitted from 1 to 32 threads at once through per thread queues (see src/submission_queue.hpp) and merged,
+// against the same threads pushing into one mutex guarded vector. The demo's parallelFor runs on a worker pool sized to
+// the cores, so to go past that count threads are started per iteration here, outside the timed span, and start
+// submitting together
+int benchSubmitCommand(int argc, char** argv) {
+	uint32_t objectCount = 1000000;
+	unsigned int iterations = 10;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--objects" && i + 1 < argc) objectCount = std::stoul(argv[++i]);
+		else if (option == "--iterations" && i + 1 < argc) iterations = std::max(1ul, std::stoul(argv[++i]));
+		else return usage();
+	}
+
+	// Wall time from the start signal until the last thread has submitted
+	auto submitMilliseconds = [&](unsigned int threadCount, auto&& submitRange) {
+		std::atomic<bool> go {false};
+		std::atomic<unsigned int> done {0};
+		std::vector<std::thread> threads;
+		for (unsigned int t=0; t<threadCount; t++)
+			threads.emplace_back([&, t]() {
+				while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+				submitRange((uint32_t)((uint64_t)objectCount * t / threadCount), (uint32_t)((uint64_t)objectCount * (t + 1) / threadCount));
+				done.fetch_add(1, std::memory_order_release);
+			});
+		auto start = std::chrono::steady_clock::now();
+		go.store(true, std::memory_order_release);
+		while (done.load(std::memory_order_acquire) < threadCount) std::this_thread::yield();
+		double ms = millisecondsSince(start);
+		for (auto& thread : threads) thread.join();
+		return ms;
+	};
+
+	std::cout << objectCount << " objects, best of " << iterations << ", " << std::thread::hardware_concurrency() << " hardware threads\n"
+		<< "  threads   queues submit ms   merge ms   M objects/s   mutex vector ms\n";
+
+	SubmissionQueues queues;
+	std::vector<uint32_t> merged;
+	std::vector<unsigned char> seen;
+	bool complete = true;
+	for (unsigned int threadCount=1; threadCount<=32; threadCount*=2) {
+		double submitMs = INFINITY, mergeMs = INFINITY;
+		for (unsigned int i=0; i<iterations; i++) {
+			submitMs = std::min(submitMs, submitMilliseconds(threadCount, [&](uint32_t begin, uint32_t end) {
+				auto& local = queues.local();
+				for (uint32_t object=begin; object<end; object++) local.push_back(object);
+			}));
+			auto start = std::chrono::steady_clock::now();
+			queues.merge(merged);
+			mergeMs = std::min(mergeMs, millisecondsSince(start));
+		}
+
+		// Every object exactly once
+		seen.assign(objectCount, 0);
+		for (auto object : merged) if (object < objectCount) seen[object]++;
+		complete = complete && merged.size() == objectCount && std::all_of(seen.begin(), seen.end(), [](unsigned char count) { return count == 1; });
+
+		std::mutex mutex;
+		std::vector<uint32_t> shared;
+		double mutexMs = INFINITY;
+		for (unsigned int i=0; i<iterations; i++) {
+			shared.clear();
+			mutexMs = std::min(mutexMs, submitMilliseconds(threadCount, [&](uint32_t begin, uint32_t end) {
+				for (uint32_t object=begin; object<end; object++) {
+					std::lock_guard<std::mutex> lock(mutex);
+					shared.push_back(object);
+				}
+			}));
+		}
+
+		std::cout << std::fixed << std::setprecision(3) << "  " << std::setw(7) << threadCount << std::setw(9) << queues.queueCount()
+			<< std::setw(10) << submitMs << std::setw(11) << mergeMs << std::setw(14) << std::setprecision(1) << objectCount / ((submitMs + mergeMs) / 1000.0) / 1e6
+			<< std::setw(18) << std::setprecision(3) << mutexMs << "\n";
+	}
+	std::cout << "  merged output: " << (complete ? "complete" : "MISSING OR DUPLICATED OBJECTS") << "\n";
+	return complete ? 0 : 1;
+}
+
+// Cost of an empty CPU_PROFILE_ZONE (see src/cpu_profiler.hpp) on one thread and on several at once, plus the raw
+// timestamp sources
+int benchProfilerCommand(int argc, char** argv) {
+	uint64_t zoneCount = 10000000;
+	unsigned int threadCount = 4;
+	std::string tracePath;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--zones" && i + 1 < argc) zoneCount = std::max(1ull, std::stoull(argv[++i]));
+		else if (option == "--threads" && i + 1 < argc) threadCount = std::max(1ul, std::stoul(argv[++i]));
+		else if (option == "--trace" && i + 1 < argc) tracePath = argv[++i];
+		else return usage();
+	}
+
+	auto zones = [](uint64_t count) {
+		for (uint64_t i=0; i<count; i++) {
+			CPU_PROFILE_ZONE("bench zone");
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	zones(zoneCount);
+	double singleMs = millisecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (unsigned int t=0; t<threadCount; t++) threads.emplace_back(zones, zoneCount / threadCount);
+	for (auto& thread : threads) thread.join();
+	double threadedMs = millisecondsSince(start);
+
+	volatile uint64_t sink = 0;
+	start = std::chrono::steady_clock::now();
+	for (uint64_t i=0; i<zoneCount; i++) sink = sink + cpuProfilerTimestamp();
+	double timestampMs = millisecondsSince(start);
+	start = std::chrono::steady_clock::now();
+	for (uint64_t i=0; i<zoneCount; i++) sink = sink + std::chrono::steady_clock::now().time_since_epoch().count();
+	double steadyClockMs = millisecondsSince(start);
+
+	std::cout << zoneCount << " zones, " << std::thread::hardware_concurrency() << " hardware threads\n"
+	#ifdef CPU_PROFILER_RDTSC
+		<< "  timestamp source: rdtsc, " << CpuProfiler::instance().ticksPerMicrosecond() << " ticks/us\n"
+	#else
+		<< "  timestamp source: steady_clock\n"
+	#endif
+		<< "  zone, 1 thread:   " << singleMs * 1e6 / zoneCount << " ns\n"
+		<< "  zone, " << threadCount << " threads:  " << threadedMs * 1e6 / zoneCount << " ns (wall time per zone)\n"
+		<< "  timestamp read:   " << timestampMs * 1e6 / zoneCount << " ns (zone bookkeeping " << (singleMs - 2.0 * timestampMs) * 1e6 / zoneCount << " ns)\n"
+		<< "  steady_clock:     " << steadyClockMs * 1e6 / zoneCount << " ns\n";
+
+	if (!tracePath.empty()) {
+		std::ofstream trace(tracePath);
+		uint64_t written = CpuProfiler::instance().writeChromeTrace(trace);
+		std::cout << "  wrote " << written << " zones to " << tracePath << "\n";
+	}
+	return 0;
+}
+
+// Hand-off through the frame packet queue (see src/spsc_queue.hpp): streaming throughput between two threads, and the
+// round trip of one item bounced between two queues
+int benchSpscCommand(int argc, char** argv) {
+	uint64_t itemCount = 10000000;
+	for (int i=2; i<argc; i++) {
+		std::string option = argv[i];
+		if (option == "--items" && i + 1 < argc) itemCount = std::max(1ull, std::stoull(argv[++i]));
+		else return usage();
+	}
+
+	static SpscQueue<uint64_t, 1024> stream;
+	uint64_t sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::thread consumer([&]() {
+		uint64_t value;
+		for (uint64_t received=0; received<itemCount;) {
+			if (stream.tryPop(value)) {
+				sum += value;
+				received++;
+			}
+			else std::this_thread::yield();
+		}
+	});
+	for (uint64_t i=0; i<itemCount; i++) {
+		uint64_t value = i;
+		while (!stream.tryPush(std::move(value))) std::this_thread::yield();
+	}
+	consumer.join();
+	double streamMs = millisecondsSince(start);
+	bool complete = sum == itemCount * (itemCount - 1) / 2;
+
+	static SpscQueue<uint64_t, 2> ping, pong;
+	const uint64_t roundTrips = std::min<uint64_t>(itemCount, 100000);
+	start = std::chrono::steady_clock::now();
+	std::thread echo([&]() {
+		uint64_t value;
+		for (uint64_t i=0; i<roundTrips; i++) {
+			while (!ping.tryPop(value)) std::this_thread::yield();
+			while (!pong.tryPush(std::move(value))) std::this_thread::yield();
+		}
+	});
+	for (uint64_t i=0; i<roundTrips; i++) {
+		uint64_t value = i;
+		while (!ping.tryPush(std::move(value))) std::this_thread::yield();
+		while (!pong.tryPop(value)) std::this_thread::yield();
+	}
+	echo.join();
+	double roundTripMs = millisecondsSince(start);
+
+	std::cout << itemCount << " items, " << std::thread::hardware_concurrency() << " hardware threads\n"
+		<< "  stream:           " << itemCount / (streamMs / 1000.0) / 1e6 << " M items/s (" << (complete ? "complete" : "ITEMS LOST") << ")\n"
+		<< "  round trip:       " << roundTripMs * 1e3 / roundTrips << " us\n";
+	return complete ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) return usage();
+
+	std::string command = argv[1];
+	if (command != "bench-bvh" && command != "bench-vertex" && command != "bench-transforms" && command != "bench-pool" && command != "bench-sort" && command != "bench-submit" && command != "bench-profiler" && command != "bench-spsc" && argc < 3) return usage();
+	if (command == "write") return writeCommand(argc, argv);
+	if (command == "validate") return validateCommand(argv);
+	if (command == "bench-import") return benchImportCommand(argc, argv);
+	if (command == "bench-bvh") return benchBvhCommand(argc, argv);
+	if (command == "bench-vertex") return benchVertexCommand(argc, argv);
+	if (command == "bench-transforms") return benchTransformsCommand(argc, argv);
+	if (command == "bench-pool") return benchPoolCommand(argc, argv);
+	if (command == "bench-sort") return benchSortCommand(argc, argv);
+	if (command == "bench-submit") return benchSubmitCommand(argc, argv);
+	if (command == "bench-profiler") return benchProfilerCommand(argc, argv);
+	if (command == "bench-spsc") return benchSpscCommand(argc, argv);
+	return usage();
+}